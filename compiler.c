@@ -38,37 +38,225 @@ along with Water.  If not, see <http://www.gnu.org/licenses/>.
 #include <getopt.h>
 #include <libgen.h>
 #include <limits.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-static inline bool cell_Create(H2oCell *target) {
+// the smallest block the arena asks malloc for
+#define WATER_BLOCK (64 * 1024)
+
+// allocate zeroed memory that lives until arena_Free
+static bool arena_Alloc(H2oArena arena, size_t size, void *target) {
+    if (!arena)  return false;
+    if (!target) return false;
+
+    size_t align = __alignof__(max_align_t);
+
+    size = (size + (align - 1)) & ~(align - 1);
+
+    if (!arena->block || (size_t) (arena->limit - arena->cursor) < size) {
+        size_t   length = (size < WATER_BLOCK ? WATER_BLOCK : size);
+        H2oBlock block  = malloc(sizeof(struct water_block) + length);
+
+        if (!block) return false;
+
+        block->next = arena->block;
+        block->size = length;
+
+        arena->block  = block;
+        arena->cursor = block->start;
+        arena->limit  = block->start + length;
+    }
+
+    void *result = arena->cursor;
+
+    arena->cursor += size;
+
+    memset(result, 0, size);
+
+    *((void **) target) = result;
+
+    return true;
+}
+
+static void arena_Free(H2oArena arena) {
+    if (!arena) return;
+
+    H2oBlock block = arena->block;
+
+    while (block) {
+        H2oBlock next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->block  = 0;
+    arena->cursor = 0;
+    arena->limit  = 0;
+}
+
+// FNV-1a
+static inline unsigned text_Hash(const char *text, unsigned length) {
+    unsigned hash = 2166136261u;
+
+    for ( ; length-- ; ++text) {
+        hash ^= (unsigned char) *text;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static bool hash_Init(H2oArena arena, unsigned size, H2oHash hash) {
+    if (!hash) return false;
+
+    unsigned buckets = 16;
+
+    while (buckets < size) buckets *= 2;
+
+    hash->arena   = arena;
+    hash->count   = 0;
+    hash->size    = buckets;
+    hash->buckets = calloc(buckets, sizeof(H2oEntry));
+
+    return 0 != hash->buckets;
+}
+
+static void hash_Free(H2oHash hash) {
+    if (!hash) return;
+
+    free(hash->buckets);
+
+    hash->buckets = 0;
+    hash->count   = 0;
+    hash->size    = 0;
+}
+
+static inline H2oEntry hash_Entry(H2oHash hash, const char *key, unsigned length, unsigned code) {
+    H2oEntry entry = hash->buckets[code & (hash->size - 1)];
+
+    for ( ; entry ; entry = entry->next) {
+        if (code   != entry->hash)   continue;
+        if (length != entry->length) continue;
+        if (memcmp(key, entry->key, length)) continue;
+        return entry;
+    }
+
+    return 0;
+}
+
+// double the buckets (the entries stay where they are)
+static bool hash_Grow(H2oHash hash) {
+    unsigned  size    = hash->size * 2;
+    H2oEntry *buckets = calloc(size, sizeof(H2oEntry));
+
+    if (!buckets) return false;
+
+    unsigned index = 0;
+
+    for ( ; index < hash->size ; ++index) {
+        H2oEntry entry = hash->buckets[index];
+        while (entry) {
+            H2oEntry next = entry->next;
+            entry->next = buckets[entry->hash & (size - 1)];
+            buckets[entry->hash & (size - 1)] = entry;
+            entry = next;
+        }
+    }
+
+    free(hash->buckets);
+
+    hash->buckets = buckets;
+    hash->size    = size;
+
+    return true;
+}
+
+static bool hash_NFind(H2oHash hash, const char *key, unsigned length, void *target) {
+    if (!hash)   return false;
+    if (!key)    return false;
     if (!target) return false;
 
-    H2oCell result = malloc(sizeof(struct water_cell));
+    H2oEntry entry = hash_Entry(hash, key, length, text_Hash(key, length));
+
+    if (!entry) return false;
+
+    *((void **) target) = entry->value;
+
+    return true;
+}
+
+static inline bool hash_Find(H2oHash hash, const char *key, void *target) {
+    if (!key) return false;
+    return hash_NFind(hash, key, strlen(key), target);
+}
+
+static bool hash_NReplace(H2oHash hash, const char *key, unsigned length, void *value) {
+    if (!hash) return false;
+    if (!key)  return false;
+
+    unsigned code  = text_Hash(key, length);
+    H2oEntry entry = hash_Entry(hash, key, length, code);
 
-    if (!result) return false;
+    if (entry) {
+        entry->value = value;
+        return true;
+    }
+
+    if (hash->count >= hash->size) {
+        if (!hash_Grow(hash)) return false;
+    }
 
-    memset(result, 0, sizeof(struct water_cell));
+    char *copy = 0;
 
-    *target = result;
+    if (!arena_Alloc(hash->arena, sizeof(struct water_entry), &entry)) return false;
+    if (!arena_Alloc(hash->arena, length + 1, &copy))                  return false;
+
+    memcpy(copy, key, length);
+
+    entry->hash   = code;
+    entry->length = length;
+    entry->key    = copy;
+    entry->value  = value;
+    entry->next   = hash->buckets[code & (hash->size - 1)];
+
+    hash->buckets[code & (hash->size - 1)] = entry;
+    hash->count += 1;
 
     return true;
 }
 
-static bool stack_Init(unsigned count, H2oStack target) {
+static inline bool hash_Replace(H2oHash hash, const char *key, void *value) {
+    if (!key) return false;
+    return hash_NReplace(hash, key, strlen(key), value);
+}
+
+static inline bool cell_Create(H2oArena arena, H2oCell *target) {
+    if (!target) return false;
+
+    return arena_Alloc(arena, sizeof(struct water_cell), target);
+}
+
+static bool stack_Init(H2oArena arena, unsigned count, H2oStack target) {
     if (!target) return false;
 
     memset(target, 0, sizeof(struct water_stack));
 
+    target->arena = arena;
+
     if (count < 1) return true;
 
     H2oCell list = 0;
     H2oCell end  = 0;
 
-    if (!cell_Create(&list)) return false;
+    if (!cell_Create(arena, &list)) return false;
 
     target->free_list = end = list;
 
     while (count--) {
-        if (!cell_Create(&end->next)) return false;
+        if (!cell_Create(arena, &end->next)) return false;
+        end = end->next;
     }
 
     return true;
@@ -91,6 +279,7 @@ static inline const char* type2name(H2oType type) {
     case water_one_plus:  return "one_plus";
     case water_or:        return "or";
     case water_predicate: return "predicate";
+    case water_guard:     return "guard";
     case water_range:     return "range";
     case water_select:    return "select";
     case water_sequence:  return "sequence";
@@ -142,6 +331,12 @@ static inline void node_Print(FILE* output, H2oNode value) {
         fprintf(output, "%%%*.*s", length, length, text);
         return;
     }
+    case water_guard:  {
+        const char* text = value.text->value.start;
+        unsigned  length = value.text->value.length;
+        fprintf(output, "%%{%*.*s}", length, length, text);
+        return;
+    }
     case water_not:       {
         fprintf(output, "(");
         node_Print(output, value.operator->value);
@@ -263,9 +458,9 @@ static void stack_Print(FILE* output, H2oStack stack) {
     return;
 }
 
-static inline bool table_Init(H2oTable table) {
+static inline bool table_Init(H2oArena arena, H2oTable table) {
     if (!table) return false;
-    if (!stable_Init(1024, &table->map))  return false;
+    if (!hash_Init(arena, 64, &table->map)) return false;
 
     table->count = 0;
     table->last  = 0;
@@ -278,25 +473,16 @@ static inline bool symbol_Add(H2oTable table, CuData text, unsigned *index) {
     if (!text.start)  return false;
     if (!text.length) return false;
 
-    StaticValue result;
-    H2oSymbol   symbol;
+    H2oSymbol symbol;
 
-    if (stable_NFind(&table->map, text.start, text.length, &result)) {
-        symbol = (H2oSymbol) result;
+    if (hash_NFind(&table->map, text.start, text.length, &symbol)) {
         *index = symbol->index;
         return true;
     }
 
-    symbol = malloc(sizeof(struct water_symbol));
-
-    if (!symbol) return false;
-
-    memset(symbol, 0, sizeof(struct water_symbol));
+    if (!arena_Alloc(table->map.arena, sizeof(struct water_symbol), &symbol)) return false;
 
-    if (!stable_NReplace(&table->map, text.start, text.length, symbol)) {
-        free(symbol);
-        return false;
-    }
+    if (!hash_NReplace(&table->map, text.start, text.length, symbol)) return false;
 
     symbol->name  = text;
     symbol->index = table->count++;
@@ -323,29 +509,232 @@ static inline bool write_Table(H2oParser water, H2oTable table) {
         return true;
     }
 
-    inline bool write_List(H2oSymbol symbol) {
-        if (!symbol) return true;
-        if (!symbol->next) {
-            if (!write_Symbol(symbol)) return false;
-        } else {
-            if (!write_List(symbol->next)) return false;
-            fprintf(water->output, ", ");
-            if (!write_Symbol(symbol)) return false;
-        }
-        return true;
+    // the list runs newest first, write it in index order
+    H2oSymbol *symbols = calloc(table->count + 1, sizeof(H2oSymbol));
+
+    if (!symbols) return false;
+
+    H2oSymbol symbol = table->last;
+
+    for ( ; symbol ; symbol = symbol->next) {
+        symbols[symbol->index] = symbol;
     }
 
     fprintf(water->output, "{ ");
-    if (!write_List(table->last)) return false;
+
+    unsigned index = 0;
+
+    for ( ; index < table->count ; ++index) {
+        if (index) fprintf(water->output, ", ");
+        if (!write_Symbol(symbols[index])) {
+            free(symbols);
+            return false;
+        }
+    }
+
     fprintf(water->output, " };\n");
 
+    free(symbols);
+
+    return true;
+}
+
+// a minimal perfect hash over a table (see struct water_index)
+// - hash and displace: the names are split into buckets of about four,
+//   the largest buckets are placed first, each one by searching for a
+//   seed that sends all its names to free slots
+struct water_perfect {
+    unsigned  buckets;
+    unsigned *seeds;
+    unsigned *slots;
+};
+
+static void perfect_Free(struct water_perfect *perfect) {
+    free(perfect->seeds);
+    free(perfect->slots);
+    perfect->buckets = 0;
+    perfect->seeds   = 0;
+    perfect->slots   = 0;
+}
+
+static bool perfect_Build(H2oTable table, struct water_perfect *perfect) {
+    memset(perfect, 0, sizeof(*perfect));
+
+    unsigned count = table->count;
+
+    if (!count) return false;
+
+    unsigned buckets = (count + 3) / 4;
+    unsigned limit   = (count < 1024 ? 1 << 16 : count * 64);
+
+    unsigned long long *hashes = calloc(count, sizeof(unsigned long long));
+    unsigned *starts  = calloc(buckets + 2, sizeof(unsigned));  // the members of each bucket
+    unsigned *members = calloc(count, sizeof(unsigned));
+    unsigned *sizes   = calloc(count + 2, sizeof(unsigned));    // the buckets by size (largest first)
+    unsigned *order   = calloc(buckets, sizeof(unsigned));
+    unsigned *trial   = calloc(count, sizeof(unsigned));
+    char     *taken   = calloc(count, sizeof(char));
+
+    perfect->buckets = buckets;
+    perfect->seeds   = calloc(buckets, sizeof(unsigned));
+    perfect->slots   = calloc(count, sizeof(unsigned));
+
+    inline bool done(bool result) {
+        free(hashes);
+        free(starts);
+        free(members);
+        free(sizes);
+        free(order);
+        free(trial);
+        free(taken);
+        if (!result) perfect_Free(perfect);
+        return result;
+    }
+
+    if (!hashes || !starts || !members || !sizes || !order || !trial || !taken) return done(false);
+    if (!perfect->seeds || !perfect->slots) return done(false);
+
+    unsigned  inx    = 0;
+    H2oSymbol symbol = table->last;
+
+    for ( ; symbol ; symbol = symbol->next) {
+        hashes[symbol->index] = h2o_HashText(symbol->name.start, symbol->name.length);
+    }
+
+    // counting sort the names by bucket
+    for (inx = 0 ; inx < count ; ++inx) starts[(hashes[inx] % buckets) + 2] += 1;
+    for (inx = 2 ; inx < buckets + 2 ; ++inx) starts[inx] += starts[inx - 1];
+    for (inx = 0 ; inx < count ; ++inx) members[starts[(hashes[inx] % buckets) + 1]++] = inx;
+
+    // now bucket b holds members[starts[b]] .. members[starts[b + 1] - 1]
+    inline unsigned bucket_Size(unsigned bucket) {
+        return starts[bucket + 1] - starts[bucket];
+    }
+
+    // counting sort the buckets by size (largest first)
+    for (inx = 0 ; inx < buckets ; ++inx) sizes[count - bucket_Size(inx) + 1] += 1;
+    for (inx = 1 ; inx < count + 1 ; ++inx) sizes[inx] += sizes[inx - 1];
+    for (inx = 0 ; inx < buckets ; ++inx) order[sizes[count - bucket_Size(inx)]++] = inx;
+
+    inline bool bucket_Place(unsigned bucket, unsigned seed) {
+        unsigned size = bucket_Size(bucket);
+        unsigned at   = 0;
+
+        for ( ; at < size ; ++at) {
+            unsigned slot = h2o_Mix(hashes[members[starts[bucket] + at]], seed) % count;
+            if (taken[slot]) break;
+            taken[slot] = 1;
+            trial[at]   = slot;
+        }
+
+        if (at < size) {
+            while (at--) taken[trial[at]] = 0;
+            return false;
+        }
+
+        for (at = 0 ; at < size ; ++at) {
+            perfect->slots[trial[at]] = members[starts[bucket] + at];
+        }
+
+        perfect->seeds[bucket] = seed;
+
+        return true;
+    }
+
+    // two names with the same hash never separate
+    inline bool bucket_Distinct(unsigned bucket) {
+        unsigned size = bucket_Size(bucket);
+        unsigned one  = 0;
+
+        for ( ; one < size ; ++one) {
+            unsigned two = one + 1;
+            for ( ; two < size ; ++two) {
+                if (hashes[members[starts[bucket] + one]] == hashes[members[starts[bucket] + two]]) return false;
+            }
+        }
+
+        return true;
+    }
+
+    for (inx = 0 ; inx < buckets ; ++inx) {
+        unsigned bucket = order[inx];
+        unsigned seed   = 0;
+
+        if (!bucket_Size(bucket))     break;
+        if (!bucket_Distinct(bucket)) return done(false);
+
+        for ( ; seed < limit ; ++seed) {
+            if (bucket_Place(bucket, seed)) break;
+        }
+
+        if (seed >= limit) return done(false);
+    }
+
+    return done(true);
+}
+
+static void write_Numbers(H2oParser water, const unsigned *numbers, unsigned count) {
+    unsigned index = 0;
+
+    fprintf(water->output, "{");
+
+    for ( ; index < count ; ++index) {
+        if (0 == (index % 16)) fprintf(water->output, "\n   ");
+        fprintf(water->output, " %u,", numbers[index]);
+    }
+
+    fprintf(water->output, "\n};\n");
+}
+
+// write the perfect hash of a table as <prefix>_index (if one was found)
+static bool write_Index(H2oParser water, H2oTable table, const char *prefix) {
+    struct water_perfect perfect;
+
+    if (!perfect_Build(table, &perfect)) return false;
+
+    fprintf(water->output, "static const unsigned %s_seed[] = ", prefix);
+    write_Numbers(water, perfect.seeds, perfect.buckets);
+
+    fprintf(water->output, "static const unsigned %s_slot[] = ", prefix);
+    write_Numbers(water, perfect.slots, table->count);
+
+    fprintf(water->output, "static struct water_index %s_index = { %u, %s_seed, %s_slot };\n",
+            prefix, perfect.buckets, prefix, prefix);
+
+    perfect_Free(&perfect);
+
+    return true;
+}
+
+// record where (in the grammar source) node id was written
+static bool position_Set(H2oParser water, unsigned id, CuCursor location) {
+    if (id >= water->allocated) {
+        unsigned               size      = (water->allocated ? water->allocated * 2 : 1024);
+        struct water_position *positions = 0;
+
+        while (size <= id) size *= 2;
+
+        if (!(positions = realloc(water->positions, sizeof(struct water_position) * size))) return false;
+
+        memset(positions + water->allocated, 0, sizeof(struct water_position) * (size - water->allocated));
+
+        water->positions = positions;
+        water->allocated = size;
+    }
+
+    // (Copper counts lines and columns from zero, places from one)
+    if (location) {
+        water->positions[id].line   = location->line_number + 1;
+        water->positions[id].column = location->char_offset + 1;
+    }
+
     return true;
 }
 
-static inline bool node_Create(enum water_type type, H2oTarget target) {
+static inline bool node_Create(H2oParser water, enum water_type type, H2oTarget target, CuCursor location) {
+    if (!water)      return false;
     if (!target.any) return false;
 
-    static unsigned next_id = 1;
     unsigned size = 0;
 
     switch (type) {
@@ -369,6 +758,10 @@ static inline bool node_Create(enum water_type type, H2oTarget target) {
         size = sizeof(struct water_text);
         break;
 
+    case water_guard:
+        size = sizeof(struct water_text);
+        break;
+
     case water_not:
         size = sizeof(struct water_operator);
         break;
@@ -394,7 +787,7 @@ static inline bool node_Create(enum water_type type, H2oTarget target) {
         break;
 
     case water_range:
-        size = sizeof(struct water_operator);
+        size = sizeof(struct water_range);
         break;
 
     case water_select:
@@ -433,14 +826,14 @@ static inline bool node_Create(enum water_type type, H2oTarget target) {
         return false;
     }
 
-    H2oAny result = malloc(size);
+    H2oAny result = 0;
 
-    if (!result) return false;
-
-    memset(result, 0, size);
+    if (!arena_Alloc(&water->arena, size, &result)) return false;
 
     result->type = type;
-    result->id   = next_id++;
+    result->id   = ++water->next_id;
+
+    if (!position_Set(water, result->id, location)) return false;
 
     *target.any = result;
 
@@ -476,43 +869,110 @@ static bool water_MoreData(Copper parser)
     return true;
 }
 #else
+// the most handed to Copper at once
+#define WATER_CHUNK (1 << 20)
+
+// map the whole input when it is a regular file
+static bool water_MapInput(H2oBuffer tbuffer) {
+    struct stat info;
+
+    int fd = fileno(tbuffer->input);
+
+    if (0 > fd)                  return false;
+    if (0 != fstat(fd, &info))   return false;
+    if (!S_ISREG(info.st_mode))  return false;
+    if (0 >= info.st_size)       return false;
+
+    void *start = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (MAP_FAILED == start) return false;
+
+    madvise(start, info.st_size, MADV_SEQUENTIAL);
+
+    tbuffer->mapped = start;
+    tbuffer->cursor = 0;
+    tbuffer->read   = info.st_size;
+
+    return true;
+}
+
+// print each line handed to Copper (at -v)
+static void water_PrintLines(H2oBuffer tbuffer, const char *start, size_t length) {
+    const char *end = start + length;
+
+    while (start < end) {
+        const char *eol   = memchr(start, '\n', end - start);
+        size_t      count = (eol ? (eol + 1) : end) - start;
+
+        if (!tbuffer->partial) {
+            printf("%s[%u] ", tbuffer->filename, ++tbuffer->line_number);
+        }
+
+        fwrite(start, 1, count, stdout);
+
+        tbuffer->partial = !eol;
+        start += count;
+    }
+}
+
 static bool water_MoreData(H2oParser water, CuData *target)
 {
     H2oBuffer tbuffer = &water->buffer;
 
     if (tbuffer->cursor >= tbuffer->read) {
-        int read = getline(&tbuffer->line, &tbuffer->allocated, tbuffer->input);
-        if (read < 0) {
-            if (ferror(tbuffer->input)) return false;
+        size_t read = 0;
+
+        if (!tbuffer->mapped) {
+            read = fread(tbuffer->line, 1, tbuffer->allocated, tbuffer->input);
+        }
+
+        if (0 >= read) {
+            if (tbuffer->input && ferror(tbuffer->input)) return false;
             target->length = -1;
             target->start  = 0;
             return true;
         }
+
         tbuffer->cursor = 0;
         tbuffer->read   = read;
     }
 
+    size_t      count = tbuffer->read - tbuffer->cursor;
+    const char *start = (tbuffer->mapped ? tbuffer->mapped : tbuffer->line) + tbuffer->cursor;
+
+    if (WATER_CHUNK < count) count = WATER_CHUNK;
+
     if (0 < h2o_global_debug) {
-        unsigned line_number = water->base.cursor.line_number + 1;
-        printf("%s[%d] %s", tbuffer->filename, line_number, tbuffer->line);
+        water_PrintLines(tbuffer, start, count);
     }
 
-    unsigned count = tbuffer->read - tbuffer->cursor;
-
     target->length   = count;
-    target->start    = tbuffer->line + tbuffer->cursor;
+    target->start    = start;
     tbuffer->cursor += count;
 
     return true;
 }
 #endif
 
+/* from water.c */
+extern bool water_graph(Copper input);
+
+// the Copper graph of water.cu and the events it names
+// - built once, then only read, so every parser shares them
+static struct water_arena graph_arena;
+static struct water_hash  graph_node;
+static struct water_hash  graph_action;
+static bool               graph_ready = false;
+static pthread_once_t     graph_once  = PTHREAD_ONCE_INIT;
+
 static bool water_FindNode(Copper parser, CuName name, CuNode* target) {
     H2oParser water = (H2oParser) parser;
 
-    StaticValue result;
+    void *result = 0;
 
-    if (!stable_Find(&water->node, name, &result)) return false;
+    if (!hash_Find(&water->node, name, &result)) {
+        if (!hash_Find(&graph_node, name, &result)) return false;
+    }
 
     *target = (CuNode) result;
 
@@ -524,11 +984,9 @@ static bool water_FindPredicate(Copper parser, CuName name, CuPredicate* target)
 }
 
 static bool water_FindEvent(Copper parser, CuName name, CuEvent* target) {
-    H2oParser water = (H2oParser) parser;
-
-    StaticValue result;
+    void *result = 0;
 
-    if (!stable_Find(&water->action, name, &result)) return false;
+    if (!hash_Find(&graph_action, name, &result)) return false;
 
     *target = (CuEvent) result;
 
@@ -538,11 +996,15 @@ static bool water_FindEvent(Copper parser, CuName name, CuEvent* target) {
 static bool water_AddName(Copper parser, CuName name, CuNode value) {
     H2oParser water = (H2oParser) parser;
 
-    return stable_Replace(&water->node, name, (StaticValue) value);
+    return hash_Replace(&water->node, name, (void *) value);
+}
+
+static bool graph_AddName(Copper parser, CuName name, CuNode value) {
+    return hash_Replace(&graph_node, name, (void *) value);
 }
 
-static bool water_SetEvent(H2oParser water, CuName name, CuEvent value) {
-    return stable_Replace(&water->action, name, (StaticValue) value);
+static bool graph_SetEvent(CuName name, CuEvent value) {
+    return hash_Replace(&graph_action, name, (void *) value);
 }
 
 static void print_State(H2oParser water, bool start, const char* format, ...) {
@@ -581,7 +1043,7 @@ static inline bool stack_Push(H2oStack stack, H2oNode value) {
     if (cell) {
         stack->free_list = cell->next;
     } else {
-        if (!cell_Create(&cell)) return false;
+        if (!cell_Create(stack->arena, &cell)) return false;
     }
 
     cell->next  = stack->top;
@@ -629,24 +1091,24 @@ static inline bool stack_Swap(H2oStack stack) {
 
 /***********************************************************/
 
-static inline bool make_Action(H2oParser water, H2oType type) {
+static inline bool make_Action(H2oParser water, H2oType type, CuCursor location) {
     if (!water) return false;
 
     H2oText result = 0;
 
-    if (!node_Create(type, &result)) return false;
+    if (!node_Create(water, type, &result, location)) return false;
 
     if (!stack_Push(&water->stack, result)) return false;
 
     return true;
 }
 
-static inline bool make_Text(H2oParser water, H2oType type) {
+static inline bool make_Text(H2oParser water, H2oType type, CuCursor location) {
     if (!water) return false;
 
     H2oText result = 0;
 
-    if (!node_Create(type, &result)) return false;
+    if (!node_Create(water, type, &result, location)) return false;
 
     if (!cu_MarkedText((Copper) water, &result->value)) return false;
 
@@ -668,12 +1130,12 @@ static inline bool make_Text(H2oParser water, H2oType type) {
     return true;
 }
 
-static inline bool make_Operator(H2oParser water, H2oType type) {
+static inline bool make_Operator(H2oParser water, H2oType type, CuCursor location) {
     if (!water) return false;
 
     H2oOperator result = 0;
 
-    if (!node_Create(type, &result)) return false;
+    if (!node_Create(water, type, &result, location)) return false;
 
     if (!stack_Pop(&water->stack, &result->value)) return false;
 
@@ -682,12 +1144,12 @@ static inline bool make_Operator(H2oParser water, H2oType type) {
     return true;
 }
 
-static inline bool make_Branch(H2oParser water, H2oType type) {
+static inline bool make_Branch(H2oParser water, H2oType type, CuCursor location) {
     if (!water) return false;
 
     H2oBranch result = 0;
 
-    if (!node_Create(type, &result)) return false;
+    if (!node_Create(water, type, &result, location)) return false;
 
     if (!stack_Pop(&water->stack, &result->after)) return false;
     if (!stack_Pop(&water->stack, &result->before)) return false;
@@ -706,10 +1168,16 @@ static bool declare_event(Copper input, CuCursor location) {
 
     H2oDefine define = 0;
 
-    if (!node_Create(water_define, &define)) return false;
+    if (!node_Create(water, water_define, &define, location)) return false;
 
     if (!cu_MarkedText((Copper) water, &define->name)) return false;
 
+    // the rule cache holds every rule defined (not only those applied),
+    // so any rule can be found through its index (see h2o_LiveJoin)
+    unsigned index;
+
+    if (!symbol_Add(&water->identifer, define->name, &index)) return false;
+
     define->next = water->rule;
 
     water->rule = define;
@@ -736,6 +1204,9 @@ static bool define_event(Copper input, CuCursor location) {
 
     if (check != define) return false;
 
+    // (the code of the rule is placed where the rule is declared)
+    water->positions[define->match.any->id] = water->positions[define->id];
+
     print_State(water, false, "%s", event_name);
     return true;
     (void) event_name;
@@ -746,7 +1217,7 @@ static bool identifier_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Text(water, water_identifer)) return false;
+    if (!make_Text(water, water_identifer, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -758,7 +1229,7 @@ static bool label_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Text(water, water_label)) return false;
+    if (!make_Text(water, water_label, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -770,7 +1241,7 @@ static bool event_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Text(water, water_event)) return false;
+    if (!make_Text(water, water_event, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -782,7 +1253,27 @@ static bool predicate_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Text(water, water_predicate)) return false;
+    if (!make_Text(water, water_predicate, location)) return false;
+
+    print_State(water, false, "%s", event_name);
+    return true;
+    (void) event_name;
+}
+
+static bool guard_event(Copper input, CuCursor location) {
+    const char *event_name = "guard";
+    H2oParser water = (H2oParser) input;
+    print_State(water, true, "%s", event_name);
+
+    H2oText result = 0;
+
+    if (!node_Create(water, water_guard, &result, location)) return false;
+
+    if (!cu_MarkedText((Copper) water, &result->value)) return false;
+
+    if (!stack_Push(&water->stack, result)) return false;
+
+    water->guards += 1;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -794,7 +1285,7 @@ static bool not_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Operator(water, water_not)) return false;
+    if (!make_Operator(water, water_not, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -806,7 +1297,7 @@ static bool assert_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Operator(water, water_assert)) return false;
+    if (!make_Operator(water, water_assert, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -817,7 +1308,7 @@ static bool any_event(Copper input, CuCursor location) {
     const char *event_name = "any";
     H2oParser water = (H2oParser) input;
 
-    if (!make_Action(water, water_any)) return false;
+    if (!make_Action(water, water_any, location)) return false;
 
     return true;
     (void) event_name;
@@ -828,7 +1319,7 @@ static bool zero_plus_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Operator(water, water_zero_plus)) return false;
+    if (!make_Operator(water, water_zero_plus, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -840,7 +1331,7 @@ static bool one_plus_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Operator(water, water_one_plus)) return false;
+    if (!make_Operator(water, water_one_plus, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -852,7 +1343,7 @@ static bool maybe_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Operator(water, water_maybe)) return false;
+    if (!make_Operator(water, water_maybe, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -873,7 +1364,7 @@ static bool number_event(Copper input, CuCursor location) {
 
     H2oCount result;
 
-    if (!node_Create(water_count, &result)) return false;
+    if (!node_Create(water, water_count, &result, location)) return false;
 
     result->count = count;
 
@@ -900,7 +1391,7 @@ static bool range_event(Copper input, CuCursor location) {
 
     if (water_count != min->type) return false;
 
-    if (!node_Create(water_range, &result)) return false;
+    if (!node_Create(water, water_range, &result, location)) return false;
 
     result->max = max->count;
     result->min = min->count;
@@ -919,7 +1410,7 @@ static bool select_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Branch(water, water_select)) return false;
+    if (!make_Branch(water, water_select, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -931,7 +1422,7 @@ static bool tuple_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Branch(water, water_tuple)) return false;
+    if (!make_Branch(water, water_tuple, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -943,7 +1434,7 @@ static bool assign_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Branch(water, water_and)) return false;
+    if (!make_Branch(water, water_and, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -955,8 +1446,8 @@ static bool leaf_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Action(water, water_leaf)) return false;
-    if (!make_Branch(water, water_and))  return false;
+    if (!make_Action(water, water_leaf, location)) return false;
+    if (!make_Branch(water, water_and, location))  return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -968,8 +1459,8 @@ static bool tree_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Operator(water, water_childern)) return false;
-    if (!make_Branch(water, water_and))        return false;
+    if (!make_Operator(water, water_childern, location)) return false;
+    if (!make_Branch(water, water_and, location))        return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -981,7 +1472,7 @@ static bool and_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Branch(water, water_and)) return false;
+    if (!make_Branch(water, water_and, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -993,7 +1484,7 @@ static bool or_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Branch(water, water_or)) return false;
+    if (!make_Branch(water, water_or, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -1005,7 +1496,7 @@ static bool sequence_event(Copper input, CuCursor location) {
     H2oParser water = (H2oParser) input;
     print_State(water, true, "%s", event_name);
 
-    if (!make_Branch(water, water_sequence)) return false;
+    if (!make_Branch(water, water_sequence, location)) return false;
 
     print_State(water, false, "%s", event_name);
     return true;
@@ -1014,28 +1505,614 @@ static bool sequence_event(Copper input, CuCursor location) {
 
 /*------------------------------------------------------------*/
 
-static bool write_Tree(H2oParser water, H2oNode match) {
+// a post-order walk over a grammar tree (children before parents)
+// - an explicit stack, so any depth of nesting is fine
+struct water_walk {
+    struct water_step {
+        H2oNode  node;
+        unsigned next;   // the next child to visit
+    } *steps;
+    unsigned depth;
+    unsigned allocated;
+    bool     failed;
+};
+
+static inline unsigned node_Childern(H2oNode node, H2oNode childern[2]) {
+    switch (node.any->type) {
+    case water_define:
+        childern[0] = node.define->match;
+        return 1;
 
-    inline bool write_node(H2oNode value) {
-        return write_Tree(water, value);
-    }
+    case water_not:
+    case water_assert:
+    case water_zero_plus:
+    case water_one_plus:
+    case water_maybe:
+    case water_childern:
+        childern[0] = node.operator->value;
+        return 1;
 
-    inline void lvalue(H2oNode value) {
-        fprintf(water->output, "L%.6x", value.any->id);
+    case water_range:
+        childern[0] = node.range->value;
+        return 1;
+
+    case water_and:
+    case water_or:
+    case water_select:
+    case water_sequence:
+    case water_tuple:
+        childern[0] = node.branch->before;
+        childern[1] = node.branch->after;
+        return 2;
+
+    default:
+        break;
     }
 
-    inline void avalue(H2oNode value) {
-        fprintf(water->output, "(H2oCode) &L%.6x", value.any->id);
+    return 0;
+}
+
+static bool walk_Push(struct water_walk *walk, H2oNode node) {
+    if (walk->depth >= walk->allocated) {
+        unsigned           size  = (walk->allocated ? walk->allocated * 2 : 64);
+        struct water_step *steps = realloc(walk->steps, sizeof(struct water_step) * size);
+        if (!steps) return false;
+        walk->steps     = steps;
+        walk->allocated = size;
     }
 
-    inline bool write_define() {
-        H2oDefine   rule = match.define;
+    walk->steps[walk->depth].node = node;
+    walk->steps[walk->depth].next = 0;
+    walk->depth += 1;
+
+    return true;
+}
+
+static inline bool walk_Start(struct water_walk *walk, H2oNode root) {
+    walk->depth  = 0;
+    walk->failed = false;
+    if (!root.any) return false;
+    return walk_Push(walk, root);
+}
+
+// the next node in post-order (false at the end, or on error)
+static bool walk_Next(struct water_walk *walk, H2oNode *target) {
+    while (0 < walk->depth) {
+        struct water_step *step = &walk->steps[walk->depth - 1];
+        H2oNode            childern[2];
+        unsigned           count = node_Childern(step->node, childern);
+
+        if (step->next < count) {
+            H2oNode child = childern[step->next++];
+            if (!child.any) continue;
+            if (!walk_Push(walk, child)) {
+                walk->depth  = 0;
+                walk->failed = true;
+                return false;
+            }
+            continue;
+        }
+
+        *target = step->node;
+        walk->depth -= 1;
+        return true;
+    }
+
+    return false;
+}
+
+static inline void walk_Free(struct water_walk *walk) {
+    free(walk->steps);
+    walk->steps     = 0;
+    walk->depth     = 0;
+    walk->allocated = 0;
+}
+
+/*------------------------------------------------------------*/
+
+// larger FIRST sets are not worth testing before a rule
+#define FIRST_LIMIT 64
+
+// the rule defined for each identifier (zero if none)
+static bool first_Defines(H2oParser water, H2oDefine **target) {
+    H2oDefine *defines = calloc(water->identifer.count + 1, sizeof(H2oDefine));
+
+    if (!defines) return false;
+
+    H2oDefine rule = water->rule;
+
+    for ( ; rule ; rule = rule->next) {
+        H2oSymbol symbol;
+        if (!hash_NFind(&water->identifer.map, rule->name.start, rule->name.length, &symbol)) continue;
+        defines[symbol->index] = rule;
+    }
+
+    *target = defines;
+
+    return true;
+}
+
+// the FIRST set of one rule, from the current sets of the rules it uses
+struct water_collect {
+    H2oDefine *defines;
+    unsigned  *stamps;      // per label: the pass that last added it
+    unsigned   pass;
+    bool       open;
+    unsigned   count;
+    unsigned   labels[FIRST_LIMIT];
+    struct water_frame {
+        H2oNode  node;
+        unsigned state;
+        bool     before;    // the nullable of the first branch (or/select)
+    } *frames;
+    unsigned   depth;
+    unsigned   allocated;
+};
+
+static inline void collect_Label(struct water_collect *collect, unsigned label) {
+    if (collect->pass == collect->stamps[label]) return;
+
+    collect->stamps[label] = collect->pass;
+
+    if (FIRST_LIMIT <= collect->count) {
+        collect->open = true;
+        return;
+    }
+
+    collect->labels[collect->count++] = label;
+}
+
+static bool collect_Push(struct water_collect *collect, H2oNode node) {
+    if (collect->depth >= collect->allocated) {
+        unsigned            size   = (collect->allocated ? collect->allocated * 2 : 64);
+        struct water_frame *frames = realloc(collect->frames, sizeof(struct water_frame) * size);
+        if (!frames) return false;
+        collect->frames    = frames;
+        collect->allocated = size;
+    }
+
+    collect->frames[collect->depth].node   = node;
+    collect->frames[collect->depth].state  = 0;
+    collect->frames[collect->depth].before = false;
+    collect->depth += 1;
+
+    return true;
+}
+
+// collect the labels rule may start with
+// - sets collect->open if it may start with any node
+// - nullable is set if it may succeed without testing the node
+static bool first_Collect(struct water_collect *collect, H2oDefine rule, bool *nullable) {
+    bool result = false; // the nullable of the last node finished
+
+    collect->pass  += 1;
+    collect->open   = false;
+    collect->count  = 0;
+    collect->depth  = 0;
+
+    if (!collect_Push(collect, rule->match)) return false;
+
+    while (0 < collect->depth && !collect->open) {
+        struct water_frame *frame = &collect->frames[collect->depth - 1];
+        H2oNode             node  = frame->node;
+        H2oDefine           used  = 0;
+        unsigned            inx   = 0;
+
+        inline bool push(H2oNode value, unsigned state) {
+            frame->state = state;
+            return collect_Push(collect, value);
+        }
+
+        inline void done(bool value) {
+            result = value;
+            collect->depth -= 1;
+        }
+
+        if (!node.any) {
+            collect->open = true;
+            break;
+        }
+
+        switch (node.any->type) {
+        case water_label:
+            collect_Label(collect, node.text->index);
+            done(false);
+            continue;
+
+        // a guard only filters, what follows it is still tested
+        case water_event:
+        case water_guard:
+            done(true);
+            continue;
+
+        case water_identifer:
+            used = collect->defines[node.text->index];
+            if (!used || used->first.open) {
+                collect->open = true;
+                continue;
+            }
+            for ( ; inx < used->first.count ; ++inx) {
+                collect_Label(collect, used->first.labels[inx]);
+            }
+            done(used->first.nullable);
+            continue;
+
+        case water_and:
+        case water_sequence:
+            if (0 == frame->state) {
+                if (!push(node.branch->before, 1)) return false;
+                continue;
+            }
+            if (1 == frame->state && result) {
+                if (!push(node.branch->after, 2)) return false;
+                continue;
+            }
+            done(result);
+            continue;
+
+        case water_or:
+        case water_select:
+            if (0 == frame->state) {
+                if (!push(node.branch->before, 1)) return false;
+                continue;
+            }
+            if (1 == frame->state) {
+                frame->before = result;
+                if (!push(node.branch->after, 2)) return false;
+                continue;
+            }
+            done(frame->before || result);
+            continue;
+
+        case water_tuple:
+            if (0 == frame->state) {
+                if (!push(node.branch->before, 1)) return false;
+                continue;
+            }
+            if (result) collect->open = true;
+            done(result);
+            continue;
+
+        case water_maybe:
+        case water_zero_plus:
+            if (0 == frame->state) {
+                if (!push(node.operator->value, 1)) return false;
+                continue;
+            }
+            done(true);
+            continue;
+
+        case water_assert:
+        case water_one_plus:
+            if (0 == frame->state) {
+                if (!push(node.operator->value, 1)) return false;
+                continue;
+            }
+            done(result);
+            continue;
+
+        case water_range:
+            if (0 == frame->state) {
+                if (!push(node.range->value, 1)) return false;
+                continue;
+            }
+            done(result || (0 == node.range->min));
+            continue;
+
+        case water_any:
+        case water_leaf:
+        case water_predicate:
+        case water_not:
+        case water_childern:
+        case water_count:
+        case water_define:
+        case water_void:
+            break;
+        }
+
+        collect->open = true;
+    }
+
+    *nullable = result;
+
+    return true;
+}
+
+// (re)compute the FIRST set of rule
+static bool first_Update(H2oParser water, struct water_collect *collect, H2oDefine rule, bool *changed) {
+    bool nullable = false;
+
+    if (!first_Collect(collect, rule, &nullable)) return false;
+
+    if (collect->open) {
+        *changed = !rule->first.open;
+        rule->first.open = true;
+        return true;
+    }
+
+    // the sets only grow, so an equal count is an equal set
+    if (nullable       == rule->first.nullable &&
+        collect->count == rule->first.count) {
+        *changed = false;
+        return true;
+    }
+
+    unsigned *labels = 0;
+
+    if (!arena_Alloc(&water->arena, sizeof(unsigned) * (collect->count + 1), &labels)) return false;
+
+    memcpy(labels, collect->labels, sizeof(unsigned) * collect->count);
+
+    rule->first.nullable = nullable;
+    rule->first.count    = collect->count;
+    rule->first.labels   = labels;
+
+    *changed = true;
+
+    return true;
+}
+
+// compute the FIRST set of every rule
+// - rules are taken a strongly connected component at a time,
+//   the rules they use first (Tarjan), so only rules that use
+//   each other are iterated to a fixed point
+static bool first_Rules(H2oParser water, H2oDefine *defines) {
+    unsigned count = water->identifer.count;
+
+    struct water_collect collect;
+    struct water_walk    walk;
+
+    memset(&collect, 0, sizeof(collect));
+    memset(&walk,    0, sizeof(walk));
+
+    collect.defines = defines;
+
+    // the identifiers each rule uses
+    unsigned *starts    = calloc(count + 1, sizeof(unsigned));
+    unsigned *edges     = 0;
+    unsigned  used      = 0;
+    unsigned  allocated = 0;
+
+    // Tarjan
+    unsigned *numbers = calloc(count + 1, sizeof(unsigned)); // zero is unvisited
+    unsigned *lows    = calloc(count + 1, sizeof(unsigned));
+    unsigned *cursors = calloc(count + 1, sizeof(unsigned));
+    unsigned *calls   = calloc(count + 1, sizeof(unsigned));
+    unsigned *members = calloc(count + 1, sizeof(unsigned));
+    bool     *onstack = calloc(count + 1, sizeof(bool));
+    unsigned  ncalls  = 0;
+    unsigned  nmember = 0;
+    unsigned  number  = 0;
+
+    collect.stamps = calloc(water->label.count + 1, sizeof(unsigned));
+
+    inline bool done(bool result) {
+        free(starts);
+        free(edges);
+        free(numbers);
+        free(lows);
+        free(cursors);
+        free(calls);
+        free(members);
+        free(onstack);
+        free(collect.stamps);
+        free(collect.frames);
+        walk_Free(&walk);
+        return result;
+    }
+
+    if (!starts || !numbers || !lows || !cursors || !calls || !members || !onstack || !collect.stamps) {
+        return done(false);
+    }
+
+    unsigned index = 0;
+
+    for ( ; index < count ; ++index) {
+        H2oDefine rule = defines[index];
+        H2oNode   node;
+
+        starts[index] = used;
+
+        if (!rule) continue;
+
+        rule->first.open     = false;
+        rule->first.nullable = false;
+        rule->first.count    = 0;
+        rule->first.labels   = 0;
+        if (!walk_Start(&walk, rule->match)) continue;
+
+        while (walk_Next(&walk, &node)) {
+            if (water_identifer != node.any->type) continue;
+            if (used >= allocated) {
+                unsigned  size = (allocated ? allocated * 2 : 1024);
+                unsigned *grow = realloc(edges, sizeof(unsigned) * size);
+                if (!grow) return done(false);
+                edges     = grow;
+                allocated = size;
+            }
+            edges[used++] = node.text->index;
+        }
+    }
+
+    starts[count] = used;
+
+    // settle one component (members[from] .. members[nmember - 1])
+    inline bool settle(unsigned from) {
+        bool changed = true;
+
+        while (changed) {
+            changed = false;
+            unsigned at = from;
+            for ( ; at < nmember ; ++at) {
+                bool update = false;
+                if (!first_Update(water, &collect, defines[members[at]], &update)) return false;
+                changed |= update;
+            }
+            // a single rule that does not use itself is settled at once
+            if (from + 1 == nmember) {
+                unsigned member = members[from];
+                unsigned edge   = starts[member];
+                bool     self   = false;
+                for ( ; edge < starts[member + 1] ; ++edge) {
+                    if (member == edges[edge]) self = true;
+                }
+                if (!self) break;
+            }
+        }
+
+        for ( ; from < nmember ; ++from) {
+            onstack[members[from]] = false;
+        }
+
+        return true;
+    }
+
+    for (index = 0 ; index < count ; ++index) {
+        if (!defines[index])  continue;
+        if (numbers[index])   continue;
+
+        calls[ncalls++] = index;
+
+        while (0 < ncalls) {
+            unsigned current = calls[ncalls - 1];
+
+            if (!numbers[current]) {
+                numbers[current]   = lows[current] = ++number;
+                cursors[current]   = starts[current];
+                onstack[current]   = true;
+                members[nmember++] = current;
+            }
+
+            if (cursors[current] < starts[current + 1]) {
+                unsigned next = edges[cursors[current]++];
+                if (!defines[next]) continue;
+                if (!numbers[next]) {
+                    calls[ncalls++] = next;
+                    continue;
+                }
+                if (onstack[next] && numbers[next] < lows[current]) {
+                    lows[current] = numbers[next];
+                }
+                continue;
+            }
+
+            ncalls -= 1;
+
+            if (0 < ncalls) {
+                unsigned caller = calls[ncalls - 1];
+                if (lows[current] < lows[caller]) lows[caller] = lows[current];
+            }
+
+            if (lows[current] != numbers[current]) continue;
+
+            unsigned from = nmember;
+            while (members[--from] != current) ;
+
+            if (!settle(from)) return done(false);
+
+            nmember = from;
+        }
+    }
+
+    return done(true);
+}
+
+// can applications of this rule be pruned by its FIRST set
+static inline bool first_Prune(H2oDefine rule) {
+    if (!rule)                return false;
+    if (rule->first.open)     return false;
+    if (rule->first.nullable) return false;
+    return true;
+}
+
+// the name of a rule head (extern while sharding)
+static void write_Head(H2oParser water, H2oDefine rule) {
+    if (water->exported) {
+        fprintf(water->output, "%s_L%.6x", water->exported, rule->id);
+    } else {
+        fprintf(water->output, "L%.6x", rule->id);
+    }
+}
+
+static bool write_First(H2oParser water, H2oDefine *defines) {
+    unsigned count  = water->identifer.count;
+    unsigned index  = 0;
+    unsigned offset = 0;
+
+    fprintf(water->output, "\nstatic const unsigned rule_first_offset[] = { 0");
+
+    for ( ; index < count ; ++index) {
+        H2oDefine rule = defines[index];
+        if (first_Prune(rule)) offset += rule->first.count;
+        fprintf(water->output, ", %u", offset);
+    }
+
+    fprintf(water->output, " };\n");
+    fprintf(water->output, "static const unsigned rule_first_label[] = {");
+
+    for (index = 0 ; index < count ; ++index) {
+        H2oDefine rule = defines[index];
+        if (!first_Prune(rule)) continue;
+        unsigned inx = 0;
+        for ( ; inx < rule->first.count ; ++inx) {
+            fprintf(water->output, " %u,", rule->first.labels[inx]);
+        }
+    }
+
+    fprintf(water->output, " 0 };\n");
+
+    // filled in by the registration
+    if (water->exported) {
+        fprintf(water->output, "static H2oCode rule_first_code[%u];\n", count + 1);
+        fprintf(water->output,
+                "static struct water_first rule_first = { &%s_roots, rule_first_offset, rule_first_label, rule_first_code };\n",
+                water->name);
+        return true;
+    }
+
+    fprintf(water->output, "static const H2oCode rule_first_code[] = {");
+
+    for (index = 0 ; index < count ; ++index) {
+        H2oDefine rule = defines[index];
+        fprintf(water->output, "%s ", (index ? "," : ""));
+        if (first_Prune(rule)) {
+            fprintf(water->output, "(H2oCode) &L%.6x", rule->match.any->id);
+        } else {
+            fprintf(water->output, "0");
+        }
+    }
+
+    fprintf(water->output, " };\n");
+    fprintf(water->output,
+            "static struct water_first rule_first = { &%s_roots, rule_first_offset, rule_first_label, rule_first_code };\n",
+            water->name);
+
+    return true;
+}
+
+/*------------------------------------------------------------*/
+
+// write one node (the nodes it uses are already written)
+static bool write_Node(H2oParser water, H2oNode match) {
+
+    inline void lvalue(H2oNode value) {
+        fprintf(water->output, "L%.6x", value.any->id);
+    }
+
+    inline void avalue(H2oNode value) {
+        fprintf(water->output, "(H2oCode) &L%.6x", value.any->id);
+    }
+
+    inline bool write_define() {
+        H2oDefine   rule = match.define;
         const char* text = rule->name.start;
         unsigned  length = rule->name.length;
-        fprintf(water->output, "\n// rule %*.*s\n", length, length, text);
-        write_node(rule->match);
-        fprintf(water->output, "static const H2oCode ");
-        lvalue(rule);
+        if (water->exported) {
+            fprintf(water->output, "const H2oCode ");
+        } else {
+            fprintf(water->output, "static const H2oCode ");
+        }
+        write_Head(water, rule);
         fprintf(water->output, " = ");
         avalue(rule->match);
         fprintf(water->output, "; // rule %*.*s\n", length, length, text);
@@ -1046,9 +2123,10 @@ static bool write_Tree(H2oParser water, H2oNode match) {
         H2oText text = match.text;
         fprintf(water->output, "static const struct water_action ");
         lvalue(text);
-        fprintf(water->output, " = { water_Apply, \"L%.6x\", %u, &rules, \"%*.*s\" };\n",
+        fprintf(water->output, " = { water_Apply, \"L%.6x\", %u, &%s_rules, \"%*.*s\" };\n",
                 text->id,
                 text->index,
+                water->name,
                 (int) text->value.length,
                 (int) text->value.length,
                 text->value.start);
@@ -1059,9 +2137,10 @@ static bool write_Tree(H2oParser water, H2oNode match) {
         H2oText text = match.text;
         fprintf(water->output, "static const struct water_action ");
         lvalue(text);
-        fprintf(water->output, " = { water_Root, \"L%.6x\", %u, &roots, \"%*.*s\" };\n",
+        fprintf(water->output, " = { water_Root, \"L%.6x\", %u, &%s_roots, \"%*.*s\" };\n",
                 text->id,
                 text->index,
+                water->name,
                 (int) text->value.length,
                 (int) text->value.length,
                 text->value.start);
@@ -1072,23 +2151,44 @@ static bool write_Tree(H2oParser water, H2oNode match) {
         H2oText text = match.text;
         fprintf(water->output, "static const struct water_action ");
         lvalue(text);
-        fprintf(water->output, " = { water_Event, \"L%.6x\", %u, &events, \"%*.*s\" };\n",
+        fprintf(water->output, " = { water_Event, \"L%.6x\", %u, &%s_events, \"%*.*s\" };\n",
                 text->id,
                 text->index,
+                water->name,
                 (int) text->value.length,
                 (int) text->value.length,
                 text->value.start);
         return true;
     }
 
+    // the guard itself is a function next to its node (the interpreter
+    // calls it through the node, native code calls it directly)
+    inline bool write_guard() {
+        H2oText text = match.text;
+        fprintf(water->output, "static bool guard_L%.6x(Water WATER, H2oUserNode node) {\n", text->id);
+        fprintf(water->output, "    H2O_GUARD_NODE *NODE = node;\n");
+        fprintf(water->output, "    (void) WATER;\n");
+        fprintf(water->output, "    (void) NODE;\n");
+        fprintf(water->output, "    return (%*.*s);\n",
+                (int) text->value.length,
+                (int) text->value.length,
+                text->value.start);
+        fprintf(water->output, "}\n");
+        fprintf(water->output, "static const struct water_guard ");
+        lvalue(text);
+        fprintf(water->output, " = { water_Guard, \"L%.6x\", guard_L%.6x };\n", text->id, text->id);
+        return true;
+    }
+
     inline bool write_predicate() {
         H2oText text = match.text;
         fprintf(water->output, "static const struct water_action ");
 
         lvalue(text);
-        fprintf(water->output, " = { water_Predicate, \"L%.6x\", %u, &predicates, \"%*.*s\" };\n",
+        fprintf(water->output, " = { water_Predicate, \"L%.6x\", %u, &%s_predicates, \"%*.*s\" };\n",
                 text->id,
                 text->index,
+                water->name,
                 (int) text->value.length,
                 (int) text->value.length,
                 text->value.start);
@@ -1097,7 +2197,6 @@ static bool write_Tree(H2oParser water, H2oNode match) {
 
     inline bool write_not() {
         H2oOperator operator = match.operator;
-        write_node(operator->value);
         fprintf(water->output, "static const struct water_function ");
         lvalue(match);
         fprintf(water->output, " = { water_Not, \"L%.6x\", ", operator->id);
@@ -1108,7 +2207,6 @@ static bool write_Tree(H2oParser water, H2oNode match) {
 
     inline bool write_assert() {
         H2oOperator operator = match.operator;
-        write_node(operator->value);
         fprintf(water->output, "static const struct water_function ");
         lvalue(match);
         fprintf(water->output, " = { water_Assert, \"L%.6x\", ", operator->id);
@@ -1119,7 +2217,6 @@ static bool write_Tree(H2oParser water, H2oNode match) {
 
     inline bool write_zero_plus() {
         H2oOperator operator = match.operator;
-        write_node(operator->value);
         fprintf(water->output, "static const struct water_function ");
         lvalue(match);
         fprintf(water->output, " = { water_ZeroPlus, \"L%.6x\", ", operator->id);
@@ -1130,7 +2227,6 @@ static bool write_Tree(H2oParser water, H2oNode match) {
 
     inline bool write_one_plus() {
         H2oOperator operator = match.operator;
-        write_node(operator->value);
         fprintf(water->output, "static const struct water_function ");
         lvalue(match);
         fprintf(water->output, " = { water_OnePlus, \"L%.6x\", ", operator->id);
@@ -1141,7 +2237,6 @@ static bool write_Tree(H2oParser water, H2oNode match) {
 
     inline bool write_maybe() {
         H2oOperator operator = match.operator;
-        write_node(operator->value);
         fprintf(water->output, "static const struct water_function ");
         lvalue(match);
         fprintf(water->output, " = { water_Maybe, \"L%.6x\", ", operator->id);
@@ -1160,7 +2255,6 @@ static bool write_Tree(H2oParser water, H2oNode match) {
 
     inline bool write_range() {
         H2oRange range = match.range;
-        write_node(range->value);
         fprintf(water->output, "static const struct water_group ");
         lvalue(match);
         fprintf(water->output, " = { water_Range, \"L%.6x\", ", range->id);
@@ -1173,8 +2267,6 @@ static bool write_Tree(H2oParser water, H2oNode match) {
 
     inline bool write_select() {
         H2oBranch branch = match.branch;
-        write_node(branch->before);
-        write_node(branch->after);
         fprintf(water->output, "static const struct water_chain ");
         lvalue(match);
         fprintf(water->output, " = { water_Select, \"L%.6x\", ", branch->id);
@@ -1187,8 +2279,6 @@ static bool write_Tree(H2oParser water, H2oNode match) {
 
     inline bool write_tuple() {
         H2oBranch branch = match.branch;
-        write_node(branch->before);
-        write_node(branch->after);
         fprintf(water->output, "static const struct water_chain ");
         lvalue(match);
         fprintf(water->output, " = { water_Tuple, \"L%.6x\", ", branch->id);
@@ -1215,7 +2305,6 @@ static bool write_Tree(H2oParser water, H2oNode match) {
 
     inline bool write_childern() {
         H2oOperator operator = match.operator;
-        write_node(operator->value);
         fprintf(water->output, "static const struct water_function ");
         lvalue(match);
         fprintf(water->output, " = { water_Childern, \"L%.6x\", ", operator->id);
@@ -1226,8 +2315,6 @@ static bool write_Tree(H2oParser water, H2oNode match) {
 
     inline bool write_and() {
         H2oBranch branch = match.branch;
-        write_node(branch->before);
-        write_node(branch->after);
         fprintf(water->output, "static const struct water_chain ");
         lvalue(match);
         fprintf(water->output, " = { water_And, \"L%.6x\", ", branch->id);
@@ -1240,8 +2327,6 @@ static bool write_Tree(H2oParser water, H2oNode match) {
 
     inline bool write_or() {
         H2oBranch branch = match.branch;
-        write_node(branch->before);
-        write_node(branch->after);
         fprintf(water->output, "static const struct water_chain ");
         lvalue(match);
         fprintf(water->output, " = { water_Or, \"L%.6x\", ", branch->id);
@@ -1254,8 +2339,6 @@ static bool write_Tree(H2oParser water, H2oNode match) {
 
     inline bool write_sequence() {
         H2oBranch branch = match.branch;
-        write_node(branch->before);
-        write_node(branch->after);
         fprintf(water->output, "static const struct water_chain ");
         lvalue(match);
         fprintf(water->output, " = { water_Sequence, \"L%.6x\", ", branch->id);
@@ -1290,6 +2373,7 @@ static bool write_Tree(H2oParser water, H2oNode match) {
     case water_one_plus:  return write_one_plus();
     case water_or:        return write_or();
     case water_predicate: return write_predicate();
+    case water_guard:     return write_guard();
     case water_range:     return write_range();
     case water_select:    return write_select();
     case water_sequence:  return write_sequence();
@@ -1301,16 +2385,136 @@ static bool write_Tree(H2oParser water, H2oNode match) {
     return false;
 }
 
-static bool write_Ccode(H2oParser water,
-                        const char* name)
+// write every node of a rule, the nodes used before their users
+static bool write_Tree(H2oParser water, struct water_walk *walk, H2oNode match) {
+    if (!match.any) return false;
+
+    if (water_define == match.any->type) {
+        H2oDefine   rule = match.define;
+        const char* text = rule->name.start;
+        unsigned  length = rule->name.length;
+        fprintf(water->output, "\n// rule %*.*s\n", length, length, text);
+    }
+
+    H2oNode node;
+
+    if (!walk_Start(walk, match)) return false;
+
+    while (walk_Next(walk, &node)) {
+        if (!write_Node(water, node)) return false;
+    }
+
+    return !walk->failed;
+}
+
+static void write_Quoted(H2oParser water, const char* text) {
+    fputc('"', water->output);
+    for ( ; *text ; ++text) {
+        if ('"' == *text || '\\' == *text) fputc('\\', water->output);
+        fputc(*text, water->output);
+    }
+    fputc('"', water->output);
+}
+
+// the source map of the rules begin .. end (not including end)
+// - a place for every label between the lowest and highest node
+static bool write_Source(H2oParser water,
+                         struct water_walk *walk,
+                         H2oDefine begin,
+                         H2oDefine end,
+                         unsigned shard)
 {
+    unsigned  low  = UINT_MAX;
+    unsigned  high = 0;
+    H2oDefine rule = begin;
+    H2oNode   node;
+
+    for ( ; rule != end ; rule = rule->next) {
+        if (!walk_Start(walk, rule->match)) continue;
+        while (walk_Next(walk, &node)) {
+            if (node.any->id < low)  low  = node.any->id;
+            if (node.any->id > high) high = node.any->id;
+        }
+        if (walk->failed) return false;
+    }
+
+    unsigned   count  = (low <= high ? high - low + 1 : 0);
+    H2oDefine *owners = calloc(count + 1, sizeof(H2oDefine));
+
+    if (!owners) return false;
+
+    for (rule = begin ; rule != end ; rule = rule->next) {
+        if (!walk_Start(walk, rule->match)) continue;
+        while (walk_Next(walk, &node)) {
+            owners[node.any->id - low] = rule;
+        }
+    }
+
+    fprintf(water->output, "\nstatic const struct water_place source_place[] = {\n");
+
+    unsigned index = 0;
+
+    for ( ; index < count ; ++index) {
+        unsigned id = low + index;
+
+        if (!(rule = owners[index])) {
+            fprintf(water->output, "    { 0 },\n");
+            continue;
+        }
+
+        fprintf(water->output, "    { (H2oCode) &L%.6x, \"%*.*s\", %u, %u },\n",
+                id,
+                (int) rule->name.length,
+                (int) rule->name.length,
+                rule->name.start,
+                water->positions[id].line,
+                water->positions[id].column);
+    }
+
+    fprintf(water->output, "    { 0 }\n};\n");
+
+    if (water->exported) {
+        fprintf(water->output, "struct water_source %s_source_%u = { ", water->exported, shard);
+    } else {
+        fprintf(water->output, "static struct water_source source_map = { ");
+    }
+
+    write_Quoted(water, water->buffer.filename);
+
+    fprintf(water->output, ", %u, %u, source_place };\n", (count ? low : 0), count);
+
+    free(owners);
+
+    return true;
+}
+
+static void write_Banner(H2oParser water, const char* include) {
     fprintf(water->output,
             "/*-*- mode: c;-*-*/\n"
             "/* A recursive-descent tree parser generated by water 1.0.0 */\n"
             "\n"
             "/* ================================================== */\n"
-            "#include <water.h>\n"
-            "/* ================================================== */\n");
+            "#include %s\n"
+            "/* ================================================== */\n", include);
+
+    if (!water->guards) return;
+
+    // the %{ } guards see the current node as NODE (and the Water as WATER)
+    // - a guard that reads NODE needs its type: compile the C file with
+    //   H2O_GUARD_HEADER naming the header that declares it and
+    //   H2O_GUARD_NODE naming the type
+    fprintf(water->output,
+            "\n"
+            "/* a %%{ } guard that reads NODE needs -DH2O_GUARD_HEADER=<header> -DH2O_GUARD_NODE=<type> */\n"
+            "#if defined(H2O_GUARD_HEADER)\n"
+            "#include H2O_GUARD_HEADER\n"
+            "#endif\n"
+            "#if !defined(H2O_GUARD_NODE)\n"
+            "#define H2O_GUARD_NODE void\n"
+            "#endif\n");
+}
+
+static void write_Caches(H2oParser water) {
     fprintf(water->output, "\n");
     fprintf(water->output, "static void *rule_value[%u];\n",      water->identifer.count);
     fprintf(water->output, "static void *root_value[%u];\n",      water->label.count);
@@ -1332,39 +2536,118 @@ static bool write_Ccode(H2oParser water,
     write_Table(water, &water->predicate);
 
     fprintf(water->output, "\n");
-    fprintf(water->output, "struct water_cache rules      = { rule_cache,      0, %u, rule_list,      rule_value,      };\n", water->identifer.count);
-    fprintf(water->output, "struct water_cache roots      = { root_cache,      0, %u, root_list,      root_value,      };\n", water->label.count);
-    fprintf(water->output, "struct water_cache events     = { event_cache,     0, %u, event_list,     event_value,     };\n", water->event.count);
-    fprintf(water->output, "struct water_cache predicates = { predicate_cache, 0, %u, predicate_list, predicate_value, };\n", water->predicate.count);
+
+    const char *rule_index      = (write_Index(water, &water->identifer, "rule")      ? "&rule_index"      : "0");
+    const char *root_index      = (write_Index(water, &water->label,     "root")      ? "&root_index"      : "0");
+    const char *event_index     = (write_Index(water, &water->event,     "event")     ? "&event_index"     : "0");
+    const char *predicate_index = (write_Index(water, &water->predicate, "predicate") ? "&predicate_index" : "0");
+
+    fprintf(water->output, "\n");
+    fprintf(water->output, "static struct water_first rule_first;\n");
+    fprintf(water->output, "\n");
+    fprintf(water->output, "struct water_cache %s_rules      = { rule_cache,      %u, rule_list,      rule_value,      0, &rule_first, 0, %s };\n", water->name, water->identifer.count, rule_index);
+    fprintf(water->output, "struct water_cache %s_roots      = { root_cache,      %u, root_list,      root_value,      0, 0,           0, %s };\n", water->name, water->label.count,     root_index);
+    fprintf(water->output, "struct water_cache %s_events     = { event_cache,     %u, event_list,     event_value,     0, 0,           0, %s };\n", water->name, water->event.count,     event_index);
+    fprintf(water->output, "struct water_cache %s_predicates = { predicate_cache, %u, predicate_list, predicate_value, 0, 0,           0, %s };\n", water->name, water->predicate.count, predicate_index);
     fprintf(water->output, "\n");
+}
 
-    H2oDefine rule = water->rule;
+// the grammar (see h2o_LoadGrammarLibrary) and the registration
+static void write_Register(H2oParser water,
+                           const char* name,
+                           H2oDefine *defines)
+{
+    unsigned  count = 0;
+    H2oDefine rule  = water->rule;
+
+    for ( ; rule ; rule = rule->next) ++count;
 
-    while (rule) {
-        if (!write_Tree(water, rule)) return false;
-        rule = rule->next;
+    fprintf(water->output, "\nstatic const char *rule_names[] = {\n");
+
+    for (rule = water->rule ; rule ; rule = rule->next) {
+        fprintf(water->output, "    \"%*.*s\",\n",
+                (int) rule->name.length, (int) rule->name.length, rule->name.start);
     }
 
-    fprintf(water->output,
-            "\n"
-            "extern bool %s(Water water) {\n"
+    fprintf(water->output, "    0\n};\n");
+    fprintf(water->output, "\nstatic const char *rule_qualified[] = {\n");
+
+    for (rule = water->rule ; rule ; rule = rule->next) {
+        fprintf(water->output, "    \"%s.%*.*s\",\n",
+                name, (int) rule->name.length, (int) rule->name.length, rule->name.start);
+    }
+
+    fprintf(water->output, "    0\n};\n");
+
+    // (the shard sources are added by the registration)
+    fprintf(water->output,
+            "\n"
+            "static H2oCode rule_codes[%u];\n"
+            "\n"
+            "static struct water_grammar grammar_info = {\n"
+            "    \"%s\", %u, rule_names, rule_qualified, rule_codes,\n"
+            "    &%s_rules, &%s_roots, &%s_events, &%s_predicates,\n"
+            "    %s\n"
+            "};\n",
+            count + 1,
+            name, count,
+            name, name, name, name,
+            (water->exported ? "0" : "&source_map"));
+
+    fprintf(water->output,
             "\n"
-            "    if (!h2o_AddCache(water, &rules))      return false;\n"
-            "    if (!h2o_AddCache(water, &roots))      return false;\n"
-            "    if (!h2o_AddCache(water, &events))     return false;\n"
-            "    if (!h2o_AddCache(water, &predicates)) return false;\n"
+            "extern H2oGrammar %s_grammar(void) {\n"
             "\n", name);
 
-    rule = water->rule;
+    // the rule heads are in other files, so the FIRST codes are filled in here
+    if (water->exported) {
+        unsigned index = 0;
+        for ( ; index < water->identifer.count ; ++index) {
+            H2oDefine rule = defines[index];
+            if (!first_Prune(rule)) continue;
+            fprintf(water->output, "    rule_first_code[%u] = ", index);
+            write_Head(water, rule);
+            fprintf(water->output, ";\n");
+        }
+        fprintf(water->output, "\n");
+    }
 
-    while (rule) {
-        const char* text = rule->name.start;
-        unsigned  length = rule->name.length;
-        unsigned      id = rule->id;
-        fprintf(water->output,
-                "    if (!h2o_AddName(water, \"%*.*s\", L%.6x)) return false;\n",
-                length, length, text, id);
-        rule = rule->next;
+    // the rules defined here need no look up
+    unsigned index = 0;
+
+    for ( ; index < water->identifer.count ; ++index) {
+        H2oDefine rule = defines[index];
+        if (!rule) continue;
+        fprintf(water->output, "    rule_value[%u] = (void *) ", index);
+        write_Head(water, rule);
+        fprintf(water->output, ";\n");
+    }
+
+    fprintf(water->output, "\n");
+
+    for (index = 0, rule = water->rule ; rule ; rule = rule->next, ++index) {
+        fprintf(water->output, "    rule_codes[%u] = ", index);
+        write_Head(water, rule);
+        fprintf(water->output, ";\n");
+    }
+
+    fprintf(water->output,
+            "\n"
+            "    return &grammar_info;\n"
+            "}\n"
+            "\n"
+            "extern bool %s(Water water) {\n"
+            "    if (!h2o_AttachGrammar(water, %s_grammar())) return false;\n",
+            name, name);
+
+    if (water->exported) {
+        unsigned shard = 1;
+        fprintf(water->output, "\n");
+        for ( ; shard <= water->shards ; ++shard) {
+            fprintf(water->output,
+                    "    if (!h2o_AddSource(water, &%s_source_%u)) return false;\n",
+                    water->exported, shard);
+        }
     }
 
     fprintf(water->output,
@@ -1372,18 +2655,948 @@ static bool write_Ccode(H2oParser water,
             "    return true;\n"
             "}\n"
             "\n");
+}
+
+// the declarations every shard shares
+static void write_Header(H2oParser water,
+                         const char* name)
+{
+    fprintf(water->output,
+            "/*-*- mode: c;-*-*/\n"
+            "/* The shared declarations of %s generated by water 1.0.0 */\n"
+            "#if !defined(_%s_shards_h_)\n"
+            "#define _%s_shards_h_\n"
+            "\n"
+            "/* ================================================== */\n"
+            "#include <water.h>\n"
+            "/* ================================================== */\n"
+            "\n"
+            "extern struct water_cache %s_rules;\n"
+            "extern struct water_cache %s_roots;\n"
+            "extern struct water_cache %s_events;\n"
+            "extern struct water_cache %s_predicates;\n"
+            "\n",
+            name, name, name, name, name, name, name);
+
+    H2oDefine rule = water->rule;
+
+    for ( ; rule ; rule = rule->next) {
+        const char* text = rule->name.start;
+        unsigned  length = rule->name.length;
+        fprintf(water->output, "extern const H2oCode ");
+        write_Head(water, rule);
+        fprintf(water->output, "; // rule %*.*s\n", length, length, text);
+    }
+
+    fprintf(water->output, "\n");
+
+    unsigned shard = 1;
+
+    for ( ; shard <= water->shards ; ++shard) {
+        fprintf(water->output, "extern struct water_source %s_source_%u;\n", name, shard);
+    }
+
+    fprintf(water->output,
+            "\n"
+            "extern H2oGrammar %s_grammar(void);\n"
+            "extern bool %s(Water water);\n"
+            "\n"
+            "#endif\n",
+            name, name);
+}
+
+// <outfile> without its .c, then _names.h
+extern void water_NamesPath(const char* outfile, char *path, size_t size) {
+    size_t length = strlen(outfile);
+
+    if (2 < length && !strcmp(outfile + length - 2, ".c")) length -= 2;
+
+    snprintf(path, size, "%.*s_names.h", (int) length, outfile);
+}
+
+// an enum of the indexes symbol_Add gave a table
+static bool write_Enum(H2oParser water,
+                       const char* name,
+                       const char* kind,
+                       H2oTable table)
+{
+    H2oSymbol *symbols = calloc(table->count + 1, sizeof(H2oSymbol));
+
+    if (!symbols) return false;
+
+    H2oSymbol symbol = table->last;
+
+    for ( ; symbol ; symbol = symbol->next) {
+        symbols[symbol->index] = symbol;
+    }
+
+    fprintf(water->output, "enum %s_%s {\n", name, kind);
+
+    unsigned index = 0;
+
+    for ( ; index < table->count ; ++index) {
+        const char* text = symbols[index]->name.start;
+        unsigned  length = symbols[index]->name.length;
+        unsigned  inx    = 0;
+
+        fprintf(water->output, "    %s_%s_", name, kind);
+
+        // (names may hold characters C does not take)
+        for ( ; inx < length ; ++inx) {
+            fputc((isalnum((unsigned char) text[inx]) ? text[inx] : '_'), water->output);
+        }
+
+        fprintf(water->output, " = %u,\n", index);
+    }
+
+    fprintf(water->output,
+            "    %s_%s_count = %u\n"
+            "};\n"
+            "\n",
+            name, kind, table->count);
+
+    free(symbols);
 
     return true;
 }
 
+// the companion header, <base>_names.h, for binding by index
+// (see h2o_BindEvents)
+static bool write_Names(H2oParser water,
+                        const char* name)
+{
+    if (!water->outfile) return true;
+
+    char path[strlen(water->outfile) + 16];
+
+    water_NamesPath(water->outfile, path, sizeof(path));
+
+    FILE *output = water->output;
+    FILE *file   = fopen(path, "w");
+
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    water->output = file;
+
+    fprintf(water->output,
+            "/*-*- mode: c;-*-*/\n"
+            "/* The rule, root, event and predicate indexes of %s generated by water 1.0.0 */\n"
+            "#if !defined(_%s_names_h_)\n"
+            "#define _%s_names_h_\n"
+            "\n"
+            "/* ================================================== */\n"
+            "#include <water.h>\n"
+            "/* ================================================== */\n"
+            "\n",
+            name, name, name);
+
+    bool result = (write_Enum(water, name, "rule",      &water->identifer)
+                   && write_Enum(water, name, "root",      &water->label)
+                   && write_Enum(water, name, "event",     &water->event)
+                   && write_Enum(water, name, "predicate", &water->predicate));
+
+    fprintf(water->output,
+            "extern struct water_cache %s_rules;\n"
+            "extern struct water_cache %s_roots;\n"
+            "extern struct water_cache %s_events;\n"
+            "extern struct water_cache %s_predicates;\n"
+            "\n"
+            "extern H2oGrammar %s_grammar(void);\n"
+            "extern bool %s(Water water);\n"
+            "\n"
+            "#endif\n",
+            name, name, name, name, name, name);
+
+    fclose(file);
+
+    water->output = output;
+
+    return result;
+}
+
+static unsigned tree_Size(struct water_walk *walk, H2oNode match) {
+    unsigned size = 0;
+    H2oNode  node;
+
+    if (!walk_Start(walk, match)) return 0;
+
+    while (walk_Next(walk, &node)) ++size;
+
+    return size;
+}
+
+// write <base>.h, the caches and registration into the output file,
+// and the rules into <base>_1.c ... <base>_N.c
+// (where <base> is the output file without its .c)
+static bool write_Shards(H2oParser water,
+                         const char* name,
+                         H2oDefine *defines)
+{
+    if (!water->outfile) {
+        fprintf(stderr, "sharding needs an output file\n");
+        return false;
+    }
+
+    size_t length = strlen(water->outfile);
+
+    if (2 < length && !strcmp(water->outfile + length - 2, ".c")) length -= 2;
+
+    char base[length + 1];
+    char path[length + 16];
+    char quoted[length + 5];
+
+    memcpy(base, water->outfile, length);
+    base[length] = 0;
+
+    const char *slash   = strrchr(base, '/');
+    const char *include = (slash ? slash + 1 : base);
+
+    snprintf(quoted, sizeof(quoted), "\"%s.h\"", include);
+
+    struct water_walk walk;
+    FILE  *output = water->output;
+    FILE  *file   = 0;
+
+    memset(&walk, 0, sizeof(walk));
+
+    inline bool done(bool result) {
+        if (file) fclose(file);
+        walk_Free(&walk);
+        water->output   = output;
+        water->exported = 0;
+        return result;
+    }
+
+    inline bool open_File(const char *format, unsigned number) {
+        if (file) fclose(file);
+        snprintf(path, sizeof(path), format, base, number);
+        if (!(file = fopen(path, "w"))) {
+            perror(path);
+            return false;
+        }
+        water->output = file;
+        return true;
+    }
+
+    water->exported = name;
+
+    if (!open_File("%s.h", 0)) return done(false);
+
+    write_Header(water, name);
+
+    // the registration
+    water->output = output;
+
+    write_Banner(water, quoted);
+    write_Caches(water);
+
+    if (!write_First(water, defines)) return done(false);
+
+    write_Register(water, name, defines);
+
+    // the rules, balanced by node count
+    unsigned total   = water->next_id;
+    unsigned written = 0;
+    unsigned shard   = 1;
+
+    if (!open_File("%s_%u.c", shard)) return done(false);
+
+    write_Banner(water, quoted);
+
+    H2oDefine begin = water->rule;
+    H2oDefine rule  = begin;
+
+    for ( ; rule ; rule = rule->next) {
+        unsigned size = tree_Size(&walk, rule);
+
+        if (shard < water->shards && 0 < written && ((size_t) total * shard) < ((size_t) written * water->shards)) {
+            if (!write_Source(water, &walk, begin, rule, shard)) return done(false);
+            if (!open_File("%s_%u.c", ++shard)) return done(false);
+            write_Banner(water, quoted);
+            begin = rule;
+        }
+
+        if (!write_Tree(water, &walk, rule)) return done(false);
+
+        written += size;
+    }
+
+    if (!write_Source(water, &walk, begin, 0, shard)) return done(false);
+
+    // every shard exists, even with more shards than rules
+    while (shard < water->shards) {
+        if (!open_File("%s_%u.c", ++shard)) return done(false);
+        write_Banner(water, quoted);
+        if (!write_Source(water, &walk, 0, 0, shard)) return done(false);
+    }
+
+    return done(true);
+}
+
+static bool write_Ccode(H2oParser water,
+                        const char* name)
+{
+    H2oDefine *defines = 0;
+
+    water->name = name;
+
+    if (!first_Defines(water, &defines)) return false;
+
+    inline bool done(bool result) {
+        free(defines);
+        return result;
+    }
+
+    if (!first_Rules(water, defines)) return done(false);
+    if (!write_Names(water, name))    return done(false);
+
+    if (1 < water->shards) {
+        return done(write_Shards(water, name, defines));
+    }
+
+    write_Banner(water, "<water.h>");
+    write_Caches(water);
+
+    struct water_walk walk;
+
+    memset(&walk, 0, sizeof(walk));
+
+    H2oDefine rule = water->rule;
+
+    for ( ; rule ; rule = rule->next) {
+        if (!write_Tree(water, &walk, rule)) {
+            walk_Free(&walk);
+            return done(false);
+        }
+    }
+
+    if (!write_Source(water, &walk, water->rule, 0, 0)) {
+        walk_Free(&walk);
+        return done(false);
+    }
+
+    walk_Free(&walk);
+
+    if (!write_First(water, defines)) return done(false);
+
+    write_Register(water, name, defines);
+
+    return done(true);
+}
+
 /*------------------------------------------------------------*/
 
-/* from water.c */
-extern bool water_graph(Copper input);
+static inline bool bytes_Reserve(H2oBytes bytes, size_t size, size_t align, size_t *offset) {
+    if (!bytes)  return false;
+    if (!offset) return false;
+
+    size_t at  = (bytes->length + (align - 1)) & ~(align - 1);
+    size_t end = at + size;
+
+    if (end > bytes->allocated) {
+        size_t allocated = (bytes->allocated ? bytes->allocated : 4096);
+
+        while (allocated < end) allocated *= 2;
+
+        char *start = realloc(bytes->start, allocated);
+
+        if (!start) return false;
+
+        memset(start + bytes->allocated, 0, allocated - bytes->allocated);
+
+        bytes->start     = start;
+        bytes->allocated = allocated;
+    }
+
+    bytes->length = end;
+    *offset       = at;
+
+    return true;
+}
+
+static inline bool bytes_Append(H2oBytes bytes, const void *value, size_t size, size_t align, size_t *offset) {
+    if (!bytes_Reserve(bytes, size, align, offset)) return false;
+
+    memcpy(bytes->start + *offset, value, size);
+
+    return true;
+}
+
+static inline bool bytes_String(H2oBytes bytes, const char *text, unsigned length, size_t *offset) {
+    if (!bytes_Reserve(bytes, length + 1, 1, offset)) return false;
+
+    memcpy(bytes->start + *offset, text, length);
+    bytes->start[*offset + length] = 0;
+
+    return true;
+}
+
+// write a pointer (to target) at slot and record its relocation
+static inline bool bytes_Pointer(H2oBytes bytes, size_t slot, size_t target) {
+    if (!bytes) return false;
+
+    if (bytes->rcount >= bytes->rallocated) {
+        size_t  allocated = (bytes->rallocated ? bytes->rallocated * 2 : 1024);
+        size_t *relocs    = realloc(bytes->relocs, allocated * sizeof(size_t));
+
+        if (!relocs) return false;
+
+        bytes->relocs     = relocs;
+        bytes->rallocated = allocated;
+    }
+
+    size_t value = bytes->base + target;
+
+    memcpy(bytes->start + slot, &value, sizeof(size_t));
+
+    bytes->relocs[bytes->rcount++] = slot;
+
+    return true;
+}
+
+// pick a base address for the image from its name
+// so images of different grammars rarely want the same address
+static size_t image_Base(const char* name) {
+    unsigned hash = text_Hash(name, strlen(name));
+
+#if __SIZEOF_POINTER__ == 8
+    return 0x200000000000UL + (((size_t) (hash & 0xffff)) << 28);
+#else
+    return 0x40000000UL + (((size_t) (hash & 0x3f)) << 22);
+#endif
+}
+
+// the order of the caches in the image
+enum water_image_cache {
+    image_rules,
+    image_roots,
+    image_events,
+    image_predicates,
+    image_void
+};
+
+// the childern are already written (at nodes[child id])
+static bool write_ImageNode(H2oBytes image, size_t caches[], size_t nodes[], H2oNode match, size_t *offset) {
+
+    size_t label = 0;
+
+    inline bool write_node(H2oNode value, size_t *at) {
+        if (!value.any) return false;
+        *at = nodes[value.any->id];
+        return 0 != *at;
+    }
+
+    inline bool write_label() {
+        char buffer[20];
+        int  length = snprintf(buffer, sizeof(buffer), "L%.6x", match.any->id);
+        return bytes_String(image, buffer, length, &label);
+    }
+
+    inline bool write_code(H2oOperation oper) {
+        struct water_code value;
+        memset(&value, 0, sizeof(value));
+        value.oper = oper;
+        if (!bytes_Append(image, &value, sizeof(value), __alignof__(value), offset)) return false;
+        return bytes_Pointer(image, *offset + offsetof(struct water_code, label), label);
+    }
+
+    inline bool write_action(H2oOperation oper, enum water_image_cache cache) {
+        H2oText text = match.text;
+        size_t  name = 0;
+        if (!bytes_String(image, text->value.start, text->value.length, &name)) return false;
+
+        struct water_action value;
+        memset(&value, 0, sizeof(value));
+        value.oper  = oper;
+        value.index = text->index;
+        if (!bytes_Append(image, &value, sizeof(value), __alignof__(value), offset)) return false;
+        if (!bytes_Pointer(image, *offset + offsetof(struct water_action, label), label))         return false;
+        if (!bytes_Pointer(image, *offset + offsetof(struct water_action, cache), caches[cache])) return false;
+        return bytes_Pointer(image, *offset + offsetof(struct water_action, name), name);
+    }
+
+    inline bool write_function(H2oOperation oper) {
+        size_t argument = 0;
+        if (!write_node(match.operator->value, &argument)) return false;
+
+        struct water_function value;
+        memset(&value, 0, sizeof(value));
+        value.oper = oper;
+        if (!bytes_Append(image, &value, sizeof(value), __alignof__(value), offset)) return false;
+        if (!bytes_Pointer(image, *offset + offsetof(struct water_function, label), label)) return false;
+        return bytes_Pointer(image, *offset + offsetof(struct water_function, argument), argument);
+    }
+
+    inline bool write_chain(H2oOperation oper) {
+        size_t before = 0;
+        size_t after  = 0;
+        if (!write_node(match.branch->before, &before)) return false;
+        if (!write_node(match.branch->after,  &after))  return false;
+
+        struct water_chain value;
+        memset(&value, 0, sizeof(value));
+        value.oper = oper;
+        if (!bytes_Append(image, &value, sizeof(value), __alignof__(value), offset)) return false;
+        if (!bytes_Pointer(image, *offset + offsetof(struct water_chain, label),  label))  return false;
+        if (!bytes_Pointer(image, *offset + offsetof(struct water_chain, before), before)) return false;
+        return bytes_Pointer(image, *offset + offsetof(struct water_chain, after), after);
+    }
+
+    inline bool write_group() {
+        H2oRange range    = match.range;
+        size_t   argument = 0;
+        if (!write_node(range->value, &argument)) return false;
+
+        struct water_group value;
+        memset(&value, 0, sizeof(value));
+        value.oper    = water_Range;
+        value.minimum = range->min;
+        value.maximum = range->max;
+        if (!bytes_Append(image, &value, sizeof(value), __alignof__(value), offset)) return false;
+        if (!bytes_Pointer(image, *offset + offsetof(struct water_group, label), label)) return false;
+        return bytes_Pointer(image, *offset + offsetof(struct water_group, argument), argument);
+    }
+
+    if (!match.any) return false;
+    if (!offset)    return false;
+
+    if (!write_label()) return false;
+
+    H2oType type = match.any->type;
+
+    switch (type) {
+    case water_and:       return write_chain(water_And);
+    case water_any:       return write_code(water_Any);
+    case water_assert:    return write_function(water_Assert);
+    case water_childern:  return write_function(water_Childern);
+    case water_event:     return write_action(water_Event, image_events);
+    case water_identifer: return write_action(water_Apply, image_rules);
+    case water_label:     return write_action(water_Root, image_roots);
+    case water_leaf:      return write_code(water_Leaf);
+    case water_maybe:     return write_function(water_Maybe);
+    case water_not:       return write_function(water_Not);
+    case water_one_plus:  return write_function(water_OnePlus);
+    case water_or:        return write_chain(water_Or);
+    case water_predicate: return write_action(water_Predicate, image_predicates);
+    case water_range:     return write_group();
+    case water_select:    return write_chain(water_Select);
+    case water_sequence:  return write_chain(water_Sequence);
+    case water_tuple:     return write_chain(water_Tuple);
+    case water_zero_plus: return write_function(water_ZeroPlus);
+    case water_guard:
+        fprintf(stderr, "%%{ } guards are C code, they need --emit=c\n");
+        break;
+    case water_count:     break;
+    case water_define:    break;
+    case water_void:      break;
+    }
+
+    return false;
+}
+
+static bool write_ImageTree(H2oBytes image, size_t caches[], size_t nodes[],
+                            struct water_walk *walk, H2oNode match, size_t *offset)
+{
+    H2oNode node;
+
+    if (!walk_Start(walk, match)) return false;
+
+    while (walk_Next(walk, &node)) {
+        if (!write_ImageNode(image, caches, nodes, node, &nodes[node.any->id])) return false;
+    }
+
+    if (walk->failed) return false;
+
+    *offset = nodes[match.any->id];
+
+    return true;
+}
+
+// lay the grammar out as an image in bytes (see struct water_image)
+static bool image_Build(H2oParser water,
+                        const char* name,
+                        H2oBytes bytes)
+{
+    struct water_bytes image;
+    struct water_image header;
+
+    memset(&image,  0, sizeof(image));
+    memset(&header, 0, sizeof(header));
+
+    H2oTable tables[image_void] = {
+        [image_rules]      = &water->identifer,
+        [image_roots]      = &water->label,
+        [image_events]     = &water->event,
+        [image_predicates] = &water->predicate,
+    };
+
+    H2oCacheType types[image_void] = {
+        [image_rules]      = rule_cache,
+        [image_roots]      = root_cache,
+        [image_events]     = event_cache,
+        [image_predicates] = predicate_cache,
+    };
+
+    size_t caches[image_void];
+    size_t values[image_void];
+    size_t page  = sysconf(_SC_PAGESIZE);
+    size_t at    = 0;
+    size_t count = 0;
+    size_t names = 0;
+    size_t codes = 0;
+    size_t text  = 0;
+
+    image.base = image_Base(name);
+    water->name = name;
+
+    H2oDefine *defines = 0;
+    size_t    *starts  = calloc(water->identifer.count + 1, sizeof(size_t));
+    size_t    *nodes   = calloc(water->next_id + 1, sizeof(size_t));
+    size_t    *titles  = calloc(water->next_id + 1, sizeof(size_t));
+
+    struct water_walk walk;
+
+    memset(&walk, 0, sizeof(walk));
+
+    inline bool done(bool result) {
+        walk_Free(&walk);
+        free(defines);
+        free(starts);
+        free(nodes);
+        free(titles);
+        free(image.relocs);
+        if (result) {
+            *bytes = image;
+            bytes->relocs = 0;
+        } else {
+            free(image.start);
+        }
+        return result;
+    }
+
+    if (!starts)                             return done(false);
+    if (!nodes)                              return done(false);
+    if (!titles)                             return done(false);
+    if (!first_Defines(water, &defines))     return done(false);
+    if (!first_Rules(water, defines))        return done(false);
+
+    H2oDefine rule = water->rule;
+
+    for ( ; rule ; rule = rule->next) ++count;
+
+    if (!bytes_Reserve(&image, sizeof(header), 8, &at)) return done(false);
+
+    /* data (writable) */
+    if (!bytes_Reserve(&image, 0, page, &header.data)) return done(false);
+
+    if (!bytes_Reserve(&image,
+                       sizeof(struct water_grammar),
+                       __alignof__(struct water_grammar),
+                       &header.grammar)) return done(false);
+
+    unsigned inx = 0;
+    for ( ; inx < image_void ; ++inx) {
+        if (!bytes_Reserve(&image,
+                           sizeof(struct water_cache),
+                           __alignof__(struct water_cache),
+                           &caches[inx])) return done(false);
+        if (!bytes_Reserve(&image,
+                           sizeof(void*) * tables[inx]->count,
+                           __alignof__(void*),
+                           &values[inx])) return done(false);
+    }
+
+    size_t source = 0;
+
+    if (!bytes_Reserve(&image,
+                       sizeof(struct water_source),
+                       __alignof__(struct water_source),
+                       &source)) return done(false);
+
+    /* code (read-only) */
+    if (!bytes_Reserve(&image, 0, page, &header.code)) return done(false);
+
+    for (inx = 0 ; inx < image_void ; ++inx) {
+        H2oTable table = tables[inx];
+
+        if (!bytes_Reserve(&image,
+                           sizeof(char*) * table->count,
+                           __alignof__(char*),
+                           &names)) return done(false);
+
+        H2oSymbol symbol = table->last;
+
+        for ( ; symbol ; symbol = symbol->next) {
+            if (!bytes_String(&image, symbol->name.start, symbol->name.length, &text)) return done(false);
+            if (!bytes_Pointer(&image, names + (sizeof(char*) * symbol->index), text)) return done(false);
+        }
+
+        struct water_cache cache;
+
+        memset(&cache, 0, sizeof(cache));
+
+        cache.type  = types[inx];
+        cache.count = table->count;
+
+        memcpy(image.start + caches[inx], &cache, sizeof(cache));
+
+        if (!bytes_Pointer(&image, caches[inx] + offsetof(struct water_cache, names),  names))       return done(false);
+        if (!bytes_Pointer(&image, caches[inx] + offsetof(struct water_cache, values), values[inx])) return done(false);
+
+        struct water_perfect perfect;
+
+        if (!perfect_Build(table, &perfect)) continue;
+
+        size_t seeds = 0;
+        size_t slots = 0;
+        size_t index = 0;
+
+        bool write_index() {
+            if (!bytes_Reserve(&image, sizeof(unsigned) * perfect.buckets, __alignof__(unsigned), &seeds)) return false;
+            if (!bytes_Reserve(&image, sizeof(unsigned) * table->count,    __alignof__(unsigned), &slots)) return false;
+            if (!bytes_Reserve(&image,
+                               sizeof(struct water_index),
+                               __alignof__(struct water_index),
+                               &index)) return false;
+
+            memcpy(image.start + seeds, perfect.seeds, sizeof(unsigned) * perfect.buckets);
+            memcpy(image.start + slots, perfect.slots, sizeof(unsigned) * table->count);
+
+            ((struct water_index *) (image.start + index))->buckets = perfect.buckets;
+
+            if (!bytes_Pointer(&image, index + offsetof(struct water_index, seeds), seeds)) return false;
+            if (!bytes_Pointer(&image, index + offsetof(struct water_index, slots), slots)) return false;
+
+            return bytes_Pointer(&image, caches[inx] + offsetof(struct water_cache, index), index);
+        }
+
+        bool written = write_index();
+
+        perfect_Free(&perfect);
+
+        if (!written) return done(false);
+    }
+
+    size_t qualified = 0;
+
+    if (!bytes_Reserve(&image, sizeof(char*)   * count, __alignof__(char*),   &names))     return done(false);
+    if (!bytes_Reserve(&image, sizeof(char*)   * count, __alignof__(char*),   &qualified)) return done(false);
+    if (!bytes_Reserve(&image, sizeof(H2oCode) * count, __alignof__(H2oCode), &codes))     return done(false);
+
+    for (inx = 0, rule = water->rule ; rule ; rule = rule->next, ++inx) {
+        size_t code = 0;
+
+        if (!write_ImageTree(&image, caches, nodes, &walk, rule->match, &code)) return done(false);
+        if (!bytes_String(&image, rule->name.start, rule->name.length, &text)) return done(false);
+
+        // the rule of each node (for the source map)
+        H2oNode node;
+        if (walk_Start(&walk, rule->match)) {
+            while (walk_Next(&walk, &node)) titles[node.any->id] = text;
+        }
+
+        if (!bytes_Pointer(&image, names + (sizeof(char*)   * inx), text)) return done(false);
+        if (!bytes_Pointer(&image, codes + (sizeof(H2oCode) * inx), code)) return done(false);
+
+        size_t length = strlen(name) + 1 + rule->name.length;
+        char   full[length + 1];
+
+        snprintf(full, sizeof(full), "%s.%.*s", name, (int) rule->name.length, rule->name.start);
+
+        if (!bytes_String(&image, full, length, &text))                          return done(false);
+        if (!bytes_Pointer(&image, qualified + (sizeof(char*) * inx), text)) return done(false);
+
+        // the rules defined here need no look up
+        H2oSymbol symbol;
+        if (hash_NFind(&water->identifer.map, rule->name.start, rule->name.length, &symbol)) {
+            starts[symbol->index] = code;
+            if (!bytes_Pointer(&image, values[image_rules] + (sizeof(void*) * symbol->index), code)) return done(false);
+        }
+    }
+
+    /* first sets */
+    unsigned total   = 0;
+    size_t   offsets = 0;
+    size_t   labels  = 0;
+    size_t   heads   = 0;
+    size_t   first   = 0;
+
+    for (inx = 0 ; inx < water->identifer.count ; ++inx) {
+        if (first_Prune(defines[inx])) total += defines[inx]->first.count;
+    }
+
+    if (!bytes_Reserve(&image, sizeof(unsigned) * (water->identifer.count + 1), __alignof__(unsigned), &offsets)) return done(false);
+    if (!bytes_Reserve(&image, sizeof(unsigned) * (total + 1),                  __alignof__(unsigned), &labels))  return done(false);
+    if (!bytes_Reserve(&image, sizeof(H2oCode)  * water->identifer.count,       __alignof__(H2oCode),  &heads))   return done(false);
+
+    for (total = 0, inx = 0 ; inx < water->identifer.count ; ++inx) {
+        rule = defines[inx];
+        if (first_Prune(rule)) {
+            memcpy(image.start + labels + (sizeof(unsigned) * total), rule->first.labels, sizeof(unsigned) * rule->first.count);
+            total += rule->first.count;
+            if (!bytes_Pointer(&image, heads + (sizeof(H2oCode) * inx), starts[inx])) return done(false);
+        }
+        ((unsigned *) (image.start + offsets))[inx + 1] = total;
+    }
+
+    if (!bytes_Reserve(&image,
+                       sizeof(struct water_first),
+                       __alignof__(struct water_first),
+                       &first)) return done(false);
+
+    if (!bytes_Pointer(&image, first + offsetof(struct water_first, roots),   caches[image_roots])) return done(false);
+    if (!bytes_Pointer(&image, first + offsetof(struct water_first, offsets), offsets))             return done(false);
+    if (!bytes_Pointer(&image, first + offsetof(struct water_first, labels),  labels))              return done(false);
+    if (!bytes_Pointer(&image, first + offsetof(struct water_first, codes),   heads))               return done(false);
+    if (!bytes_Pointer(&image, caches[image_rules] + offsetof(struct water_cache, first), first))   return done(false);
+
+    /* source map (a place for every label) */
+    size_t places = 0;
+
+    if (!bytes_Reserve(&image,
+                       sizeof(struct water_place) * (water->next_id + 1),
+                       __alignof__(struct water_place),
+                       &places)) return done(false);
+
+    for (inx = 1 ; inx <= water->next_id ; ++inx) {
+        if (!nodes[inx] || !titles[inx]) continue;
+
+        size_t             slot = places + (sizeof(struct water_place) * (inx - 1));
+        struct water_place place;
+
+        memset(&place, 0, sizeof(place));
+
+        place.line   = water->positions[inx].line;
+        place.column = water->positions[inx].column;
+
+        memcpy(image.start + slot, &place, sizeof(place));
+
+        if (!bytes_Pointer(&image, slot + offsetof(struct water_place, code), nodes[inx]))  return done(false);
+        if (!bytes_Pointer(&image, slot + offsetof(struct water_place, rule), titles[inx])) return done(false);
+    }
+
+    struct water_source map;
+
+    memset(&map, 0, sizeof(map));
+
+    map.first = 1;
+    map.count = water->next_id;
+
+    memcpy(image.start + source, &map, sizeof(map));
+
+    if (!bytes_String(&image, water->buffer.filename, strlen(water->buffer.filename), &text)) return done(false);
+
+    if (!bytes_Pointer(&image, source + offsetof(struct water_source, file),   text))   return done(false);
+    if (!bytes_Pointer(&image, source + offsetof(struct water_source, places), places)) return done(false);
+
+    if (!bytes_String(&image, name, strlen(name), &text)) return done(false);
+
+    struct water_grammar grammar;
+
+    memset(&grammar, 0, sizeof(grammar));
+
+    grammar.count = count;
+
+    memcpy(image.start + header.grammar, &grammar, sizeof(grammar));
+
+    at = header.grammar;
+
+    if (!bytes_Pointer(&image, at + offsetof(struct water_grammar, name),       text))                     return done(false);
+    if (!bytes_Pointer(&image, at + offsetof(struct water_grammar, names),      names))                    return done(false);
+    if (!bytes_Pointer(&image, at + offsetof(struct water_grammar, qualified),  qualified))                return done(false);
+    if (!bytes_Pointer(&image, at + offsetof(struct water_grammar, codes),      codes))                    return done(false);
+    if (!bytes_Pointer(&image, at + offsetof(struct water_grammar, rules),      caches[image_rules]))      return done(false);
+    if (!bytes_Pointer(&image, at + offsetof(struct water_grammar, roots),      caches[image_roots]))      return done(false);
+    if (!bytes_Pointer(&image, at + offsetof(struct water_grammar, events),     caches[image_events]))     return done(false);
+    if (!bytes_Pointer(&image, at + offsetof(struct water_grammar, predicates), caches[image_predicates])) return done(false);
+    if (!bytes_Pointer(&image, at + offsetof(struct water_grammar, source),     source))                   return done(false);
+
+    /* relocations */
+    header.rcount = image.rcount;
+
+    if (!bytes_Append(&image,
+                      image.relocs,
+                      sizeof(size_t) * image.rcount,
+                      __alignof__(size_t),
+                      &header.relocs)) return done(false);
+
+    memcpy(header.magic, H2O_IMAGE_MAGIC, sizeof(header.magic));
+
+    header.version = H2O_IMAGE_VERSION;
+    header.pointer = sizeof(void*);
+    header.base    = image.base;
+    header.size    = image.length;
+    header.align   = page;
+
+    memcpy(image.start, &header, sizeof(header));
+
+    return done(true);
+}
+
+static bool write_Image(H2oParser water,
+                        const char* name)
+{
+    struct water_bytes image;
+
+    if (!image_Build(water, name, &image)) return false;
+
+    bool result = (image.length == fwrite(image.start, 1, image.length, water->output));
+
+    free(image.start);
+
+    return result;
+}
+
+/*------------------------------------------------------------*/
+
+static void graph_Init() {
+    struct copper graph;
+
+    memset(&graph, 0, sizeof(graph));
+
+    graph.attach = graph_AddName;
+
+    if (!hash_Init(&graph_arena, 1024, &graph_node))  return;
+    if (!hash_Init(&graph_arena, 64, &graph_action)) return;
+
+    graph_SetEvent("and",        and_event);
+    graph_SetEvent("any",        any_event);
+    graph_SetEvent("assert",     assert_event);
+    graph_SetEvent("assign",     assign_event);
+    graph_SetEvent("declare",    declare_event);
+    graph_SetEvent("define",     define_event);
+    graph_SetEvent("event",      event_event);
+    graph_SetEvent("guard",      guard_event);
+    graph_SetEvent("identifier", identifier_event);
+    graph_SetEvent("label",      label_event);
+    graph_SetEvent("leaf",       leaf_event);
+    graph_SetEvent("maybe",      maybe_event);
+    graph_SetEvent("not",        not_event);
+    graph_SetEvent("number",     number_event);
+    graph_SetEvent("one_plus",   one_plus_event);
+    graph_SetEvent("or",         or_event);
+    graph_SetEvent("predicate",  predicate_event);
+    graph_SetEvent("range",      range_event);
+    graph_SetEvent("select",     select_event);
+    graph_SetEvent("sequence",   sequence_event);
+    graph_SetEvent("tree",       tree_event);
+    graph_SetEvent("tuple",      tuple_event);
+    graph_SetEvent("zero_plus",  zero_plus_event);
+
+    water_graph(&graph);
+
+    graph_ready = true;
+}
 
 static bool water_Init(H2oParser water) {
     memset(water, 0, sizeof(struct water_parser));
 
+    if (0 != pthread_once(&graph_once, graph_Init)) return false;
+    if (!graph_ready) return false;
+
     water->base.node      = water_FindNode;
     water->base.attach    = water_AddName;
     water->base.predicate = water_FindPredicate;
@@ -1391,39 +3604,13 @@ static bool water_Init(H2oParser water) {
 
     if (!cu_InputInit(&water->base, 1024)) return false;
 
-    if (!stable_Init(1024, &water->node))      return false;
-    if (!stable_Init(1024, &water->action))   return false;
-    if (!stack_Init(100,   &water->stack))     return false;
-
-    water_SetEvent(water, "and",        and_event);
-    water_SetEvent(water, "any",       any_event);
-    water_SetEvent(water, "assert",     assert_event);
-    water_SetEvent(water, "assign",     assign_event);
-    water_SetEvent(water, "declare",    declare_event);
-    water_SetEvent(water, "define",     define_event);
-    water_SetEvent(water, "event",      event_event);
-    water_SetEvent(water, "identifier", identifier_event);
-    water_SetEvent(water, "label",      label_event);
-    water_SetEvent(water, "leaf",       leaf_event);
-    water_SetEvent(water, "maybe",      maybe_event);
-    water_SetEvent(water, "not",        not_event);
-    water_SetEvent(water, "number",     number_event);
-    water_SetEvent(water, "one_plus",   one_plus_event);
-    water_SetEvent(water, "or",         or_event);
-    water_SetEvent(water, "predicate",  predicate_event);
-    water_SetEvent(water, "range",      range_event);
-    water_SetEvent(water, "select",     select_event);
-    water_SetEvent(water, "sequence",   sequence_event);
-    water_SetEvent(water, "tree",       tree_event);
-    water_SetEvent(water, "tuple",      tuple_event);
-    water_SetEvent(water, "zero_plus",  zero_plus_event);
-
-    if (!table_Init(&water->identifer))  return false;
-    if (!table_Init(&water->event))      return false;
-    if (!table_Init(&water->label))      return false;
-    if (!table_Init(&water->predicate))  return false;
-
-    water_graph((Copper) water);
+    if (!hash_Init(&water->arena, 16, &water->node))    return false;
+    if (!stack_Init(&water->arena, 100, &water->stack)) return false;
+
+    if (!table_Init(&water->arena, &water->identifer))  return false;
+    if (!table_Init(&water->arena, &water->event))      return false;
+    if (!table_Init(&water->arena, &water->label))      return false;
+    if (!table_Init(&water->arena, &water->predicate))  return false;
 
     return true;
 }
@@ -1432,13 +3619,22 @@ extern bool water_Create(const char* infile,
                          const char* outfile,
                          H2oParser *target)
 {
+     if (!target) return false;
+
      H2oParser water = (H2oParser) malloc(sizeof(struct water_parser));
 
      if (!water) return false;
 
-     if (!water_Init(water)) return false;
+     if (!water_Init(water)) {
+         free(water);
+         return false;
+     }
 
-     *target = water;
+     inline bool fail(const char *name) {
+         perror(name);
+         water_Free(water);
+         return false;
+     }
 
      if (!infile) {
          water->buffer.filename = "<stdin>";
@@ -1446,8 +3642,14 @@ extern bool water_Create(const char* infile,
      } else {
          water->buffer.filename = infile;
          if (!(water->buffer.input = fopen(infile, "r"))) {
-             perror(infile);
-             exit(1);
+             return fail(infile);
+         }
+     }
+
+     if (!water_MapInput(&water->buffer)) {
+         water->buffer.allocated = WATER_CHUNK;
+         if (!(water->buffer.line = malloc(WATER_CHUNK))) {
+             return fail(water->buffer.filename);
          }
      }
 
@@ -1455,76 +3657,191 @@ extern bool water_Create(const char* infile,
          water->output = stdout;
      } else {
          if (!(water->output = fopen(outfile, "w"))) {
-             perror(outfile);
-             exit(1);
+             return fail(outfile);
          }
      }
 
+     water->outfile = outfile;
+
+     *target = water;
+
      return true;
 }
 
-extern void water_Parse(H2oParser water,
-                        const char* name)
+// the grammar is in text (which must outlive the parser)
+extern bool water_Text(const char* text,
+                       size_t length,
+                       H2oParser *target)
 {
-    if (!water) return;
+    if (!text)   return false;
+    if (!target) return false;
 
-    if (0 < h2o_global_debug) {
-        printf("before parse\n");
+    H2oParser water = (H2oParser) malloc(sizeof(struct water_parser));
+
+    if (!water) return false;
+
+    if (!water_Init(water)) {
+        free(water);
+        return false;
     }
 
+    water->buffer.filename = "<text>";
+    water->buffer.mapped   = (char *) text;
+    water->buffer.borrowed = true;
+    water->buffer.cursor   = 0;
+    water->buffer.read     = length;
+
+    *target = water;
+
+    return true;
+}
+
+extern bool water_Shards(H2oParser water, unsigned count) {
+    if (!water)     return false;
+    if (1 > count)  return false;
+
+    water->shards = count;
+
+    return true;
+}
+
+// parse the whole input and run its events
+// - a failure is returned (h2o_CompileGrammar runs in the user's process,
+//   so only a syntax error is printed, and the rest only when debugging)
+static bool water_Read(H2oParser water) {
+    H2O_DEBUG(1, "%s: before parse\n", water->buffer.filename);
+
     CuData data = { 0, 0 };
 
     if (!cu_Start("file", (Copper) water)) {
-        printf("start error\n");
-        return;
+        H2O_DEBUG(1, "%s: unable to start the parse\n", water->buffer.filename);
+        return false;
     }
 
     for ( ; ; ) {
         switch(cu_Event((Copper) water, &data)) {
         case cu_NeedData:
             if (!water_MoreData(water, &data)) {
-                printf("read error\n");
-                return;
+                H2O_DEBUG(1, "%s: unable to read\n", water->buffer.filename);
+                return false;
             }
             continue;
 
         case cu_FoundPath:
-            if (0 < h2o_global_debug) {
-                printf("before run\n");
-            }
+            H2O_DEBUG(1, "%s: before run\n", water->buffer.filename);
 
             if (!cu_RunQueue((Copper) water)) {
-                printf("event error\n");
+                H2O_DEBUG(1, "%s: an event failed\n", water->buffer.filename);
+                return false;
             }
 
-            write_Ccode(water, name);
-            return;
+            return true;
 
         case cu_NoPath:
             cu_SyntaxError(stderr,
                            (Copper) water,
                            water->buffer.filename);
-            return;
+            return false;
 
 
         case cu_Error:
-            printf("error error\n");
-            return;
+            H2O_DEBUG(1, "%s: parse error\n", water->buffer.filename);
+            return false;
         }
     }
- }
+}
+
+extern bool water_Parse(H2oParser water,
+                        const char* name,
+                        H2oEmit emit)
+{
+    if (!water) return false;
+
+    if (!water_Read(water)) return false;
+
+    switch (emit) {
+    case emit_ccode:
+        return write_Ccode(water, name);
+
+    case emit_image:
+        if (!write_Image(water, name)) {
+            printf("image error\n");
+            return false;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+// compile straight into memory (as an image that needs no file)
+extern bool water_Compile(H2oParser water,
+                          const char* name,
+                          H2oGrammar *target)
+{
+    if (!water)  return false;
+    if (!name)   return false;
+    if (!target) return false;
+
+    if (!water_Read(water)) return false;
+
+    struct water_bytes image;
+
+    if (!image_Build(water, name, &image)) return false;
+
+    bool result = h2o_LoadGrammarBytes(image.start, image.length, target);
+
+    free(image.start);
+
+    return result;
+}
+
+extern bool h2o_CompileGrammar(const char* name,
+                               const char* text,
+                               size_t length,
+                               H2oGrammar *target)
+{
+    H2oParser water = 0;
+
+    if (!water_Text(text, length, &water)) return false;
+
+    bool result = water_Compile(water, name, target);
+
+    water_Free(water);
+
+    return result;
+}
 
 extern bool water_Free(H2oParser water) {
     if (!water) return false;
     if (!water->buffer.filename) return false;
 
-    if (stdin != water->buffer.input) {
+    if (water->buffer.mapped && !water->buffer.borrowed) {
+        munmap(water->buffer.mapped, water->buffer.read);
+    }
+
+    free(water->buffer.line);
+
+    if (water->buffer.input && stdin != water->buffer.input) {
         fclose(water->buffer.input);
     }
 
-    water->buffer.filename = 0;
-    water->buffer.input    = 0;
-    water->output          = 0;
+    if (water->output && stdout != water->output) {
+        fclose(water->output);
+    }
+
+    free(water->positions);
+
+    hash_Free(&water->node);
+    hash_Free(&water->identifer.map);
+    hash_Free(&water->label.map);
+    hash_Free(&water->event.map);
+    hash_Free(&water->predicate.map);
+
+    // every node, symbol, stack cell and key
+    arena_Free(&water->arena);
+
+    free(water);
 
     return true;
 }
@@ -48,6 +48,11 @@ typedef struct water_symbol   *H2oSymbol;
 typedef struct water_table    *H2oTable;
 typedef struct water_buffer   *H2oBuffer;
 typedef struct water_parser   *H2oParser;
+typedef struct water_bytes    *H2oBytes;
+typedef struct water_block    *H2oBlock;
+typedef struct water_arena    *H2oArena;
+typedef struct water_entry    *H2oEntry;
+typedef struct water_hash     *H2oHash;
 
 union water_node {
     H2oAny      any;
@@ -86,6 +91,7 @@ typedef enum water_type {
     water_count,
     water_define,
     water_event,
+    water_guard,
     water_identifer,
     water_label,
     water_leaf,
@@ -111,6 +117,14 @@ struct water_any {
     unsigned id;
 };
 
+// the FIRST set of a rule (over the label table)
+struct water_first_set {
+    bool      open;      // may succeed whatever the node is
+    bool      nullable;  // may succeed without testing the node
+    unsigned  count;
+    unsigned *labels;    // the labels the rule may start with
+};
+
 // use for
 // - identifier = ....
 struct water_define {
@@ -119,6 +133,7 @@ struct water_define {
     H2oDefine next;
     CuData    name;
     H2oNode   match;
+    struct water_first_set first;
 };
 
 // use for
@@ -126,6 +141,7 @@ struct water_define {
 // - label
 // - event
 // - predicate
+// - guard (the value is the C expression)
 struct water_text {
     H2oType  type;
     unsigned id;
@@ -179,13 +195,64 @@ struct water_branch {
 
 /*------------------------------------------------------------*/
 
+// use for building a grammar image
+struct water_bytes {
+    size_t  base;      // the address the image is laid out for
+    char   *start;
+    size_t  length;
+    size_t  allocated;
+    size_t *relocs;    // offsets of every pointer in the image
+    size_t  rcount;
+    size_t  rallocated;
+};
+
 struct water_buffer {
     const char *filename;
     FILE       *input;
-    unsigned    cursor;
+    size_t      cursor;
     ssize_t     read;
     size_t      allocated;
-    char       *line;
+    char       *line;        // the last block read (if not mapped)
+    char       *mapped;      // the whole input (if it could be mapped)
+    bool        borrowed;    // mapped is the caller's text (see water_Text)
+    unsigned    line_number; // lines printed at -v
+    bool        partial;     // the last line printed was incomplete
+};
+
+// use for every allocation that lives as long as the parser
+// - released in one shot by water_Free
+struct water_block {
+    H2oBlock next;
+    size_t   size;
+    char     start[];
+};
+
+struct water_arena {
+    H2oBlock block;  // the current block (the others follow it)
+    char    *cursor;
+    char    *limit;
+};
+
+// use for the name maps
+struct water_entry {
+    H2oEntry    next;
+    unsigned    hash;
+    unsigned    length;
+    const char *key;
+    void       *value;
+};
+
+struct water_hash {
+    H2oArena  arena;
+    unsigned  count;
+    unsigned  size;     // a power of two
+    H2oEntry *buckets;
+};
+
+// where a node was written in the grammar source
+struct water_position {
+    unsigned line;
+    unsigned column;
 };
 
 // use for the node stack
@@ -195,8 +262,9 @@ struct water_cell {
 };
 
 struct water_stack {
-    H2oCell top;
-    H2oCell free_list;
+    H2oArena arena;
+    H2oCell  top;
+    H2oCell  free_list;
 };
 
 struct water_symbol {
@@ -206,16 +274,21 @@ struct water_symbol {
 };
 
 struct water_table {
-    struct static_table map;
-    unsigned            count;
-    H2oSymbol           last;
+    struct water_hash map;
+    unsigned          count;
+    H2oSymbol         last;
 };
 
 struct water_parser {
     struct copper base;
 
-    struct static_table node;
-    struct static_table action;
+    struct water_arena arena;
+    unsigned           next_id;
+
+    struct water_hash node;   // added by Copper (the water.cu graph is shared)
+
+    struct water_position *positions; // by node id
+    unsigned               allocated;
 
     // parsing context
     struct water_stack  stack;
@@ -223,18 +296,33 @@ struct water_parser {
 
     FILE* output;
 
+    const char *name;      // the grammar (its caches are named by it)
+    const char *outfile;   // null for stdout
+    unsigned    shards;    // split the C output over this many files
+    const char *exported;  // while sharding, the prefix of the (extern) rule heads
+
     struct water_table identifer; // water_Apply
     struct water_table label;     // water_Root
     struct water_table event;     // water_Event
     struct water_table predicate; // water_Predicate
 
     H2oDefine rule;
+    unsigned  guards;   // the number of %{ } guards
 };
 
+typedef enum water_emit {
+    emit_ccode,  // a C file to compile and link
+    emit_image,  // a grammar image for h2o_LoadGrammarImage
+} H2oEmit;
+
 extern unsigned int h2o_global_debug;
 
 extern bool water_Create(const char* infile, const char* outfile, H2oParser *target);
-extern void water_Parse(H2oParser water, const char* name);
+extern bool water_Text(const char* text, size_t length, H2oParser *target);
+extern bool water_Shards(H2oParser water, unsigned count);
+extern void water_NamesPath(const char* outfile, char *path, size_t size);
+extern bool water_Parse(H2oParser water, const char* name, H2oEmit emit);
+extern bool water_Compile(H2oParser water, const char* name, H2oGrammar *target);
 extern bool water_Free(H2oParser value);
 
 #endif
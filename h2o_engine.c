@@ -41,6 +41,12 @@ struct water_thread {
     H2oUserNode  node;
 };
 
+// the roots a scanned repetition may choose between
+#define SCAN_IDS 8
+
+// the most labels of a FIRST set tested through the match call-back
+#define FIRST_CALLS 4
+
 typedef struct water_marker *H2oMaker;
 
 struct water_marker {
@@ -63,6 +69,198 @@ static bool make_Thread(H2oEvent event,
     return true;
 }
 
+// add an event for the current node to the end of the queue
+static inline bool queue_Add(Water water, H2oEvent event) {
+    if (water->limits.events && water->queued >= water->limits.events) {
+        water->exceeded = limit_events;
+        return false;
+    }
+
+    H2oThread value = water->free_list;
+
+    if (!value) {
+        if (!make_Thread(event, water->cursor.current, &value)) return false;
+    } else {
+        water->free_list = value->next;
+        value->next  = 0;
+        value->event = event;
+        value->node  = water->cursor.current;
+    }
+
+    if (!water->begin) {
+        water->begin = water->end = value;
+    } else {
+        water->end->next = value;
+        water->end = value;
+    }
+
+    water->queued += 1;
+
+    return true;
+}
+
+// drop every event queued after end (all of them if end is zero)
+static inline void queue_Reset(Water water, H2oThread end) {
+    H2oThread current = 0;
+
+    if (!end) {
+        current      = water->begin;
+        water->end   = 0;
+        water->begin = 0;
+    } else {
+        water->end = end;
+        current    = end->next;
+        end->next  = 0;
+    }
+
+    while (current) {
+        H2oThread next = current->next;
+        current->next = water->free_list;
+        water->free_list = current;
+        current = next;
+        if (water->queued) water->queued -= 1;
+    }
+}
+
+// the type id of node (in integer type-id mode)
+static inline size_t type_Id(Water water, H2oUserNode node) {
+    const char *field = ((const char *) node) + water->type_offset;
+
+    switch (water->type_size) {
+    case 1: return *((const unsigned char *)      field);
+    case 2: return *((const unsigned short *)     field);
+    case 4: return *((const unsigned int *)       field);
+    case 8: return *((const unsigned long long *) field);
+    }
+
+    return 0;
+}
+
+// does node match the root type
+static inline bool type_Match(Water water, H2oUserType type, H2oUserNode node) {
+    if (water->type_size) {
+        return ((size_t) type) == type_Id(water, node);
+    }
+    return water->match(water, type, node);
+}
+
+static void *resolve_Value(Water, H2oCache, unsigned);
+
+// a cache entry (resolved here on first use in lazy mode)
+static inline void *cache_Value(Water water, H2oCache cache, unsigned index) {
+    void *value = __atomic_load_n(&cache->values[index], __ATOMIC_ACQUIRE);
+
+    if (value)        return value;
+    if (!water->lazy) return 0;
+
+    return resolve_Value(water, cache, index);
+}
+
+// can the rule bound to action start at the current node
+// - false only when no label in the rule's FIRST set matches
+// - without type ids each label is a call to water->match, so a set
+//   of more than FIRST_CALLS labels is left to the rule itself
+static inline bool first_Test(Water water, H2oAction action, H2oCode code) {
+    H2oFirst first = action->cache->first;
+
+    if (!first) return true;
+
+    // the cache entry was rebound to a rule the compiler didn't analyse
+    if (code != first->codes[action->index]) return true;
+
+    H2oUserNode node = water->cursor.current;
+
+    if (!node) return false;
+
+    // (the masks are over type ids, only a type-id Water may use them)
+    const unsigned long long *masks = 0;
+
+    if (water->type_size && !water->lazy) {
+        masks = __atomic_load_n(&action->cache->masks, __ATOMIC_ACQUIRE);
+    }
+
+    if (masks) {
+        size_t id = type_Id(water, node);
+        if (64 <= id) return false;
+        return 0 != (masks[action->index] & (1ULL << id));
+    }
+
+    const unsigned *label = first->labels + first->offsets[action->index];
+    const unsigned *end   = first->labels + first->offsets[action->index + 1];
+    H2oCache        roots = first->roots;
+
+    if (!water->type_size && FIRST_CALLS < end - label) return true;
+
+    for ( ; label < end ; ++label) {
+        H2oUserType type = cache_Value(water, roots, *label);
+        if (type && type_Match(water, type, node)) return true;
+    }
+
+    return false;
+}
+
+static bool find_Place(Water, H2oCode, H2oSource*, const struct water_place**);
+
+// the label of code, and its place in the grammar source (if known)
+// - for trace output only (the text is per thread)
+static const char* code_Place(Water water, H2oCode code) {
+    static __thread char buffer[256];
+
+    H2oSource                 source = 0;
+    const struct water_place *place  = 0;
+
+    if (!find_Place(water, code, &source, &place)) return code->label;
+
+    snprintf(buffer, sizeof(buffer), "%s %s:%u:%u %s",
+             code->label, source->file, place->line, place->column, place->rule);
+
+    return buffer;
+}
+
+// count one operation against the limits (false once one is exceeded)
+static inline bool limit_Check(Water water, unsigned level) {
+    if (water->exceeded) return false;
+
+    if (water->limits.operations) {
+        if (water->operations >= water->limits.operations) {
+            water->exceeded = limit_operations;
+            return false;
+        }
+        water->operations += 1;
+    }
+
+    if (water->limits.depth && level >= water->limits.depth) {
+        water->exceeded = limit_depth;
+        return false;
+    }
+
+    return true;
+}
+
+// the type ids of a root, or of a choice of roots (false for any other code)
+static bool scan_Ids(Water water, H2oCode code, size_t ids[], unsigned *count) {
+    if (!code) return false;
+
+    switch (code->oper) {
+    case water_Root: {
+        H2oAction action = (H2oAction) code;
+        void     *type   = cache_Value(water, action->cache, action->index);
+        if (!type) return true; // (matches no node, as in match_root)
+        if (SCAN_IDS <= *count) return false;
+        ids[(*count)++] = (size_t) type;
+        return true;
+    }
+
+    case water_Or:
+    case water_Select:
+        return (scan_Ids(water, ((H2oChain) code)->before, ids, count)
+                && scan_Ids(water, ((H2oChain) code)->after, ids, count));
+
+    default:
+        return false;
+    }
+}
+
 static bool water_vm(Water water, unsigned level, H2oCode start)
 {
     inline void indent() {
@@ -92,24 +290,7 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
 
         water->cursor = marker->location;
 
-        H2oThread current = 0 ;
-
-        if (!marker->end) {
-            current      = water->begin;
-            water->end   = 0;
-            water->begin = 0;
-        } else {
-            water->end = marker->end;
-            current    = marker->end->next;
-            marker->end->next  = 0;
-        }
-
-        while (current) {
-            H2oThread next = current->next;
-            current->next = water->free_list;
-            water->free_list = current;
-            current = next;
-        }
+        queue_Reset(water, marker->end);
 
         indent();
         H2O_DEBUG(2, "resetting marker %x %x\n",
@@ -119,9 +300,21 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
         return true;
     }
 
+    // bring the siblings ahead of location into cache
+    inline void prefetch(H2oLocation location, unsigned from) {
+        unsigned distance = from;
+        for ( ; distance <= water->lookahead ; ++distance) {
+            H2oUserNode node;
+            if (!water->peek(water, location, distance, &node)) break;
+            __builtin_prefetch((const char *) node + water->type_offset);
+        }
+    }
+
     inline bool fetch_first(H2oLocation location) {
         if (!location->root) return false;
-        return water->first(water, location);
+        if (!water->first(water, location)) return false;
+        if (water->lookahead) prefetch(location, 1);
+        return true;
     }
 
     inline bool fetch_next(H2oLocation location) {
@@ -138,6 +331,7 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
                   (unsigned) check.current);
 
         if (!fetch_next(&check)) return false;
+        if (water->lookahead) prefetch(&check, water->lookahead);
         water->cursor = check;
         indent();
         H2O_DEBUG(2, "next node %x[%u] -> %x\n",
@@ -147,6 +341,47 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
         return true;
     }
 
+    // the length of the run of siblings (from the cursor on, from the
+    // sibling at distance from) argument matches, when it is a root or
+    // a choice of roots over an array of siblings in type-id mode
+    // - count is the number of siblings in the array
+    inline bool scan_roots(H2oCode argument, unsigned from, unsigned *length, unsigned *count) {
+        if (!water->siblings)       return false;
+        if (!water->type_size)      return false;
+        if (!water->cursor.current) return false;
+
+        size_t   ids[SCAN_IDS];
+        unsigned number = 0;
+
+        if (!scan_Ids(water, argument, ids, &number)) return false;
+
+        const H2oUserNode *nodes;
+        unsigned           total;
+
+        if (!water->siblings(water, &water->cursor, &nodes, &total)) return false;
+
+        *count  = total;
+        *length = total;
+
+        if (from < total) {
+            *length = from + h2o_ScanTypes(nodes + from, total - from,
+                                           water->type_offset, water->type_size,
+                                           ids, number);
+        }
+
+        indent(); H2O_DEBUG(2, "scanned %u of %u siblings\n", *length, total);
+
+        return true;
+    }
+
+    // move the cursor distance siblings on (within a scanned run)
+    inline void skip_nodes(unsigned distance) {
+        if (!distance) return;
+        struct water_location check = water->cursor;
+        if (!water->skip(water, &check, distance)) return;
+        water->cursor = check;
+    }
+
     inline bool as_root(H2oLocation location) {
         if (!water->cursor.current) return false;
         location->root    = water->cursor.current;
@@ -167,13 +402,23 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
     }
 
     inline void* fetch_code(H2oAction action) {
-        H2oCache cache = action->cache;
-        return cache->values[action->index];
+        return cache_Value(water, action->cache, action->index);
     }
 
     inline bool apply_code(H2oAction action) {
         H2oCode code = fetch_code(action);
         if (!code) return false;
+        if (!first_Test(water, action, code)) {
+            indent(); H2O_DEBUG(2, "rejected rule %s\n", action->name);
+            return false;
+        }
+        if (water->jit) {
+            H2oNative native = 0;
+            if (h2o_JitEntry(water, action, code, &native)) {
+                if (water->limited && !limit_Check(water, level + 1)) return false;
+                return native(water, level + 1);
+            }
+        }
         indent(); H2O_DEBUG(2, "calling rule %s\n", action->name);
         bool result =  call_with(code);
         indent(); H2O_DEBUG(2, "result of rule %s - %s\n", action->name, (result ? "true" : "false"));
@@ -186,24 +431,7 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
 
         indent(); H2O_DEBUG(2, "adding event --  %s %x\n", action->name, (unsigned) water->cursor.current);
 
-        H2oThread value = water->free_list;
-        if (!value) {
-            if (!make_Thread(event, water->cursor.current, &value)) return false;
-        } else {
-            water->free_list = value->next;
-            value->next = 0;
-            value->event = event;
-            value->node  = water->cursor.current;
-        }
-
-        if (!water->begin) {
-            water->begin = water->end = value;
-        } else {
-            water->end->next = value;
-            water->end = value;
-        }
-
-        return true;
+        return queue_Add(water, event);
     }
 
     inline bool apply_predicate(H2oAction action) {
@@ -221,7 +449,7 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
             indent(); H2O_DEBUG(2, "testing root %s - false\n", action->name);
             return false;
         }
-        if (!(water->match)(water, type, water->cursor.current)) {
+        if (!type_Match(water, type, water->cursor.current)) {
             indent(); H2O_DEBUG(2, "testing root %s - false\n", action->name);
             return false;
         }
@@ -243,6 +471,8 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
 
     inline bool water_or() {
         H2oChain chain = (H2oChain) start;
+        bool     result;
+        if (water->speculate && h2o_SpeculateOr(water, level, chain, &result)) return result;
         if (call_with(chain->before)) return true;
         if (call_with(chain->after))  return true;
         return false;
@@ -306,9 +536,16 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
         return apply_predicate(action);
     }
 
+    inline bool water_guard() {
+        H2oGuard guard = (H2oGuard) start;
+        indent(); H2O_DEBUG(2, "apply guard %s\n", guard->label);
+        return guard->test(water, water->cursor.current);
+    }
+
     inline bool water_begin() {
         struct water_location check = { water->cursor.current, 0, 0 };
         if (!(water->first)(water, &check)) return false;
+        if (water->lookahead) prefetch(&check, 1);
         water->cursor = check;
         return true;
     }
@@ -351,6 +588,11 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
 
     inline bool water_zero_plus() {
         H2oFunction function = (H2oFunction) start;
+        unsigned    length, count;
+        if (scan_roots(function->argument, 0, &length, &count)) {
+            if (length) skip_nodes(length - 1);
+            return true;
+        }
         if (!call_with(function->argument)) {
             return true;
         }
@@ -367,6 +609,12 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
 
     inline bool water_one_plus() {
         H2oFunction function = (H2oFunction) start;
+        unsigned    length, count;
+        if (scan_roots(function->argument, 0, &length, &count)) {
+            if (!length) return false;
+            skip_nodes(length - 1);
+            return true;
+        }
         if (!call_with(function->argument)) {
             return false;
         }
@@ -387,9 +635,43 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
         return true;
     }
 
+    // the same walk as water_range, from the run scanned: the minimum
+    // is matched from the cursor on, then (from the sibling after) up to
+    // the maximum, stopping on the first that fails or the last
+    inline bool scan_range(H2oGroup group, bool *result) {
+        unsigned minimum = group->minimum;
+        unsigned maximum = group->maximum;
+        unsigned length, count;
+
+        if (!scan_roots(group->argument, (minimum ? 0 : 1), &length, &count)) return false;
+
+        *result = true;
+
+        if (length < minimum) {
+            *result = false;
+            return true;
+        }
+
+        unsigned after = (minimum ? minimum : 1); // the sibling after the minimum
+        unsigned last  = after - 1;
+
+        if (after < count) {
+            last = length;
+            if (maximum && after + maximum < last) last = after + maximum;
+            if (count - 1 < last) last = count - 1;
+        }
+
+        skip_nodes(last);
+
+        return true;
+    }
+
     inline bool water_range() {
         H2oGroup group = (H2oGroup) start;
         unsigned index = group->minimum;
+        bool     result;
+
+        if (scan_range(group, &result)) return result;
 
         if (0 < index) {
             struct water_marker marker;
@@ -450,6 +732,7 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
         case water_OnePlus:   return water_one_plus();  // match one+
         case water_Or:        return water_or();        // is the root A or  B
         case water_Predicate: return water_predicate(); // apply a named predicate to root
+        case water_Guard:     return water_guard();     // apply an inline guard to root
         case water_Range:     return water_range();     // match range
         case water_Root:      return water_root();      // match root
         case water_Select:    return water_or();        // match one
@@ -465,42 +748,234 @@ static bool water_vm(Water water, unsigned level, H2oCode start)
     assert(0 != water);
     assert(0 != start);
 
-    indent(); H2O_DEBUG(2, "operation %s %s on %x\n", oper2text(start->oper), start->label, (unsigned) water->cursor.current);
+    indent(); H2O_DEBUG(2, "operation %s %s on %x\n", oper2text(start->oper), code_Place(water, start), (unsigned) water->cursor.current);
+
+    if (water->steps) h2o_StepCount(water);
+
+    if (water->limited && !limit_Check(water, level)) return false;
 
     bool result = run_code();
 
-    indent(); H2O_DEBUG(2, "operation %s %s on %x - %s\n", oper2text(start->oper), start->label, (unsigned) water->cursor.current,
+    indent(); H2O_DEBUG(2, "operation %s %s on %x - %s\n", oper2text(start->oper), code_Place(water, start), (unsigned) water->cursor.current,
                         (result ? "true" : "false"));
 
     return result;
 }
 
 
+/* entry points for native code (see h2o_jit.c) */
+extern bool h2o_Run(Water water, unsigned level, H2oCode code) {
+    return water_vm(water, level, code);
+}
+
+extern bool h2o_RunApply(Water water, unsigned level, H2oAction action) {
+    H2oCode code = cache_Value(water, action->cache, action->index);
+
+    if (!code) return false;
+
+    if (!first_Test(water, action, code)) return false;
+
+    if (water->jit) {
+        H2oNative native = 0;
+        if (h2o_JitEntry(water, action, code, &native)) {
+            if (water->limited && !limit_Check(water, level)) return false;
+            return native(water, level);
+        }
+    }
+
+    return water_vm(water, level, code);
+}
+
+extern bool h2o_RunEvent(Water water, H2oAction action) {
+    H2oEvent event = cache_Value(water, action->cache, action->index);
+
+    if (!event) return false;
+
+    return queue_Add(water, event);
+}
+
+extern void h2o_RunReset(Water water, H2oThread end) {
+    queue_Reset(water, end);
+}
+
+// release every event queued or kept for reuse
+extern void h2o_RunFree(Water water) {
+    queue_Reset(water, 0);
+
+    H2oThread current = water->free_list;
+
+    while (current) {
+        H2oThread next = current->next;
+        free(current);
+        current = next;
+    }
+
+    water->free_list = 0;
+}
+
+// move the events queued in from to the end of the queue of water
+extern void h2o_RunAppend(Water water, Water from) {
+    if (!from->begin) return;
+
+    if (!water->begin) {
+        water->begin = from->begin;
+    } else {
+        water->end->next = from->begin;
+    }
+
+    water->end     = from->end;
+    water->queued += from->queued;
+    from->begin    = 0;
+    from->end      = 0;
+    from->queued   = 0;
+}
+
 typedef void  *H2o_Value;
 typedef bool (*H2o_FetchValue)(Water, H2oUserName, H2o_Value*);
 
-static bool reload_Cache(Water water, H2oCache cache) {
+// the call-back that finds the values of cache by name
+static H2o_FetchValue cache_Fetch(Water water, H2oCache cache) {
+    switch (cache->type) {
+    case rule_cache:      return (H2o_FetchValue) water->code;
+    case root_cache:      return (H2o_FetchValue) water->type;
+    case event_cache:     return (H2o_FetchValue) water->event;
+    case predicate_cache: return (H2o_FetchValue) water->predicate;
+    case cache_void:      break;
+    }
+
+    return 0;
+}
+
+// the value another cache of the Water already holds for name
+static bool shared_Value(Water water, H2oCache cache, const char *name, void **target) {
+    unsigned long long hash = h2o_Hash(name);
+    H2oLink            link = water->caches;
+
+    for ( ; link ; link = link->next) {
+        H2oCache other = link->cache;
+        unsigned at;
+
+        if (other == cache)                    continue;
+        if (other->type != cache->type)        continue;
+        if (!other->values)                    continue;
+        if (!h2o_FindIndex(other, name, hash, &at)) continue;
+
+        void *value = __atomic_load_n(&other->values[at], __ATOMIC_ACQUIRE);
+
+        if (!value) continue;
+
+        *target = value;
+
+        return true;
+    }
+
+    return false;
+}
+
+// lazy mode: fetch one entry, the first thread to resolve it wins
+static void *resolve_Value(Water water, H2oCache cache, unsigned index) {
+    H2o_FetchValue fetch = cache_Fetch(water, cache);
+    void          *value = 0;
+
+    if (!fetch) return 0;
+
+    if (shared_Value(water, cache, cache->names[index], &value)) {
+        H2O_DEBUG(2, "sharing %s\n", cache->names[index]);
+    } else if (!fetch(water, cache->names[index], &value) || !value) {
+        H2O_DEBUG(1, "unable to find %s\n", cache->names[index]);
+        return 0;
+    }
+
+    void *expected = 0;
+
+    if (__atomic_compare_exchange_n(&cache->values[index], &expected, value,
+                                    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return value;
+    }
+
+    return expected;
+}
+
+extern void *h2o_CacheValue(Water water, H2oCache cache, unsigned index) {
+    if (!water)                 return 0;
+    if (!cache)                 return 0;
+    if (!cache->values)         return 0;
+    if (index >= cache->count)  return 0;
+
+    return cache_Value(water, cache, index);
+}
+
+extern bool h2o_EnableLazy(Water water, bool lazy) {
     if (!water) return false;
-    if (!cache) return true;
 
-    if (0 >= cache->count) {
-        return reload_Cache(water, cache->next);
+    water->lazy = lazy;
+
+    return true;
+}
+
+extern bool h2o_EnablePrefetch(Water water, H2oPeekNode peek, unsigned distance) {
+    if (!water) return false;
+
+    water->peek      = peek;
+    water->lookahead = (peek ? distance : 0);
+
+    return true;
+}
+
+extern bool h2o_EnableScan(Water water, H2oGetSiblings siblings, H2oSkipNodes skip) {
+    if (!water)             return false;
+    if (!siblings != !skip) return false;
+
+    water->siblings = siblings;
+    water->skip     = skip;
+
+    return true;
+}
+
+extern bool h2o_SetLimits(Water water, const struct water_limits *limits) {
+    if (!water) return false;
+
+    if (limits) {
+        water->limits = *limits;
+    } else {
+        memset(&water->limits, 0, sizeof(water->limits));
     }
 
-    unsigned size = sizeof(void *) * cache->count;
+    water->limited = (water->limits.operations || water->limits.depth || water->limits.events);
+
+    return true;
+}
+
+static bool reload_Cache(Water water, H2oLink link) {
+    if (!water) return false;
+    if (!link)  return true;
+
+    H2oCache cache = link->cache;
+
+    if (0 >= cache->count || cache->bound || cache->loaded) {
+        return reload_Cache(water, link->next);
+    }
 
     if (!cache->values) {
-        cache->values = malloc(size);
+        cache->values = calloc(cache->count, sizeof(void *));
         if (!cache->values) return false;
     }
 
+    // entries are resolved as they are used (see cache_Value)
+    if (water->lazy) {
+        return reload_Cache(water, link->next);
+    }
+
     const char **names  = cache->names;
     void       **values = cache->values;
 
     H2o_FetchValue fetch;
 
+    // (the rules a grammar defines were filled in when it was registered)
     inline bool fetch_value(unsigned index) {
         const char *name = names[index];
+        if (values[index])                              return true;
+        if (shared_Value(water, cache, name, &values[index])) return true;
         if (!fetch(water, name, &values[index])) {
             fprintf(stderr, "unable to find %s\n", name);
             return false;
@@ -508,35 +983,81 @@ static bool reload_Cache(Water water, H2oCache cache) {
         return true;
     }
 
-    switch (cache->type) {
-    case rule_cache:
-        fetch = (H2o_FetchValue) water->code;
-        break;
+    if (!(fetch = cache_Fetch(water, cache))) return false;
 
-    case root_cache:
-        fetch = (H2o_FetchValue) water->type;
-        break;
+    bool bound = false;
 
-    case event_cache:
-        fetch = (H2o_FetchValue) water->event;
-        break;
+    if (!h2o_RegistryBind(water, cache, &bound)) return false;
 
-    case predicate_cache:
-        fetch = (H2o_FetchValue) water->predicate;
-        break;
-
-    case cache_void:
-        return false;
+    if (!bound) {
+        unsigned index = 0;
+        for ( ; index < cache->count; ++index) {
+            if (!fetch_value(index)) return false;
+        }
     }
 
-    memset(values, 0, size);
+    __atomic_store_n(&cache->loaded, true, __ATOMIC_RELEASE);
+
+    return reload_Cache(water, link->next);
+}
+
+// in integer type-id mode fold the FIRST sets of each rule cache
+// into a mask over the (small) type ids of their roots
+// - the masks are built once (by the first type-id Water to load the
+//   grammar), published whole and kept until the grammar is freed,
+//   so parses on other threads never see a mask being filled
+static bool reload_Masks(Water water, H2oLink link) {
+    if (!water) return false;
+    if (!link)  return true;
+
+    H2oCache cache = link->cache;
+    H2oFirst first = cache->first;
+
+    if (rule_cache != cache->type) return reload_Masks(water, link->next);
+    if (!first)                    return reload_Masks(water, link->next);
+
+    // (the masks would need every root resolved)
+    if (!water->type_size || water->lazy) return reload_Masks(water, link->next);
+
+    if (__atomic_load_n(&cache->masks, __ATOMIC_ACQUIRE)) return reload_Masks(water, link->next);
 
+    H2oCache roots = first->roots;
     unsigned index = 0;
-    for ( ; index < cache->count; ++index) {
-        if (!fetch_value(index)) return false;
+
+    if (!roots->bound && !__atomic_load_n(&roots->loaded, __ATOMIC_ACQUIRE)) {
+        return reload_Masks(water, link->next);
+    }
+
+    for ( ; index < roots->count ; ++index) {
+        if (64 <= (size_t) roots->values[index]) return reload_Masks(water, link->next);
+    }
+
+    unsigned long long *masks = calloc(cache->count, sizeof(unsigned long long));
+
+    if (!masks) return false;
+
+    for (index = 0 ; index < cache->count ; ++index) {
+        const unsigned    *label = first->labels + first->offsets[index];
+        const unsigned    *end   = first->labels + first->offsets[index + 1];
+        unsigned long long mask  = 0;
+
+        for ( ; label < end ; ++label) {
+            size_t type = (size_t) roots->values[*label];
+            if (type) mask |= 1ULL << type;
+        }
+
+        masks[index] = mask;
+    }
+
+    unsigned long long *expected = 0;
+
+    // (another Water built the same masks first)
+    if (!__atomic_compare_exchange_n(&cache->masks, &expected, masks,
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(masks);
     }
 
-    return reload_Cache(water, cache->next);
+    return reload_Masks(water, link->next);
 }
 
 /*************************************************************************************
@@ -547,28 +1068,72 @@ static bool reload_Cache(Water water, H2oCache cache) {
 extern bool h2o_WaterInit(Water water, unsigned cacheSize) {
     if (!water) return false;
 
-    return true;
+    return h2o_RegistryInit(water, cacheSize);
 }
 
 extern bool h2o_Parse(Water water, const char* rule, H2oUserNode tree) {
-    if (!water) return false;
+    if (!water)       return false;
+    if (water->steps) return false; // (a stepped walk is suspended, see h2o_ParseStop)
 
-    if (!reload_Cache(water, water->cache)) return false;
+    if (water->live) return h2o_LiveParse(water, rule, tree);
 
     H2oCode code;
 
     if (!water->code(water, rule, &code)) return false;
 
+    return h2o_ParseCode(water, code, tree);
+}
+
+// resolve the caches of water (as the first parse would)
+extern bool h2o_LoadCaches(Water water) {
+    if (!water) return false;
+
+    if (!reload_Cache(water, water->caches)) return false;
+    if (!reload_Masks(water, water->caches)) return false;
+
+    return true;
+}
+
+extern bool h2o_ParseCode(Water water, H2oCode code, H2oUserNode tree) {
+    if (!water)                 return false;
+    if (water->steps)           return false;
+    if (!h2o_LoadCaches(water)) return false;
+
+    return h2o_WalkCode(water, code, tree);
+}
+
+// walk tree from code (the caches already loaded)
+extern bool h2o_WalkCode(Water water, H2oCode code, H2oUserNode tree) {
+    if (!water) return false;
+    if (!code)  return false;
+
     water->cursor.root    = 0;
     water->cursor.offset  = 0;
     water->cursor.current = tree;
 
-    return water_vm(water, 0, code);
+    // (the events queued before are kept whatever happens)
+    H2oThread before = water->end;
+
+    water->operations = 0;
+    water->queued     = 0;
+    water->exceeded   = limit_none;
+
+    bool result = water_vm(water, 0, code);
+
+    if (water->speculate) h2o_SpeculateWait(water);
+
+    if (water->exceeded) {
+        queue_Reset(water, before);
+        return false;
+    }
+
+    return result;
 }
 
 
 extern bool h2o_RunQueue(Water water) {
-    if (!water) return false;
+    if (!water)        return false;
+    if (water->steps)  return false; // (the walk is still queuing)
     if (!water->begin) return true;
 
     H2oThread current = water->begin;
@@ -587,6 +1152,10 @@ extern bool h2o_RunQueue(Water water) {
         current = next;
     }
 
+    // (the threads run are free, the next parse starts a new queue)
+    water->begin = 0;
+    water->end   = 0;
+
     return true;
 }
 
@@ -624,20 +1193,210 @@ extern bool h2o_AddName(Water water, const char* name, const H2oCode code) {
     return water->attach(water, name, code);
 }
 
+static bool link_Add(H2oLink *list, H2oCache cache, H2oSource source) {
+    H2oLink link = *list;
+
+    // (attaching the same grammar twice is harmless)
+    for ( ; link ; link = link->next) {
+        if (cache  && cache  == link->cache)  return true;
+        if (source && source == link->source) return true;
+    }
+
+    if (!(link = malloc(sizeof(struct water_link)))) return false;
+
+    link->next   = *list;
+    link->cache  = cache;
+    link->source = source;
+
+    *list = link;
+
+    return true;
+}
+
 extern bool h2o_AddCache(Water water, H2oCache cache) {
     if (!water)                    return false;
     if (!cache)                    return false;
-    if (cache->next)               return false;
     if (cache_void == cache->type) return false;
 
-    cache->next = water->cache;
-    water->cache = cache;
+    return link_Add(&water->caches, cache, 0);
+}
+
+// (the values are the cache's, so shared by every Water it is attached to)
+static bool bind_Cache(H2oCache cache, H2oCacheType type, const void *table, unsigned count) {
+    if (!cache)               return false;
+    if (!table && count)      return false;
+    if (type != cache->type)  return false;
+    if (cache->bound)         return false;
+
+    // (a parse may be reading the values)
+    if (__atomic_load_n(&cache->loaded, __ATOMIC_ACQUIRE)) return false;
+
+    if (count != cache->count) {
+        fprintf(stderr, "binding %u values to a cache of %u\n", count, cache->count);
+        return false;
+    }
+
+    const void *const *values = table;
+
+    bool     result = true;
+    unsigned index  = 0;
+
+    // (a root type may well be zero, an event or predicate may not)
+    for ( ; index < count && root_cache != type ; ++index) {
+        if (values[index]) continue;
+        fprintf(stderr, "unable to find %s\n", cache->names[index]);
+        result = false;
+    }
+
+    if (!result) return false;
+
+    if (!cache->values && count) {
+        cache->values = malloc(sizeof(void *) * count);
+        if (!cache->values) return false;
+    }
+
+    memcpy(cache->values, table, sizeof(void *) * count);
+
+    cache->bound = true;
 
     return true;
 }
 
+extern bool h2o_BindTypes(H2oCache cache, const H2oUserType table[], unsigned count) {
+    return bind_Cache(cache, root_cache, table, count);
+}
+
+extern bool h2o_BindEvents(H2oCache cache, const H2oEvent table[], unsigned count) {
+    return bind_Cache(cache, event_cache, table, count);
+}
+
+extern bool h2o_BindPredicates(H2oCache cache, const H2oPredicate table[], unsigned count) {
+    return bind_Cache(cache, predicate_cache, table, count);
+}
+
+extern bool h2o_AddSource(Water water, H2oSource source) {
+    if (!water)  return false;
+    if (!source) return false;
+
+    return link_Add(&water->sources, 0, source);
+}
+
+
 
 
 
 
 
+// resolve the names of grammar with the call-backs (and modes) of water
+// - without sharing the values of the other grammars water holds
+extern bool h2o_BindGrammar(Water water, H2oGrammar grammar) {
+    if (!water)   return false;
+    if (!grammar) return false;
+
+    struct water_link links[4] = {
+        { &links[1], grammar->rules,      0 },
+        { &links[2], grammar->roots,      0 },
+        { &links[3], grammar->events,     0 },
+        { 0,         grammar->predicates, 0 },
+    };
+
+    H2oLink caches = water->caches;
+
+    water->caches = links;
+
+    bool result = (reload_Cache(water, links) && reload_Masks(water, links));
+
+    water->caches = caches;
+
+    return result;
+}
+
+extern bool h2o_AttachGrammar(Water water, H2oGrammar grammar) {
+    if (!water)   return false;
+    if (!grammar) return false;
+
+    if (!h2o_AddCache(water, grammar->rules))      return false;
+    if (!h2o_AddCache(water, grammar->roots))      return false;
+    if (!h2o_AddCache(water, grammar->events))     return false;
+    if (!h2o_AddCache(water, grammar->predicates)) return false;
+
+    if (grammar->source) {
+        if (!h2o_AddSource(water, grammar->source)) return false;
+    }
+
+    unsigned index = 0;
+    for ( ; index < grammar->count ; ++index) {
+        if (!h2o_AddName(water, grammar->names[index], grammar->codes[index])) return false;
+        if (!grammar->qualified) continue;
+        if (!h2o_AddName(water, grammar->qualified[index], grammar->codes[index])) return false;
+    }
+
+    return true;
+}
+
+extern bool h2o_TypeField(Water water, size_t offset, unsigned size) {
+    if (!water) return false;
+
+    switch (size) {
+    case 0: // off
+    case 1:
+    case 2:
+    case 4:
+    case 8:
+        break;
+    default:
+        return false;
+    }
+
+    water->type_offset = offset;
+    water->type_size   = size;
+
+    return true;
+}
+
+// the place code was written (the number of its label indexes the places)
+static bool find_Place(Water water, H2oCode code, H2oSource *source, const struct water_place **place) {
+    if (!code)                  return false;
+    if (!code->label)           return false;
+    if ('L' != code->label[0])  return false;
+
+    char         *end    = 0;
+    unsigned long number = strtoul(code->label + 1, &end, 16);
+
+    if (*end) return false;
+
+    H2oLink link = water->sources;
+
+    for ( ; link ; link = link->next) {
+        H2oSource at = link->source;
+
+        if (number < at->first)             continue;
+        if (number - at->first >= at->count) continue;
+
+        const struct water_place *value = &at->places[number - at->first];
+
+        if (code != value->code) continue;
+
+        *source = at;
+        *place  = value;
+
+        return true;
+    }
+
+    return false;
+}
+
+extern bool h2o_SourceOf(Water water, H2oCode code, char *buffer, unsigned size) {
+    if (!water)  return false;
+    if (!buffer) return false;
+
+    H2oSource                 source = 0;
+    const struct water_place *place  = 0;
+
+    if (!find_Place(water, code, &source, &place)) return false;
+
+    int length = snprintf(buffer, size, "%s:%u:%u %s",
+                          source->file, place->line, place->column, place->rule);
+
+    return (0 <= length && (unsigned) length < size);
+}
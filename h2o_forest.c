@@ -0,0 +1,309 @@
+/**********************************************************************
+This file is part of Water.
+
+Water is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Water is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Water.  If not, see <http://www.gnu.org/licenses/>.
+***********************************************************************/
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    h2o_ParseForest
+ **    <routine-list-end>
+ **
+ ** parse a forest of trees over a pool of threads.
+ **
+ ** each worker starts with an even share of the trees, as a range
+ ** packed into one word (begin in the low half, end in the high half).
+ ** the owner takes trees from the front; a worker whose range is empty
+ ** steals the back half of another's. both are a compare and swap on
+ ** that word, so no tree is parsed twice and no lock is taken.
+ **
+ ** the events run on the caller's Water, one queue at a time (under the
+ ** lock). in ordered mode a parsed tree keeps its event queue until
+ ** every tree before it has run its events; whichever worker completes
+ ** the run of trees in order runs their events. in streaming mode the
+ ** worker that parsed a tree runs its events as soon as the lock is
+ ** free.
+ **
+ ***/
+#include "water.h"
+
+/* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+struct water_worker;
+
+struct water_queue {
+    H2oThread begin;
+    H2oThread end;
+};
+
+struct water_forest {
+    Water        water;  // the caller's (the events run on it)
+    H2oCode      code;
+    H2oUserNode *trees;
+    unsigned     count;
+    H2oOrder     order;
+    bool        *results;
+    bool         failed;
+
+    pthread_mutex_t     lock;    // (held while the events run)
+
+    /* ordered mode */
+    struct water_queue *queues;  // the events of each tree parsed (until they run)
+    bool               *parsed;
+    unsigned            next;    // the next tree to run the events of
+
+    struct water_worker *workers;
+    unsigned             size;
+};
+
+struct water_worker {
+    struct water         water;
+    struct water_forest *forest;
+    unsigned             number;
+    unsigned long long   range;  // the trees left: begin | (end << 32)
+    pthread_t            thread;
+};
+
+static inline unsigned long long range_Pack(unsigned begin, unsigned end) {
+    return ((unsigned long long) end << 32) | begin;
+}
+
+// the next tree of the worker's own range
+static bool range_Take(unsigned long long *range, unsigned *index) {
+    unsigned long long value = __atomic_load_n(range, __ATOMIC_ACQUIRE);
+
+    for ( ; ; ) {
+        unsigned begin = (unsigned) value;
+        unsigned end   = (unsigned) (value >> 32);
+
+        if (begin >= end) return false;
+
+        if (__atomic_compare_exchange_n(range, &value, range_Pack(begin + 1, end),
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *index = begin;
+            return true;
+        }
+    }
+}
+
+// move the back half of the victim's range into the (empty) thief's
+static bool range_Steal(unsigned long long *victim, unsigned long long *thief) {
+    unsigned long long value = __atomic_load_n(victim, __ATOMIC_ACQUIRE);
+
+    for ( ; ; ) {
+        unsigned begin = (unsigned) value;
+        unsigned end   = (unsigned) (value >> 32);
+
+        if (begin >= end) return false;
+
+        unsigned half = (end - begin + 1) / 2;
+
+        if (__atomic_compare_exchange_n(victim, &value, range_Pack(begin, end - half),
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(thief, range_Pack(end - half, end), __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+}
+
+// run the events of a tree on the caller's Water (under the lock),
+// and drop what a failed event left
+static bool forest_Run(struct water_forest *forest, struct water_queue queue) {
+    Water water = forest->water;
+
+    water->begin = queue.begin;
+    water->end   = queue.end;
+
+    if (h2o_RunQueue(water)) return true;
+
+    h2o_RunReset(water, 0);
+
+    return false;
+}
+
+static void forest_Result(struct water_forest *forest, unsigned index, bool result) {
+    if (forest->results) forest->results[index] = result;
+    if (!result) __atomic_store_n(&forest->failed, true, __ATOMIC_RELAXED);
+}
+
+// run the events of the trees parsed in order (under the lock)
+static void forest_Drain(struct water_forest *forest) {
+    while (forest->next < forest->count && forest->parsed[forest->next]) {
+        unsigned index = forest->next++;
+
+        if (!forest->queues[index].begin) continue;
+
+        if (!forest_Run(forest, forest->queues[index])) forest_Result(forest, index, false);
+    }
+}
+
+static void forest_Tree(struct water_worker *worker, unsigned index) {
+    struct water_forest *forest = worker->forest;
+    Water                water  = &worker->water;
+
+    bool result = h2o_WalkCode(water, forest->code, forest->trees[index]);
+
+    if (!result) h2o_RunReset(water, 0);
+
+    forest_Result(forest, index, result);
+
+    struct water_queue queue = { water->begin, water->end };
+
+    water->begin = 0;
+    water->end   = 0;
+
+    if (forest_streaming == forest->order && !queue.begin) return;
+
+    pthread_mutex_lock(&forest->lock);
+
+    if (forest_streaming == forest->order) {
+        if (!forest_Run(forest, queue)) forest_Result(forest, index, false);
+    } else {
+        forest->queues[index] = queue;
+        forest->parsed[index] = true;
+
+        forest_Drain(forest);
+    }
+
+    pthread_mutex_unlock(&forest->lock);
+}
+
+static void *forest_Work(void *argument) {
+    struct water_worker *worker = argument;
+    struct water_forest *forest = worker->forest;
+    unsigned             index;
+
+    for ( ; ; ) {
+        while (range_Take(&worker->range, &index)) {
+            forest_Tree(worker, index);
+        }
+
+        bool     stolen = false;
+        unsigned offset = 1;
+
+        for ( ; offset < forest->size && !stolen ; ++offset) {
+            struct water_worker *victim = &forest->workers[(worker->number + offset) % forest->size];
+            stolen = range_Steal(&victim->range, &worker->range);
+        }
+
+        if (!stolen) break;
+    }
+
+    return 0;
+}
+
+extern bool h2o_ParseForest(Water water,
+                            const char* rule,
+                            H2oUserNode trees[],
+                            unsigned count,
+                            unsigned threads,
+                            H2oOrder order,
+                            bool results[])
+{
+    if (!water)       return false;
+    if (water->live)  return false;
+    if (water->steps) return false;
+    if (water->begin) return false; // (its events are run or reset first)
+    if (!trees)       return false;
+    if (!count)       return true;
+
+    struct water_forest forest;
+
+    memset(&forest, 0, sizeof(forest));
+
+    // the caches are loaded once, before any worker shares them
+    if (!h2o_LoadCaches(water))                   return false;
+    if (!water->code(water, rule, &forest.code))  return false;
+
+    if (!threads) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (0 < online ? online : 1);
+    }
+
+    if (threads > count) threads = count;
+
+    forest.water   = water;
+    forest.trees   = trees;
+    forest.count   = count;
+    forest.order   = order;
+    forest.results = results;
+    forest.size    = threads;
+    forest.workers = calloc(threads, sizeof(struct water_worker));
+
+    if (!forest.workers) return false;
+
+    inline bool done(bool result) {
+        free(forest.queues);
+        free(forest.parsed);
+        free(forest.workers);
+        return result;
+    }
+
+    if (forest_ordered == order) {
+        forest.queues = calloc(count, sizeof(struct water_queue));
+        forest.parsed = calloc(count, sizeof(bool));
+
+        if (!forest.queues || !forest.parsed) return done(false);
+    }
+
+    if (0 != pthread_mutex_init(&forest.lock, 0)) return done(false);
+
+    unsigned index = 0;
+
+    for ( ; index < threads ; ++index) {
+        struct water_worker *worker = &forest.workers[index];
+
+        worker->water     = *water;
+        worker->forest    = &forest;
+        worker->number    = index;
+        worker->range     = range_Pack((unsigned) (((unsigned long long) count * index) / threads),
+                                       (unsigned) (((unsigned long long) count * (index + 1)) / threads));
+
+        worker->water.begin     = 0;
+        worker->water.end       = 0;
+        worker->water.free_list = 0;
+    }
+
+    // the calling thread is worker zero
+    unsigned started = 1;
+
+    for ( ; started < threads ; ++started) {
+        struct water_worker *worker = &forest.workers[started];
+        if (0 != pthread_create(&worker->thread, 0, forest_Work, worker)) break;
+    }
+
+    forest_Work(&forest.workers[0]);
+
+    for (index = 1 ; index < started ; ++index) {
+        pthread_join(forest.workers[index].thread, 0);
+    }
+
+    // (the ranges of workers that never started)
+    if (started < threads) forest_Work(&forest.workers[0]);
+
+    for (index = 0 ; index < threads ; ++index) {
+        h2o_RunFree(&forest.workers[index].water);
+    }
+
+    pthread_mutex_destroy(&forest.lock);
+
+    return done(!forest.failed);
+}
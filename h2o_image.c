@@ -0,0 +1,278 @@
+/**********************************************************************
+This file is part of Water.
+
+Water is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Water is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Water.  If not, see <http://www.gnu.org/licenses/>.
+***********************************************************************/
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    h2o_LoadGrammarImage
+ **    h2o_LoadGrammarBytes
+ **    h2o_LoadGrammarLibrary
+ **    h2o_FreeGrammar
+ **    <routine-list-end>
+ **
+ ** a grammar image is mapped read-only at the base address the
+ ** compiler laid it out for, so loading it is O(1) and the pages
+ ** are shared by every process that maps the same file.
+ ** only the (small) data section holding the caches is writable.
+ ** an image built in memory (see h2o_CompileGrammar) is copied to
+ ** pages of its own and relocated the same way.
+ **
+ ** a grammar compiled to C and linked into a shared object is
+ ** loaded through the <name>_grammar function water writes for it
+ ** (the object calls back into the water routines of the program).
+ **
+ ***/
+#define _GNU_SOURCE
+#include "water.h"
+
+/* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if !defined(MAP_FIXED_NOREPLACE)
+#define MAP_FIXED_NOREPLACE 0
+#endif
+
+static bool check_Image(struct water_image *header, size_t size) {
+    if (memcmp(header->magic, H2O_IMAGE_MAGIC, sizeof(header->magic))) return false;
+    if (H2O_IMAGE_VERSION != header->version) return false;
+    if (sizeof(void*) != header->pointer)     return false;
+    if (size != header->size)                 return false;
+    if (header->data    > header->code)       return false;
+    if (header->code    > header->relocs)     return false;
+    if (header->relocs  > size)               return false;
+    if (header->grammar < header->data)       return false;
+    if (header->grammar > header->code)       return false;
+    // (the whole grammar is in the writable section, the table is of size_t)
+    if (header->code - header->grammar < sizeof(struct water_grammar)) return false;
+    if (0 != header->relocs % sizeof(size_t))                         return false;
+    if (header->rcount > (size - header->relocs) / sizeof(size_t))    return false;
+    return true;
+}
+
+// used when the preferred base was not available
+static bool relocate_Image(char *image, struct water_image *header) {
+    size_t  delta  = (size_t) image - header->base;
+    size_t *relocs = (size_t *) (image + header->relocs);
+    size_t  index  = 0;
+
+    for ( ; index < header->rcount ; ++index) {
+        size_t offset = relocs[index];
+        if (offset + sizeof(size_t) > header->relocs) return false;
+        *((size_t *) (image + offset)) += delta;
+    }
+
+    return true;
+}
+
+extern bool h2o_LoadGrammarImage(const char* path, H2oGrammar *target) {
+    if (!path)   return false;
+    if (!target) return false;
+
+    struct water_image header;
+    struct stat        info;
+
+    int fd = open(path, O_RDONLY);
+
+    if (0 > fd) return false;
+
+    inline bool fail() {
+        close(fd);
+        return false;
+    }
+
+    if (0 != fstat(fd, &info)) return fail();
+
+    if (sizeof(header) != pread(fd, &header, sizeof(header), 0)) return fail();
+
+    if (!check_Image(&header, info.st_size)) {
+        H2O_DEBUG(1, "%s is not a usable grammar image\n", path);
+        return fail();
+    }
+
+    void  *want   = (void *) header.base;
+    size_t page   = sysconf(_SC_PAGESIZE);
+    bool   shared = (0 == (header.align % page));
+    char  *image  = MAP_FAILED;
+
+    if (shared) {
+        image = mmap(want, header.size, PROT_READ, MAP_PRIVATE | MAP_FIXED_NOREPLACE, fd, 0);
+        if (MAP_FAILED != image && want != image) {
+            munmap(image, header.size);
+            image = MAP_FAILED;
+        }
+    }
+
+    if (MAP_FAILED != image) {
+        if (0 != mprotect(image + header.data,
+                          header.code - header.data,
+                          PROT_READ | PROT_WRITE)) {
+            munmap(image, header.size);
+            return fail();
+        }
+    } else {
+        H2O_DEBUG(1, "relocating grammar image %s\n", path);
+
+        image = mmap(0, header.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+        if (MAP_FAILED == image) return fail();
+
+        if (!relocate_Image(image, &header)) {
+            munmap(image, header.size);
+            return fail();
+        }
+
+        if (shared) {
+            mprotect(image + header.code,
+                     header.size - header.code,
+                     PROT_READ);
+        }
+    }
+
+    close(fd);
+
+    H2oGrammar grammar = (H2oGrammar) (image + header.grammar);
+
+    grammar->image = image;
+    grammar->size  = header.size;
+
+    *target = grammar;
+
+    return true;
+}
+
+extern bool h2o_LoadGrammarBytes(const void* bytes, size_t size, H2oGrammar *target) {
+    if (!bytes)  return false;
+    if (!target) return false;
+
+    struct water_image header;
+
+    if (sizeof(header) > size) return false;
+
+    memcpy(&header, bytes, sizeof(header));
+
+    if (!check_Image(&header, size)) {
+        H2O_DEBUG(1, "not a usable grammar image\n");
+        return false;
+    }
+
+    char *image = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (MAP_FAILED == image) return false;
+
+    memcpy(image, bytes, size);
+
+    if (!relocate_Image(image, &header)) {
+        munmap(image, size);
+        return false;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    if (0 == (header.align % page)) {
+        mprotect(image + header.code,
+                 size - header.code,
+                 PROT_READ);
+    }
+
+    H2oGrammar grammar = (H2oGrammar) (image + header.grammar);
+
+    grammar->image = image;
+    grammar->size  = size;
+
+    *target = grammar;
+
+    return true;
+}
+
+extern bool h2o_LoadGrammarLibrary(const char* path, const char* name, H2oGrammar *target) {
+    if (!path)   return false;
+    if (!name)   return false;
+    if (!target) return false;
+
+    // (the same object opened twice would share its caches)
+    void *library = dlopen(path, RTLD_NOW | RTLD_LOCAL | RTLD_NOLOAD);
+
+    if (library) {
+        H2O_DEBUG(1, "%s is already loaded\n", path);
+        dlclose(library);
+        return false;
+    }
+
+    library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+    if (!library) {
+        H2O_DEBUG(1, "%s\n", dlerror());
+        return false;
+    }
+
+    char symbol[strlen(name) + sizeof("_grammar")];
+
+    snprintf(symbol, sizeof(symbol), "%s_grammar", name);
+
+    H2oGrammar (*function)(void) = (H2oGrammar (*)(void)) dlsym(library, symbol);
+    H2oGrammar grammar           = (function ? function() : 0);
+
+    if (!grammar) {
+        H2O_DEBUG(1, "%s has no %s\n", path, symbol);
+        dlclose(library);
+        return false;
+    }
+
+    grammar->library = library;
+
+    *target = grammar;
+
+    return true;
+}
+
+// the masks and native code of a grammar are released with it
+static void release_Cache(H2oCache cache) {
+    if (!cache) return;
+
+    free(cache->masks);
+    cache->masks = 0;
+
+    h2o_JitFree(cache);
+}
+
+extern bool h2o_FreeGrammar(H2oGrammar grammar) {
+    if (!grammar) return false;
+
+    // (a grammar linked into the program stays)
+    if (!grammar->image && !grammar->library) return true;
+
+    release_Cache(grammar->rules);
+    release_Cache(grammar->roots);
+    release_Cache(grammar->events);
+    release_Cache(grammar->predicates);
+
+    void  *library = grammar->library;
+    void  *image   = grammar->image;
+    size_t size    = grammar->size;
+
+    if (library) return 0 == dlclose(library);
+
+    return 0 == munmap(image, size);
+}
@@ -0,0 +1,842 @@
+/**********************************************************************
+This file is part of Water.
+
+Water is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Water is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Water.  If not, see <http://www.gnu.org/licenses/>.
+***********************************************************************/
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    h2o_EnableJit
+ **    h2o_JitEntry
+ **    h2o_JitFree
+ **    <routine-list-end>
+ **
+ ** translate the code of a rule into x86-64 once it has been
+ ** applied water->jit times. one thread compiles a rule while the
+ ** others go on interpreting it; a rule that fails to compile (in
+ ** lazy mode, one with a name not yet resolved) is tried again after
+ ** as many applications again.
+ **
+ ** the node operations (Any, Root, Leaf, And, Or, Not, Assert, Maybe,
+ ** Sequence, Select, Predicate, Guard, Event and Apply) are compiled inline,
+ ** markers live in the native frame and the user's first/match and
+ ** predicates are called directly (in integer type-id mode a Root is
+ ** a load and compare). every other operation calls back into the
+ ** interpreter (h2o_Run).
+ **
+ ** pages are written then made executable (never both) and each
+ ** rule is listed in /tmp/perf-<pid>.map for profilers (by its
+ ** place in the grammar source when there is a source map).
+ **
+ ***/
+#define _GNU_SOURCE
+#include "water.h"
+
+/* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/* the jit state of a rule cache */
+struct water_jit {
+    unsigned  *counts;   // applications of each rule
+    H2oCode   *codes;    // the code each entry was compiled from
+    H2oNative *entries;  // the native code (if any)
+    size_t    *lengths;  // the size of the pages of each entry
+    bool      *compiling; // a thread is compiling the rule
+    bool       fixed;    // the type-id mode has been compiled in
+    size_t     type_offset;
+    unsigned   type_size;
+};
+
+static pthread_mutex_t jit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#if defined(__x86_64__)
+
+/* the deepest nesting compiled inline */
+#define JIT_DEPTH 64
+
+enum jit_register {
+    rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+    r8,  r9,  r10, r11, r12, r13, r14, r15
+};
+
+enum jit_condition {
+    jit_equal     = 0x4,
+    jit_not_equal = 0x5,
+};
+
+struct jit_code {
+    unsigned char *start;
+    size_t         length;
+    size_t         allocated;
+    bool           failed;
+    unsigned       depth;  // nesting of the node being compiled
+    unsigned       inuse;  // marker slots in use
+    unsigned       slots;  // marker slots needed
+    size_t         type_offset;
+    unsigned       type_size;   // compare type ids inline (zero is off)
+    Water          water;       // resolves lazy cache entries as they are compiled
+};
+
+struct jit_label {
+    size_t  *sites;  // rel32 fields jumping to this label
+    unsigned count;
+    unsigned allocated;
+};
+
+/* frame: [rbp-8] rbx, [rbp-16] r12, [rbp-48] scratch location, markers below */
+#define FRAME_SCRATCH (-48)
+#define FRAME_MARKER(slot) (FRAME_SCRATCH - (32 * ((int) (slot) + 1)))
+
+#define WATER_FIRST   ((int) offsetof(struct water, first))
+#define WATER_MATCH   ((int) offsetof(struct water, match))
+#define WATER_CURSOR  ((int) offsetof(struct water, cursor))
+#define WATER_CURRENT ((int) offsetof(struct water, cursor.current))
+#define WATER_END     ((int) offsetof(struct water, end))
+
+static void emit_byte(struct jit_code *code, unsigned char value) {
+    if (code->failed) return;
+
+    if (code->length >= code->allocated) {
+        size_t allocated = (code->allocated ? code->allocated * 2 : 1024);
+        unsigned char *start = realloc(code->start, allocated);
+        if (!start) {
+            code->failed = true;
+            return;
+        }
+        code->start     = start;
+        code->allocated = allocated;
+    }
+
+    code->start[code->length++] = value;
+}
+
+static void emit_int32(struct jit_code *code, int value) {
+    unsigned inx = 0;
+    for ( ; inx < 4 ; ++inx) {
+        emit_byte(code, (value >> (8 * inx)) & 0xff);
+    }
+}
+
+static void emit_int64(struct jit_code *code, unsigned long value) {
+    unsigned inx = 0;
+    for ( ; inx < 8 ; ++inx) {
+        emit_byte(code, (value >> (8 * inx)) & 0xff);
+    }
+}
+
+static void emit_rex(struct jit_code *code, bool wide, unsigned reg, unsigned base) {
+    unsigned char rex = 0x40;
+    if (wide)     rex |= 0x08;
+    if (reg  & 8) rex |= 0x04;
+    if (base & 8) rex |= 0x01;
+    if (0x40 != rex) emit_byte(code, rex);
+}
+
+// [base + disp32]
+static void emit_memory(struct jit_code *code, unsigned reg, unsigned base, int disp) {
+    emit_byte(code, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if (rsp == (base & 7)) emit_byte(code, 0x24);
+    emit_int32(code, disp);
+}
+
+static void emit_load(struct jit_code *code, unsigned reg, unsigned base, int disp) {
+    emit_rex(code, true, reg, base);
+    emit_byte(code, 0x8b);
+    emit_memory(code, reg, base, disp);
+}
+
+static void emit_store(struct jit_code *code, unsigned base, int disp, unsigned reg) {
+    emit_rex(code, true, reg, base);
+    emit_byte(code, 0x89);
+    emit_memory(code, reg, base, disp);
+}
+
+static void emit_store_zero(struct jit_code *code, unsigned base, int disp) {
+    emit_rex(code, true, 0, base);
+    emit_byte(code, 0xc7);
+    emit_memory(code, 0, base, disp);
+    emit_int32(code, 0);
+}
+
+static void emit_compare_zero(struct jit_code *code, unsigned base, int disp) {
+    emit_rex(code, true, 0, base);
+    emit_byte(code, 0x83);
+    emit_memory(code, 7, base, disp);
+    emit_byte(code, 0);
+}
+
+static void emit_compare(struct jit_code *code, unsigned reg, unsigned base, int disp) {
+    emit_rex(code, true, reg, base);
+    emit_byte(code, 0x3b);
+    emit_memory(code, reg, base, disp);
+}
+
+// reg = zero extended [base + disp32] of size bytes
+static void emit_load_sized(struct jit_code *code, unsigned reg, unsigned base, int disp, unsigned size) {
+    switch (size) {
+    case 8:
+        emit_load(code, reg, base, disp);
+        return;
+    case 4:
+        emit_rex(code, false, reg, base);
+        emit_byte(code, 0x8b);
+        break;
+    case 2:
+        emit_rex(code, false, reg, base);
+        emit_byte(code, 0x0f);
+        emit_byte(code, 0xb7);
+        break;
+    case 1:
+        emit_rex(code, false, reg, base);
+        emit_byte(code, 0x0f);
+        emit_byte(code, 0xb6);
+        break;
+    default:
+        code->failed = true;
+        return;
+    }
+    emit_memory(code, reg, base, disp);
+}
+
+static void emit_compare_register(struct jit_code *code, unsigned reg, unsigned other) {
+    emit_rex(code, true, other, reg);
+    emit_byte(code, 0x39);
+    emit_byte(code, 0xc0 | ((other & 7) << 3) | (reg & 7));
+}
+
+static void emit_lea(struct jit_code *code, unsigned reg, unsigned base, int disp) {
+    emit_rex(code, true, reg, base);
+    emit_byte(code, 0x8d);
+    emit_memory(code, reg, base, disp);
+}
+
+static void emit_move(struct jit_code *code, unsigned target, unsigned source) {
+    emit_rex(code, true, source, target);
+    emit_byte(code, 0x89);
+    emit_byte(code, 0xc0 | ((source & 7) << 3) | (target & 7));
+}
+
+static void emit_move32(struct jit_code *code, unsigned target, unsigned source) {
+    emit_rex(code, false, source, target);
+    emit_byte(code, 0x89);
+    emit_byte(code, 0xc0 | ((source & 7) << 3) | (target & 7));
+}
+
+static void emit_immediate(struct jit_code *code, unsigned reg, const void *value) {
+    emit_rex(code, true, 0, reg);
+    emit_byte(code, 0xb8 | (reg & 7));
+    emit_int64(code, (unsigned long) value);
+}
+
+static void emit_test(struct jit_code *code, unsigned reg) {
+    emit_rex(code, true, reg, reg);
+    emit_byte(code, 0x85);
+    emit_byte(code, 0xc0 | ((reg & 7) << 3) | (reg & 7));
+}
+
+// test the bool result of a call
+static void emit_test_result(struct jit_code *code) {
+    emit_byte(code, 0x84);
+    emit_byte(code, 0xc0);
+}
+
+static void emit_call(struct jit_code *code, const void *function) {
+    emit_immediate(code, rax, function);
+    emit_byte(code, 0xff);
+    emit_byte(code, 0xd0);
+}
+
+static void emit_call_register(struct jit_code *code, unsigned reg) {
+    emit_rex(code, false, 0, reg);
+    emit_byte(code, 0xff);
+    emit_byte(code, 0xd0 | (reg & 7));
+}
+
+static void emit_call_memory(struct jit_code *code, unsigned base, int disp) {
+    emit_rex(code, false, 0, base);
+    emit_byte(code, 0xff);
+    emit_memory(code, 2, base, disp);
+}
+
+// esi = level + 1
+static void emit_next_level(struct jit_code *code) {
+    emit_move32(code, rsi, r12);
+    emit_byte(code, 0x83);
+    emit_byte(code, 0xc6);
+    emit_byte(code, 1);
+}
+
+static void emit_site(struct jit_code *code, struct jit_label *label) {
+    if (label->count >= label->allocated) {
+        unsigned allocated = (label->allocated ? label->allocated * 2 : 8);
+        size_t  *sites     = realloc(label->sites, allocated * sizeof(size_t));
+        if (!sites) {
+            code->failed = true;
+            return;
+        }
+        label->sites     = sites;
+        label->allocated = allocated;
+    }
+    label->sites[label->count++] = code->length;
+    emit_int32(code, 0);
+}
+
+static void emit_jump(struct jit_code *code, struct jit_label *label) {
+    emit_byte(code, 0xe9);
+    emit_site(code, label);
+}
+
+static void emit_branch(struct jit_code *code, enum jit_condition condition, struct jit_label *label) {
+    emit_byte(code, 0x0f);
+    emit_byte(code, 0x80 | condition);
+    emit_site(code, label);
+}
+
+// every jump to label is forward, so bind patches them all
+static void emit_bind(struct jit_code *code, struct jit_label *label) {
+    unsigned inx = 0;
+    for ( ; inx < label->count ; ++inx) {
+        size_t site = label->sites[inx];
+        int    rel  = code->length - (site + 4);
+        if (!code->failed) memcpy(code->start + site, &rel, 4);
+    }
+    free(label->sites);
+    memset(label, 0, sizeof(struct jit_label));
+}
+
+static void emit_mark(struct jit_code *code, unsigned slot) {
+    int at = FRAME_MARKER(slot);
+    unsigned inx = 0;
+    for ( ; inx < 3 ; ++inx) {
+        emit_load(code, rax, rbx, WATER_CURSOR + (8 * inx));
+        emit_store(code, rbp, at + (8 * inx), rax);
+    }
+    emit_load(code, rax, rbx, WATER_END);
+    emit_store(code, rbp, at + 24, rax);
+}
+
+// the queue is only touched if an event was added since the mark
+static void emit_reset(struct jit_code *code, unsigned slot) {
+    int at = FRAME_MARKER(slot);
+    unsigned inx = 0;
+    for ( ; inx < 3 ; ++inx) {
+        emit_load(code, rax, rbp, at + (8 * inx));
+        emit_store(code, rbx, WATER_CURSOR + (8 * inx), rax);
+    }
+
+    struct jit_label same = { 0, 0, 0 };
+
+    emit_load(code, rax, rbx, WATER_END);
+    emit_compare(code, rax, rbp, at + 24);
+    emit_branch(code, jit_equal, &same);
+    emit_move(code, rdi, rbx);
+    emit_load(code, rsi, rbp, at + 24);
+    emit_call(code, h2o_RunReset);
+    emit_bind(code, &same);
+}
+
+static bool compile_Node(struct jit_code *code, H2oCode node, struct jit_label *fail);
+
+static bool compile_Fallback(struct jit_code *code, H2oCode node, struct jit_label *fail) {
+    emit_move(code, rdi, rbx);
+    emit_next_level(code);
+    emit_immediate(code, rdx, node);
+    emit_call(code, h2o_Run);
+    emit_test_result(code);
+    emit_branch(code, jit_equal, fail);
+    return true;
+}
+
+static bool compile_Marked(struct jit_code *code, H2oCode node, struct jit_label *fail) {
+    unsigned slot = code->inuse++;
+
+    if (code->inuse > code->slots) code->slots = code->inuse;
+
+    struct jit_label other = { 0, 0, 0 };
+    struct jit_label done  = { 0, 0, 0 };
+
+    H2oChain    chain    = (H2oChain) node;
+    H2oFunction function = (H2oFunction) node;
+
+    emit_mark(code, slot);
+
+    switch (node->oper) {
+    case water_And:
+        compile_Node(code, chain->before, &other);
+        compile_Node(code, chain->after,  &other);
+        emit_jump(code, &done);
+        emit_bind(code, &other);
+        emit_reset(code, slot);
+        emit_jump(code, fail);
+        break;
+
+    case water_Sequence:
+        compile_Node(code, chain->before, fail);
+        compile_Node(code, chain->after,  &other);
+        emit_jump(code, &done);
+        emit_bind(code, &other);
+        emit_reset(code, slot);
+        emit_jump(code, fail);
+        break;
+
+    case water_Not:
+        compile_Node(code, function->argument, &other);
+        emit_reset(code, slot);
+        emit_jump(code, fail);
+        emit_bind(code, &other);
+        emit_reset(code, slot);
+        break;
+
+    case water_Assert:
+        compile_Node(code, function->argument, &other);
+        emit_reset(code, slot);
+        emit_jump(code, &done);
+        emit_bind(code, &other);
+        emit_reset(code, slot);
+        emit_jump(code, fail);
+        break;
+
+    default:
+        code->failed = true;
+        break;
+    }
+
+    emit_bind(code, &done);
+
+    code->inuse -= 1;
+
+    return !code->failed;
+}
+
+// is the cache entry of action resolved (in lazy mode, resolve it now)
+static inline bool jit_Resolved(struct jit_code *code, H2oAction action) {
+    if (!code->water)       return true;
+    if (!code->water->lazy) return true;
+
+    return 0 != h2o_CacheValue(code->water, action->cache, action->index);
+}
+
+// emit code that falls through on success and jumps to fail otherwise
+static bool compile_Node(struct jit_code *code, H2oCode node, struct jit_label *fail) {
+    if (code->failed) return false;
+
+    if (JIT_DEPTH <= code->depth) {
+        return compile_Fallback(code, node, fail);
+    }
+
+    H2oChain    chain    = (H2oChain) node;
+    H2oFunction function = (H2oFunction) node;
+    H2oAction   action   = (H2oAction) node;
+    bool        result   = true;
+
+    struct jit_label other = { 0, 0, 0 };
+    struct jit_label done  = { 0, 0, 0 };
+
+    code->depth += 1;
+
+    switch (node->oper) {
+    case water_Any:
+        emit_compare_zero(code, rbx, WATER_CURRENT);
+        emit_branch(code, jit_equal, fail);
+        break;
+
+    case water_Root:
+        if (!action->cache->values) {
+            code->failed = true;
+            break;
+        }
+        // (the native code only loads the entry, one not yet resolved
+        //  is left to the interpreter, which resolves it on use)
+        if (!jit_Resolved(code, action)) {
+            code->failed = true;
+            break;
+        }
+        emit_immediate(code, rax, &action->cache->values[action->index]);
+        emit_load(code, rsi, rax, 0);
+        emit_test(code, rsi);
+        emit_branch(code, jit_equal, fail);
+        emit_load(code, rdx, rbx, WATER_CURRENT);
+        emit_test(code, rdx);
+        emit_branch(code, jit_equal, fail);
+        if (code->type_size) {
+            emit_load_sized(code, rax, rdx, (int) code->type_offset, code->type_size);
+            emit_compare_register(code, rax, rsi);
+            emit_branch(code, jit_not_equal, fail);
+            break;
+        }
+        emit_move(code, rdi, rbx);
+        emit_call_memory(code, rbx, WATER_MATCH);
+        emit_test_result(code);
+        emit_branch(code, jit_equal, fail);
+        break;
+
+    case water_Leaf:
+        emit_load(code, rax, rbx, WATER_CURRENT);
+        emit_store(code, rbp, FRAME_SCRATCH, rax);
+        emit_store_zero(code, rbp, FRAME_SCRATCH + 8);
+        emit_store_zero(code, rbp, FRAME_SCRATCH + 16);
+        emit_move(code, rdi, rbx);
+        emit_lea(code, rsi, rbp, FRAME_SCRATCH);
+        emit_call_memory(code, rbx, WATER_FIRST);
+        emit_test_result(code);
+        emit_branch(code, jit_not_equal, fail);
+        break;
+
+    case water_And:
+    case water_Sequence:
+    case water_Not:
+    case water_Assert:
+        result = compile_Marked(code, node, fail);
+        break;
+
+    case water_Or:
+    case water_Select:
+        // (a speculative choice is left to the interpreter)
+        if (code->water && h2o_Speculative(code->water, node)) {
+            result = compile_Fallback(code, node, fail);
+            break;
+        }
+        compile_Node(code, chain->before, &other);
+        emit_jump(code, &done);
+        emit_bind(code, &other);
+        compile_Node(code, chain->after, fail);
+        emit_bind(code, &done);
+        break;
+
+    case water_Maybe:
+        compile_Node(code, function->argument, &other);
+        emit_bind(code, &other);
+        break;
+
+    case water_Predicate:
+        if (!action->cache->values) {
+            code->failed = true;
+            break;
+        }
+        // (the native code only loads the entry, one not yet resolved
+        //  is left to the interpreter, which resolves it on use)
+        if (!jit_Resolved(code, action)) {
+            code->failed = true;
+            break;
+        }
+        emit_immediate(code, rax, &action->cache->values[action->index]);
+        emit_load(code, rax, rax, 0);
+        emit_test(code, rax);
+        emit_branch(code, jit_equal, fail);
+        emit_move(code, rdi, rbx);
+        emit_load(code, rsi, rbx, WATER_CURRENT);
+        emit_call_register(code, rax);
+        emit_test_result(code);
+        emit_branch(code, jit_equal, fail);
+        break;
+
+    case water_Guard:
+        emit_move(code, rdi, rbx);
+        emit_load(code, rsi, rbx, WATER_CURRENT);
+        emit_call(code, ((H2oGuard) node)->test);
+        emit_test_result(code);
+        emit_branch(code, jit_equal, fail);
+        break;
+
+    case water_Event:
+        emit_move(code, rdi, rbx);
+        emit_immediate(code, rsi, action);
+        emit_call(code, h2o_RunEvent);
+        emit_test_result(code);
+        emit_branch(code, jit_equal, fail);
+        break;
+
+    case water_Apply:
+        emit_move(code, rdi, rbx);
+        emit_next_level(code);
+        emit_immediate(code, rdx, action);
+        emit_call(code, h2o_RunApply);
+        emit_test_result(code);
+        emit_branch(code, jit_equal, fail);
+        break;
+
+    default:
+        result = compile_Fallback(code, node, fail);
+        break;
+    }
+
+    code->depth -= 1;
+
+    return result && !code->failed;
+}
+
+static void perf_Map(void *start, size_t size, const char *name) {
+    char filename[64];
+
+    snprintf(filename, sizeof(filename), "/tmp/perf-%d.map", (int) getpid());
+
+    FILE *map = fopen(filename, "a");
+
+    if (!map) return;
+
+    fprintf(map, "%lx %lx water:%s\n", (unsigned long) start, (unsigned long) size, name);
+    fclose(map);
+}
+
+static bool compile_Rule(Water water, struct water_jit *state, H2oCode start, const char *name, H2oNative *target, size_t *pages) {
+    struct jit_code  code;
+    struct jit_label fail = { 0, 0, 0 };
+    struct jit_label done = { 0, 0, 0 };
+
+    memset(&code, 0, sizeof(code));
+
+    if (INT_MAX < state->type_offset) return false;
+
+    code.type_offset = state->type_offset;
+    code.type_size   = state->type_size;
+    code.water       = water;
+
+    emit_byte(&code, 0x55);           // push rbp
+    emit_move(&code, rbp, rsp);       // mov  rbp, rsp
+    emit_byte(&code, 0x53);           // push rbx
+    emit_byte(&code, 0x41);           // push r12
+    emit_byte(&code, 0x54);
+    emit_byte(&code, 0x48);           // sub  rsp, frame
+    emit_byte(&code, 0x81);
+    emit_byte(&code, 0xec);
+
+    size_t frame = code.length;
+
+    emit_int32(&code, 0);
+    emit_move(&code, rbx, rdi);       // water
+    emit_move32(&code, r12, rsi);     // level
+
+    compile_Node(&code, start, &fail);
+
+    emit_byte(&code, 0xb8);           // mov eax, 1
+    emit_int32(&code, 1);
+    emit_jump(&code, &done);
+    emit_bind(&code, &fail);
+    emit_byte(&code, 0x31);           // xor eax, eax
+    emit_byte(&code, 0xc0);
+    emit_bind(&code, &done);
+    emit_lea(&code, rsp, rbp, -16);   // lea  rsp, [rbp-16]
+    emit_byte(&code, 0x41);           // pop  r12
+    emit_byte(&code, 0x5c);
+    emit_byte(&code, 0x5b);           // pop  rbx
+    emit_byte(&code, 0x5d);           // pop  rbp
+    emit_byte(&code, 0xc3);           // ret
+
+    if (code.failed) {
+        free(code.start);
+        return false;
+    }
+
+    int size = 32 + (32 * code.slots);
+
+    memcpy(code.start + frame, &size, 4);
+
+    size_t page   = sysconf(_SC_PAGESIZE);
+    size_t length = (code.length + page - 1) & ~(page - 1);
+
+    void *region = mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (MAP_FAILED == region) {
+        free(code.start);
+        return false;
+    }
+
+    memcpy(region, code.start, code.length);
+    free(code.start);
+
+    if (0 != mprotect(region, length, PROT_READ | PROT_EXEC)) {
+        munmap(region, length);
+        return false;
+    }
+
+    perf_Map(region, code.length, name);
+
+    H2O_DEBUG(1, "jit compiled rule %s (%u bytes)\n", name, (unsigned) code.length);
+
+    *target = (H2oNative) region;
+    *pages  = length;
+
+    return true;
+}
+
+#endif
+
+static struct water_jit* jit_State(H2oCache cache) {
+    struct water_jit *state = __atomic_load_n(&cache->native, __ATOMIC_ACQUIRE);
+
+    if (state) return state;
+
+    pthread_mutex_lock(&jit_lock);
+
+    state = cache->native;
+
+    if (!state) {
+        state = calloc(1, sizeof(struct water_jit));
+        if (state) {
+            state->counts  = calloc(cache->count, sizeof(unsigned));
+            state->codes   = calloc(cache->count, sizeof(H2oCode));
+            state->entries = calloc(cache->count, sizeof(H2oNative));
+            state->lengths = calloc(cache->count, sizeof(size_t));
+            state->compiling = calloc(cache->count, sizeof(bool));
+            if (!state->counts || !state->codes || !state->entries || !state->lengths || !state->compiling) {
+                free(state->counts);
+                free(state->codes);
+                free(state->entries);
+                free(state->lengths);
+                free(state->compiling);
+                free(state);
+                state = 0;
+            } else {
+                __atomic_store_n(&cache->native, state, __ATOMIC_RELEASE);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&jit_lock);
+
+    return state;
+}
+
+// was the native code of this cache compiled for water's type-id mode
+static inline bool jit_Mode(struct water_jit *state, Water water) {
+    if (state->type_size != water->type_size) return false;
+    if (!water->type_size)                    return true;
+    return state->type_offset == water->type_offset;
+}
+
+extern bool h2o_EnableJit(Water water, unsigned threshold) {
+    if (!water) return false;
+
+#if defined(__x86_64__)
+    water->jit = threshold;
+    return true;
+#else
+    water->jit = 0;
+    return false;
+#endif
+}
+
+extern bool h2o_JitEntry(Water water, H2oAction action, H2oCode code, H2oNative *target) {
+#if defined(__x86_64__)
+    if (!water->jit)             return false;
+    if (2 <= h2o_global_debug)   return false; // keep the trace complete
+
+    struct water_jit *state = jit_State(action->cache);
+
+    if (!state) return false;
+
+    unsigned  index = action->index;
+    H2oNative entry = __atomic_load_n(&state->entries[index], __ATOMIC_ACQUIRE);
+
+    if (entry) {
+        if (code != state->codes[index]) return false;
+        if (!jit_Mode(state, water))      return false;
+        *target = entry;
+        return true;
+    }
+
+    // (compiled for another type-id mode, water always interprets it)
+    if (__atomic_load_n(&state->fixed, __ATOMIC_ACQUIRE) && !jit_Mode(state, water)) return false;
+
+    unsigned count = __atomic_add_fetch(&state->counts[index], 1, __ATOMIC_RELAXED);
+
+    if (count < water->jit) return false;
+
+    // (the others interpret the rule while one thread compiles it)
+    bool idle = false;
+
+    if (!__atomic_compare_exchange_n(&state->compiling[index], &idle, true,
+                                     false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&jit_lock);
+
+    if (!state->fixed) {
+        state->type_offset = water->type_offset;
+        state->type_size   = water->type_size;
+        __atomic_store_n(&state->fixed, true, __ATOMIC_RELEASE);
+    }
+
+    if (!jit_Mode(state, water)) {
+        pthread_mutex_unlock(&jit_lock);
+        __atomic_store_n(&state->compiling[index], false, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    entry = state->entries[index];
+
+    if (!entry) {
+        // profilers show where the rule was written (if known)
+        char        place[256];
+        const char *name = action->name;
+
+        if (h2o_SourceOf(water, code, place, sizeof(place))) name = place;
+
+        if (compile_Rule(water, state, code, name, &entry, &state->lengths[index])) {
+            state->codes[index] = code;
+            __atomic_store_n(&state->entries[index], entry, __ATOMIC_RELEASE);
+        } else {
+            // (tried again after as many applications again)
+            entry = 0;
+            __atomic_store_n(&state->counts[index], 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    pthread_mutex_unlock(&jit_lock);
+
+    __atomic_store_n(&state->compiling[index], false, __ATOMIC_RELEASE);
+
+    if (!entry) return false;
+
+    *target = entry;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+// release the native code of a cache (no walk may still be using it)
+extern void h2o_JitFree(H2oCache cache) {
+    if (!cache) return;
+
+    struct water_jit *state = cache->native;
+
+    if (!state) return;
+
+    unsigned index = 0;
+
+    for ( ; index < cache->count ; ++index) {
+        if (!state->entries[index]) continue;
+        munmap((void *) state->entries[index], state->lengths[index]);
+    }
+
+    free(state->counts);
+    free(state->codes);
+    free(state->entries);
+    free(state->lengths);
+    free(state->compiling);
+    free(state);
+
+    cache->native = 0;
+}
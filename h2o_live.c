@@ -0,0 +1,375 @@
+/**********************************************************************
+This file is part of Water.
+
+Water is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Water is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Water.  If not, see <http://www.gnu.org/licenses/>.
+***********************************************************************/
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    h2o_LiveCreate
+ **    h2o_LiveJoin
+ **    h2o_LiveLeave
+ **    h2o_Publish
+ **    h2o_ReloadGrammar
+ **    h2o_LiveReclaim
+ **    h2o_LiveFree
+ **    h2o_LiveParse
+ **    <routine-list-end>
+ **
+ ** hot reload of grammars (epoch based reclamation).
+ **
+ ** the current version is a single pointer: publishing stores the new
+ ** version then advances the epoch. a parse stores the epoch it read
+ ** in its Water before it loads the current version, and zero once it
+ ** is done. a version replaced in epoch E is only freed when every
+ ** joined Water is idle or has entered in E or later (having read E,
+ ** it can only have loaded a newer version).
+ **
+ ** parses never lock; publishing, joining and leaving do.
+ **
+ ***/
+#include "water.h"
+
+/* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+typedef struct water_version *H2oVersion;
+
+struct water_version {
+    H2oVersion    next;      // the older versions replaced (newest first)
+    H2oGrammar    grammar;
+    unsigned long published; // the epoch it was published in (never reused)
+    unsigned long retired;   // the epoch it was replaced in (zero while current)
+};
+
+struct water_live {
+    pthread_mutex_t lock;
+    H2oVersion      current;  // what new parses use
+    H2oVersion      retired;  // the versions waiting for the parses using them
+    unsigned long   epoch;    // advanced by each publish (never zero)
+    Water           readers;  // the Waters joined
+};
+
+extern bool h2o_LiveCreate(H2oLive *target) {
+    if (!target) return false;
+
+    H2oLive live = calloc(1, sizeof(struct water_live));
+
+    if (!live) return false;
+
+    if (0 != pthread_mutex_init(&live->lock, 0)) {
+        free(live);
+        return false;
+    }
+
+    live->epoch = 1;
+
+    *target = live;
+
+    return true;
+}
+
+// the links of the version a Water parses are its own (four caches and
+// a source), so they are taken out by address, without touching a
+// version that may already be gone
+static void version_Unlink(Water water) {
+    H2oLink first = water->linked;
+    H2oLink last  = water->linked + 5;
+
+    inline void unlink(H2oLink *list) {
+        while (*list) {
+            H2oLink link = *list;
+            if (first <= link && link < last) {
+                *list = link->next;
+                continue;
+            }
+            list = &link->next;
+        }
+    }
+
+    unlink(&water->caches);
+    unlink(&water->sources);
+
+    water->version = 0;
+}
+
+static void version_Link(Water water, H2oVersion version) {
+    H2oGrammar grammar = version->grammar;
+    H2oCache   caches[4] = { grammar->rules, grammar->roots, grammar->events, grammar->predicates };
+    H2oLink    link      = water->linked;
+    unsigned   index     = 0;
+
+    for ( ; index < 4 ; ++index, ++link) {
+        link->next    = water->caches;
+        link->cache   = caches[index];
+        link->source  = 0;
+        water->caches = link;
+    }
+
+    if (grammar->source) {
+        link->next     = water->sources;
+        link->cache    = 0;
+        link->source   = grammar->source;
+        water->sources = link;
+    }
+
+    water->version = version->published;
+}
+
+extern bool h2o_LiveJoin(H2oLive live, Water water) {
+    if (!live)        return false;
+    if (!water)       return false;
+    if (water->live)  return (live == water->live);
+
+    H2oLink linked = calloc(5, sizeof(struct water_link));
+
+    if (!linked) return false;
+
+    pthread_mutex_lock(&live->lock);
+
+    water->linked  = linked;
+    water->version = 0;
+    water->epoch   = 0;
+    water->reader  = live->readers;
+    water->live    = live;
+
+    live->readers = water;
+
+    pthread_mutex_unlock(&live->lock);
+
+    return true;
+}
+
+// the oldest epoch a parse in progress entered in
+static unsigned long oldest_Epoch(H2oLive live) {
+    unsigned long oldest = ULONG_MAX;
+    Water         reader = live->readers;
+
+    for ( ; reader ; reader = reader->reader) {
+        unsigned long epoch = __atomic_load_n(&reader->epoch, __ATOMIC_SEQ_CST);
+        if (!epoch)          continue;
+        if (epoch < oldest) oldest = epoch;
+    }
+
+    return oldest;
+}
+
+static void version_Free(H2oVersion version) {
+    h2o_FreeGrammar(version->grammar);
+    free(version);
+}
+
+// free the replaced versions no parse can still be using (under the lock)
+static void reclaim_Versions(H2oLive live) {
+    unsigned long oldest = oldest_Epoch(live);
+    H2oVersion   *list   = &live->retired;
+
+    while (*list) {
+        H2oVersion version = *list;
+
+        if (version->retired > oldest) {
+            list = &version->next;
+            continue;
+        }
+
+        H2O_DEBUG(1, "reclaiming grammar %s (epoch %lu)\n", version->grammar->name, version->retired);
+
+        *list = version->next;
+        version_Free(version);
+    }
+}
+
+extern bool h2o_LiveLeave(H2oLive live, Water water) {
+    if (!live)                return false;
+    if (!water)               return false;
+    if (live != water->live)  return false;
+
+    pthread_mutex_lock(&live->lock);
+
+    Water *list = &live->readers;
+
+    for ( ; *list ; list = &(*list)->reader) {
+        if (water != *list) continue;
+        *list = water->reader;
+        break;
+    }
+
+    version_Unlink(water);
+    free(water->linked);
+
+    water->linked  = 0;
+    water->epoch   = 0;
+    water->reader  = 0;
+    water->live    = 0;
+
+    reclaim_Versions(live);
+
+    pthread_mutex_unlock(&live->lock);
+
+    return true;
+}
+
+extern bool h2o_Publish(H2oLive live, Water water, H2oGrammar grammar) {
+    if (!live)    return false;
+    if (!water)   return false;
+    if (!grammar) return false;
+
+    // (a grammar that cannot be bound is never seen)
+    if (!h2o_BindGrammar(water, grammar)) return false;
+
+    H2oVersion version = calloc(1, sizeof(struct water_version));
+
+    if (!version) return false;
+
+    version->grammar = grammar;
+
+    pthread_mutex_lock(&live->lock);
+
+    H2oVersion previous = live->current;
+
+    // (the epoch stamps the version, the Waters tell versions apart by it)
+    version->published = live->epoch + 1;
+
+    __atomic_store_n(&live->current, version, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&live->epoch, version->published, __ATOMIC_SEQ_CST);
+
+    if (previous) {
+        previous->retired = version->published;
+        previous->next    = live->retired;
+        live->retired     = previous;
+    }
+
+    H2O_DEBUG(1, "published grammar %s (epoch %lu)\n", grammar->name, live->epoch);
+
+    reclaim_Versions(live);
+
+    pthread_mutex_unlock(&live->lock);
+
+    return true;
+}
+
+extern bool h2o_ReloadGrammar(H2oLive live, Water water, const char* path, const char* name) {
+    if (!live) return false;
+    if (!path) return false;
+
+    H2oGrammar grammar = 0;
+
+    if (name) {
+        if (!h2o_LoadGrammarLibrary(path, name, &grammar)) return false;
+    } else {
+        if (!h2o_LoadGrammarImage(path, &grammar)) return false;
+    }
+
+    if (h2o_Publish(live, water, grammar)) return true;
+
+    h2o_FreeGrammar(grammar);
+
+    return false;
+}
+
+extern bool h2o_LiveReclaim(H2oLive live) {
+    if (!live) return false;
+
+    pthread_mutex_lock(&live->lock);
+
+    reclaim_Versions(live);
+
+    pthread_mutex_unlock(&live->lock);
+
+    return true;
+}
+
+// every Water must have left
+extern bool h2o_LiveFree(H2oLive live) {
+    if (!live)         return false;
+    if (live->readers) return false;
+
+    H2oVersion version = live->retired;
+
+    while (version) {
+        H2oVersion next = version->next;
+        version_Free(version);
+        version = next;
+    }
+
+    if (live->current) version_Free(live->current);
+
+    pthread_mutex_destroy(&live->lock);
+
+    free(live);
+
+    return true;
+}
+
+// the code of rule in grammar ("rule" or "name.rule")
+static bool version_Code(Water water, H2oGrammar grammar, const char* rule, H2oCode *target) {
+    H2oCache rules  = grammar->rules;
+    size_t   length = strlen(grammar->name);
+    unsigned at;
+
+    if (!strncmp(rule, grammar->name, length) && '.' == rule[length]) {
+        rule += length + 1;
+    }
+
+    if (!h2o_FindIndex(rules, rule, h2o_Hash(rule), &at)) return false;
+
+    H2oCode code = h2o_CacheValue(water, rules, at);
+
+    if (!code) return false;
+
+    *target = code;
+
+    return true;
+}
+
+extern bool h2o_LiveParse(Water water, const char* rule, H2oUserNode tree) {
+    if (!water)       return false;
+    if (!water->live) return false;
+
+    H2oLive live = water->live;
+
+    // enter (the epoch is stored before the version is loaded)
+    unsigned long epoch = __atomic_load_n(&live->epoch, __ATOMIC_SEQ_CST);
+
+    __atomic_store_n(&water->epoch, epoch, __ATOMIC_SEQ_CST);
+
+    H2oVersion version = __atomic_load_n(&live->current, __ATOMIC_SEQ_CST);
+
+    inline bool leave(bool result) {
+        __atomic_store_n(&water->epoch, 0, __ATOMIC_RELEASE);
+        return result;
+    }
+
+    if (!version) return leave(false);
+
+    if (version->published != water->version) {
+        version_Unlink(water);
+        version_Link(water, version);
+    }
+
+    H2oCode code;
+
+    // the rules the grammar does not have are found as before
+    if (!version_Code(water, version->grammar, rule, &code)) {
+        if (!water->code(water, rule, &code)) return leave(false);
+    }
+
+    return leave(h2o_ParseCode(water, code, tree));
+}
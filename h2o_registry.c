@@ -0,0 +1,361 @@
+/**********************************************************************
+This file is part of Water.
+
+Water is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Water is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Water.  If not, see <http://www.gnu.org/licenses/>.
+***********************************************************************/
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    h2o_RegistryInit
+ **    h2o_RegistryBind
+ **    h2o_FindIndex
+ **    h2o_WaterFree
+ **    h2o_SetType
+ **    h2o_SetEvent
+ **    h2o_SetPredicate
+ **    <routine-list-end>
+ **
+ ** the default name registry: rule codes, root types, events and
+ ** predicates by name, for the call-backs a user leaves zero
+ ** (h2o_WaterFree also releases the links of the attached grammars).
+ **
+ ** each name is hashed once, when it is registered. a cache with a
+ ** perfect hash (see struct water_index) is then filled by placing
+ ** every registered name straight into its slot, with one strcmp
+ ** to confirm it.
+ **
+ ***/
+#include "water.h"
+
+/* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+struct water_name {
+    char              *name;   // zero for a free entry
+    unsigned long long hash;
+    void              *value;
+};
+
+// open addressing (size is a power of two)
+struct water_names {
+    struct water_name *entries;
+    unsigned           count;
+    unsigned           size;
+    bool               owned;  // the call-backs for this kind are the registry's
+};
+
+struct water_registry {
+    struct water_names kinds[cache_void];
+};
+
+static bool names_Init(struct water_names *names, unsigned size) {
+    unsigned length = 16;
+
+    while (length < size) length *= 2;
+
+    names->entries = calloc(length, sizeof(struct water_name));
+
+    if (!names->entries) return false;
+
+    names->count = 0;
+    names->size  = length;
+
+    return true;
+}
+
+static void names_Free(struct water_names *names) {
+    unsigned index = 0;
+
+    if (!names->entries) return;
+
+    for ( ; index < names->size ; ++index) {
+        free(names->entries[index].name);
+    }
+
+    free(names->entries);
+
+    names->entries = 0;
+    names->count   = 0;
+    names->size    = 0;
+}
+
+static struct water_name *names_Slot(struct water_names *names, const char *name, unsigned long long hash) {
+    unsigned mask  = names->size - 1;
+    unsigned index = hash & mask;
+
+    for ( ; ; index = (index + 1) & mask) {
+        struct water_name *entry = &names->entries[index];
+        if (!entry->name)                                   return entry;
+        if (hash == entry->hash && !strcmp(entry->name, name)) return entry;
+    }
+}
+
+static bool names_Grow(struct water_names *names) {
+    struct water_names larger;
+
+    if (!names_Init(&larger, names->size * 2)) return false;
+
+    unsigned index = 0;
+
+    for ( ; index < names->size ; ++index) {
+        struct water_name *entry = &names->entries[index];
+        if (!entry->name) continue;
+        *names_Slot(&larger, entry->name, entry->hash) = *entry;
+    }
+
+    free(names->entries);
+
+    names->entries = larger.entries;
+    names->size    = larger.size;
+
+    return true;
+}
+
+static bool names_Get(struct water_names *names, const char *name, void **target) {
+    if (!names)          return false; // (a kind the registry does not own)
+    if (!name)           return false;
+    if (!names->entries) return false;
+
+    struct water_name *entry = names_Slot(names, name, h2o_Hash(name));
+
+    if (!entry->name) return false;
+
+    *target = entry->value;
+
+    return true;
+}
+
+static bool names_Set(struct water_names *names, const char *name, void *value) {
+    if (!names)          return false; // (a kind the registry does not own)
+    if (!name)           return false;
+    if (!names->entries) return false;
+
+    // at most three quarters full
+    if (4 * (names->count + 1) > 3 * names->size) {
+        if (!names_Grow(names)) return false;
+    }
+
+    unsigned long long hash  = h2o_Hash(name);
+    struct water_name *entry = names_Slot(names, name, hash);
+
+    if (!entry->name) {
+        if (!(entry->name = strdup(name))) return false;
+        entry->hash   = hash;
+        names->count += 1;
+    }
+
+    entry->value = value;
+
+    return true;
+}
+
+static inline struct water_names *registry_Kind(Water water, H2oCacheType type) {
+    if (!water)           return 0;
+    if (!water->registry) return 0;
+
+    struct water_names *names = &water->registry->kinds[type];
+
+    if (!names->owned) return 0;
+
+    return names;
+}
+
+/* the default call-backs */
+static bool registry_FindCode(Water water, H2oUserName name, H2oCode *target) {
+    return names_Get(registry_Kind(water, rule_cache), name, (void **) target);
+}
+
+static bool registry_AddCode(Water water, H2oUserName name, H2oCode code) {
+    return names_Set(registry_Kind(water, rule_cache), name, (void *) code);
+}
+
+static bool registry_FindType(Water water, H2oUserName name, H2oUserType *target) {
+    return names_Get(registry_Kind(water, root_cache), name, (void **) target);
+}
+
+static bool registry_FindEvent(Water water, H2oUserName name, H2oEvent *target) {
+    return names_Get(registry_Kind(water, event_cache), name, (void **) target);
+}
+
+static bool registry_FindPredicate(Water water, H2oUserName name, H2oPredicate *target) {
+    return names_Get(registry_Kind(water, predicate_cache), name, (void **) target);
+}
+
+extern bool h2o_RegistryInit(Water water, unsigned size) {
+    if (!water)          return false;
+    if (water->registry) return true;
+
+    // every call-back is the user's
+    if (water->code && water->attach && water->type && water->event && water->predicate) {
+        return true;
+    }
+
+    H2oRegistry registry = calloc(1, sizeof(struct water_registry));
+
+    if (!registry) return false;
+
+    unsigned inx = 0;
+
+    for ( ; inx < cache_void ; ++inx) {
+        if (names_Init(&registry->kinds[inx], size)) continue;
+        while (inx--) names_Free(&registry->kinds[inx]);
+        free(registry);
+        return false;
+    }
+
+    // rules are found and added through the same table
+    if (!water->code && !water->attach) {
+        water->code   = registry_FindCode;
+        water->attach = registry_AddCode;
+        registry->kinds[rule_cache].owned = true;
+    }
+
+    if (!water->type) {
+        water->type = registry_FindType;
+        registry->kinds[root_cache].owned = true;
+    }
+
+    if (!water->event) {
+        water->event = registry_FindEvent;
+        registry->kinds[event_cache].owned = true;
+    }
+
+    if (!water->predicate) {
+        water->predicate = registry_FindPredicate;
+        registry->kinds[predicate_cache].owned = true;
+    }
+
+    water->registry = registry;
+
+    return true;
+}
+
+extern bool h2o_FindIndex(H2oCache cache, const char* name, unsigned long long hash, unsigned *target) {
+    if (!cache)        return false;
+    if (!cache->index) return false;
+    if (!cache->count) return false;
+
+    H2oIndex index  = cache->index;
+    unsigned bucket = hash % index->buckets;
+    unsigned slot   = h2o_Mix(hash, index->seeds[bucket]) % cache->count;
+    unsigned at     = index->slots[slot];
+
+    if (strcmp(cache->names[at], name)) return false;
+
+    *target = at;
+
+    return true;
+}
+
+// fill the values of cache from the registry (when it owns that kind)
+// - a value already filled is kept (the rules a grammar defines were
+//   filled in when it was attached, a same-named rule of another
+//   grammar must not replace them)
+// - bound is set once every value is filled
+extern bool h2o_RegistryBind(Water water, H2oCache cache, bool *bound) {
+    if (!cache) return false;
+    if (!bound) return false;
+
+    *bound = false;
+
+    struct water_names *names = registry_Kind(water, cache->type);
+
+    if (!names)        return true;
+    if (!cache->index) return true;
+
+    unsigned index = 0;
+
+    for ( ; index < names->size ; ++index) {
+        struct water_name *entry = &names->entries[index];
+        unsigned           at;
+
+        if (!entry->name) continue;
+        if (!h2o_FindIndex(cache, entry->name, entry->hash, &at)) continue;
+        if (cache->values[at]) continue;
+
+        cache->values[at] = entry->value;
+    }
+
+    for (index = 0 ; index < cache->count ; ++index) {
+        if (!cache->values[index]) return true;
+    }
+
+    *bound = true;
+
+    return true;
+}
+
+static void links_Free(H2oLink *list) {
+    H2oLink link = *list;
+
+    while (link) {
+        H2oLink next = link->next;
+        free(link);
+        link = next;
+    }
+
+    *list = 0;
+}
+
+extern bool h2o_WaterFree(Water water) {
+    if (!water) return false;
+
+    links_Free(&water->caches);
+    links_Free(&water->sources);
+
+    H2oRegistry registry = water->registry;
+
+    if (!registry) return true;
+
+    unsigned inx = 0;
+
+    for ( ; inx < cache_void ; ++inx) {
+        struct water_names *names = &registry->kinds[inx];
+
+        if (!names->owned) continue;
+
+        switch (inx) {
+        case rule_cache:      water->code = 0; water->attach = 0; break;
+        case root_cache:      water->type      = 0; break;
+        case event_cache:     water->event     = 0; break;
+        case predicate_cache: water->predicate = 0; break;
+        }
+    }
+
+    for (inx = 0 ; inx < cache_void ; ++inx) {
+        names_Free(&registry->kinds[inx]);
+    }
+
+    free(registry);
+
+    water->registry = 0;
+
+    return true;
+}
+
+extern bool h2o_SetType(Water water, H2oUserName name, H2oUserType type) {
+    return names_Set(registry_Kind(water, root_cache), name, type);
+}
+
+extern bool h2o_SetEvent(Water water, H2oUserName name, H2oEvent event) {
+    return names_Set(registry_Kind(water, event_cache), name, (void *) event);
+}
+
+extern bool h2o_SetPredicate(Water water, H2oUserName name, H2oPredicate predicate) {
+    return names_Set(registry_Kind(water, predicate_cache), name, (void *) predicate);
+}
@@ -0,0 +1,172 @@
+/**********************************************************************
+This file is part of Water.
+
+Water is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Water is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Water.  If not, see <http://www.gnu.org/licenses/>.
+***********************************************************************/
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    h2o_ScanTypes
+ **    <routine-list-end>
+ **
+ ** scan an array of siblings for the first whose type id is not one
+ ** of a few (the run a repetition of roots matches).
+ **
+ ** the siblings are pointers, so their type ids are gathered: with
+ ** avx2 four nodes a gather, eight a step, compared against each id
+ ** at once. the scalar loop does the rest (and all of it without avx2,
+ ** or for type ids of one or two bytes). the choice is made on the
+ ** first scan, from the cpu it runs on.
+ **
+ ***/
+#include "water.h"
+
+/* */
+#include <stdlib.h>
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef unsigned (*H2oScan)(const H2oUserNode nodes[], unsigned count,
+                            size_t offset, unsigned size,
+                            const size_t ids[], unsigned number);
+
+// the type id of node (as type_Id in h2o_engine.c)
+static inline size_t scan_Id(H2oUserNode node, size_t offset, unsigned size) {
+    const char *field = ((const char *) node) + offset;
+
+    switch (size) {
+    case 1: return *((const unsigned char *)      field);
+    case 2: return *((const unsigned short *)     field);
+    case 4: return *((const unsigned int *)       field);
+    case 8: return *((const unsigned long long *) field);
+    }
+
+    return 0;
+}
+
+static unsigned scan_Scalar(const H2oUserNode nodes[], unsigned count,
+                            size_t offset, unsigned size,
+                            const size_t ids[], unsigned number)
+{
+    unsigned index = 0;
+
+    for ( ; index < count ; ++index) {
+        if (!nodes[index]) break;
+
+        size_t   id    = scan_Id(nodes[index], offset, size);
+        unsigned which = 0;
+
+        for ( ; which < number ; ++which) {
+            if (id == ids[which]) break;
+        }
+
+        if (which == number) break;
+    }
+
+    return index;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static unsigned scan_Avx2(const H2oUserNode nodes[], unsigned count,
+                          size_t offset, unsigned size,
+                          const size_t ids[], unsigned number)
+{
+    if (4 != size && 8 != size) return scan_Scalar(nodes, count, offset, size, ids, number);
+
+    // (a gather adds each node to the offset, as a base)
+    const void *base  = (const void *) offset;
+    __m256i     zero  = _mm256_setzero_si256();
+    unsigned    index = 0;
+
+    for ( ; index + 8 <= count ; index += 8) {
+        __m256i low  = _mm256_loadu_si256((const __m256i *) &nodes[index]);
+        __m256i high = _mm256_loadu_si256((const __m256i *) &nodes[index + 4]);
+
+        // (a null node is left to the scalar loop)
+        __m256i empty = _mm256_or_si256(_mm256_cmpeq_epi64(low, zero),
+                                        _mm256_cmpeq_epi64(high, zero));
+
+        if (!_mm256_testz_si256(empty, empty)) break;
+
+        unsigned mask = 0; // a bit per node whose type id is one of ids
+        unsigned which;
+
+        if (8 == size) {
+            __m256i first  = _mm256_i64gather_epi64((const long long *) base, low,  1);
+            __m256i second = _mm256_i64gather_epi64((const long long *) base, high, 1);
+            __m256i one    = zero;
+            __m256i two    = zero;
+
+            for (which = 0 ; which < number ; ++which) {
+                __m256i id = _mm256_set1_epi64x((long long) ids[which]);
+                one = _mm256_or_si256(one, _mm256_cmpeq_epi64(first,  id));
+                two = _mm256_or_si256(two, _mm256_cmpeq_epi64(second, id));
+            }
+
+            mask = (_mm256_movemask_pd(_mm256_castsi256_pd(one))
+                    | (_mm256_movemask_pd(_mm256_castsi256_pd(two)) << 4));
+        } else {
+            __m128i first  = _mm256_i64gather_epi32((const int *) base, low,  1);
+            __m128i second = _mm256_i64gather_epi32((const int *) base, high, 1);
+            __m256i both   = _mm256_set_m128i(second, first);
+            __m256i any    = zero;
+
+            for (which = 0 ; which < number ; ++which) {
+                // (an id wider than the field matches no node)
+                if (ids[which] > UINT32_MAX) continue;
+                __m256i id = _mm256_set1_epi32((int) ids[which]);
+                any = _mm256_or_si256(any, _mm256_cmpeq_epi32(both, id));
+            }
+
+            mask = _mm256_movemask_ps(_mm256_castsi256_ps(any));
+        }
+
+        if (0xff != mask) return index + __builtin_ctz(~mask);
+    }
+
+    return index + scan_Scalar(nodes + index, count - index, offset, size, ids, number);
+}
+#endif
+
+static H2oScan scan_Choose() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return scan_Avx2;
+#endif
+    return scan_Scalar;
+}
+
+// the index of the first node whose type id is not one of ids (count
+// when every node's is)
+extern unsigned h2o_ScanTypes(const H2oUserNode nodes[], unsigned count,
+                              size_t offset, unsigned size,
+                              const size_t ids[], unsigned number)
+{
+    static H2oScan scan = 0;
+
+    H2oScan chosen = __atomic_load_n(&scan, __ATOMIC_RELAXED);
+
+    if (!chosen) {
+        chosen = scan_Choose();
+        __atomic_store_n(&scan, chosen, __ATOMIC_RELAXED);
+    }
+
+    return chosen(nodes, count, offset, size, ids, number);
+}
@@ -0,0 +1,406 @@
+/**********************************************************************
+This file is part of Water.
+
+Water is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Water is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Water.  If not, see <http://www.gnu.org/licenses/>.
+***********************************************************************/
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    h2o_EnableSpeculation
+ **    h2o_Speculative
+ **    h2o_SpeculateOr
+ **    h2o_SpeculateWait
+ **    h2o_SpeculateStop
+ **    <routine-list-end>
+ **
+ ** speculative ordered choice.
+ **
+ ** a choice is worth speculating on when both of its alternatives call
+ ** user code (a predicate or guard) before any rule; the answer is kept
+ ** per code node in a small table (a word per slot, the code pointer
+ ** with the answer in its low bit).
+ **
+ ** each helper thread has its own Water. a choice claims an idle helper,
+ ** copies the Water into it (the cursor is the snapshot) and runs the
+ ** first alternative itself. when that fails it waits for the helper and
+ ** takes its cursor and its events; when it succeeds the helper is
+ ** abandoned, and drops its events once it is done. a choice that finds
+ ** no idle helper runs its alternatives one after the other.
+ **
+ ** an abandoned helper still walks the tree, so a parse (and a helper)
+ ** only ends once the helpers it abandoned are idle again.
+ **
+ ***/
+#include "water.h"
+
+/* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define SPECULATE_SEEN  256  // the choices whose answer is kept
+#define SPECULATE_DEPTH 32   // the nodes searched for user code (per alternative)
+
+typedef enum water_helper_state {
+    helper_idle,
+    helper_busy,      // running an alternative for a choice
+    helper_done,      // the choice may take the result
+    helper_abandoned, // the choice no longer wants the result
+    helper_quit,
+} H2oHelperState;
+
+struct water_helper {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_cond_t  done;
+    H2oHelperState  state;
+    Water           owner;  // the Water that claimed it
+
+    struct water  water;      // the copy the alternative runs over
+    unsigned long operations; // the counts of the choice when it was claimed
+    unsigned long queued;
+    H2oCode       code;
+    unsigned      level;
+    bool          result;
+};
+
+struct water_speculate {
+    unsigned            count;
+    struct water_helper *helpers;
+    uintptr_t           seen[SPECULATE_SEEN];
+};
+
+static void *helper_Run(void *argument) {
+    struct water_helper *helper = argument;
+
+    pthread_mutex_lock(&helper->lock);
+
+    for ( ; ; ) {
+        // (an alternative abandoned before it started still runs)
+        while (helper_idle == helper->state || helper_done == helper->state) {
+            pthread_cond_wait(&helper->wake, &helper->lock);
+        }
+
+        if (helper_quit == helper->state) break;
+
+        pthread_mutex_unlock(&helper->lock);
+
+        bool result = h2o_Run(&helper->water, helper->level, helper->code);
+
+        // (the choices it abandoned end with it)
+        h2o_SpeculateWait(&helper->water);
+
+        pthread_mutex_lock(&helper->lock);
+
+        helper->result = result;
+
+        if (helper_abandoned == helper->state) {
+            h2o_RunReset(&helper->water, 0);
+            helper->state = helper_idle;
+        } else {
+            helper->state = helper_done;
+        }
+
+        pthread_cond_signal(&helper->done);
+    }
+
+    pthread_mutex_unlock(&helper->lock);
+
+    return 0;
+}
+
+static void speculate_Free(H2oSpeculate speculate, unsigned started) {
+    unsigned index = 0;
+
+    for ( ; index < started ; ++index) {
+        struct water_helper *helper = &speculate->helpers[index];
+
+        pthread_mutex_lock(&helper->lock);
+
+        // (an abandoned alternative is finished first)
+        while (helper_idle != helper->state) {
+            pthread_cond_wait(&helper->done, &helper->lock);
+        }
+
+        helper->state = helper_quit;
+
+        pthread_cond_signal(&helper->wake);
+        pthread_mutex_unlock(&helper->lock);
+
+        pthread_join(helper->thread, 0);
+
+        h2o_RunFree(&helper->water);
+
+        pthread_cond_destroy(&helper->done);
+        pthread_cond_destroy(&helper->wake);
+        pthread_mutex_destroy(&helper->lock);
+    }
+
+    free(speculate->helpers);
+    free(speculate);
+}
+
+extern bool h2o_EnableSpeculation(Water water, unsigned threads) {
+    if (!water) return false;
+
+    if (water->speculate) {
+        speculate_Free(water->speculate, water->speculate->count);
+        water->speculate = 0;
+    }
+
+    if (!threads) return true;
+
+    H2oSpeculate speculate = calloc(1, sizeof(struct water_speculate));
+
+    if (!speculate) return false;
+
+    speculate->helpers = calloc(threads, sizeof(struct water_helper));
+
+    if (!speculate->helpers) {
+        free(speculate);
+        return false;
+    }
+
+    unsigned index = 0;
+
+    for ( ; index < threads ; ++index) {
+        struct water_helper *helper = &speculate->helpers[index];
+
+        pthread_mutex_init(&helper->lock, 0);
+        pthread_cond_init(&helper->wake, 0);
+        pthread_cond_init(&helper->done, 0);
+
+        helper->state = helper_idle;
+
+        if (0 == pthread_create(&helper->thread, 0, helper_Run, helper)) continue;
+
+        pthread_cond_destroy(&helper->done);
+        pthread_cond_destroy(&helper->wake);
+        pthread_mutex_destroy(&helper->lock);
+
+        speculate_Free(speculate, index);
+        return false;
+    }
+
+    speculate->count = threads;
+
+    water->speculate = speculate;
+
+    return true;
+}
+
+// does node call user code before it applies a rule
+static bool code_Costly(H2oCode node, unsigned *budget) {
+    if (!node)          return false;
+    if (!*budget)       return false;
+
+    *budget -= 1;
+
+    switch (node->oper) {
+    case water_Predicate:
+    case water_Guard:
+        return true;
+
+    case water_And:
+    case water_Or:
+    case water_Select:
+    case water_Sequence:
+    case water_Tuple:
+        return (code_Costly(((H2oChain) node)->before, budget)
+                || code_Costly(((H2oChain) node)->after, budget));
+
+    case water_Not:
+    case water_Assert:
+    case water_ZeroPlus:
+    case water_OnePlus:
+    case water_Maybe:
+    case water_Childern:
+        return code_Costly(((H2oFunction) node)->argument, budget);
+
+    case water_Range:
+        return code_Costly(((H2oGroup) node)->argument, budget);
+
+    default:
+        return false;
+    }
+}
+
+extern bool h2o_Speculative(Water water, H2oCode node) {
+    if (!water)            return false;
+    if (!water->speculate) return false;
+    if (!node)             return false;
+
+    H2oSpeculate speculate = water->speculate;
+    uintptr_t    key       = (uintptr_t) node;
+    uintptr_t   *slot      = &speculate->seen[(key >> 4) % SPECULATE_SEEN];
+    uintptr_t    value     = __atomic_load_n(slot, __ATOMIC_RELAXED);
+
+    if (key == (value & ~(uintptr_t) 1)) return (value & 1);
+
+    if (water_Or != node->oper && water_Select != node->oper) return false;
+
+    H2oChain chain  = (H2oChain) node;
+    unsigned before = SPECULATE_DEPTH;
+    unsigned after  = SPECULATE_DEPTH;
+    bool     costly = (code_Costly(chain->before, &before) && code_Costly(chain->after, &after));
+
+    __atomic_store_n(slot, key | costly, __ATOMIC_RELAXED);
+
+    return costly;
+}
+
+static struct water_helper *helper_Claim(H2oSpeculate speculate) {
+    unsigned index = 0;
+
+    for ( ; index < speculate->count ; ++index) {
+        struct water_helper *helper = &speculate->helpers[index];
+
+        if (0 != pthread_mutex_trylock(&helper->lock)) continue;
+
+        if (helper_idle == helper->state) return helper; // (locked)
+
+        pthread_mutex_unlock(&helper->lock);
+    }
+
+    return 0;
+}
+
+// false when the choice was not speculated (then nothing was done)
+extern bool h2o_SpeculateOr(Water water, unsigned level, H2oChain chain, bool *result) {
+    if (!h2o_Speculative(water, (H2oCode) chain)) return false;
+
+    struct water_helper *helper = helper_Claim(water->speculate);
+
+    if (!helper) return false;
+
+    H2oThread free_list = helper->water.free_list;
+
+    helper->owner           = water;
+    helper->water           = *water;
+    helper->water.begin     = 0;
+    helper->water.end       = 0;
+    helper->water.free_list = free_list;
+    helper->water.steps     = 0;
+    helper->water.queued    = water->queued;
+    helper->operations      = water->operations;
+    helper->queued          = water->queued;
+    helper->code            = chain->after;
+    helper->level           = level + 1;
+    helper->state           = helper_busy;
+
+    pthread_cond_signal(&helper->wake);
+    pthread_mutex_unlock(&helper->lock);
+
+    H2O_DEBUG(2, "speculating on %s\n", chain->label);
+
+    if (h2o_Run(water, level + 1, chain->before)) {
+        pthread_mutex_lock(&helper->lock);
+
+        if (helper_done == helper->state) {
+            h2o_RunReset(&helper->water, 0);
+            helper->state = helper_idle;
+        } else {
+            helper->state = helper_abandoned;
+        }
+
+        pthread_mutex_unlock(&helper->lock);
+
+        *result = true;
+        return true;
+    }
+
+    pthread_mutex_lock(&helper->lock);
+
+    while (helper_done != helper->state) {
+        pthread_cond_wait(&helper->done, &helper->lock);
+    }
+
+    *result = helper->result;
+
+    // (the operations of the alternative count for the choice)
+    water->operations += helper->water.operations - helper->operations;
+
+    if (helper->water.exceeded) {
+        water->exceeded = helper->water.exceeded;
+        *result         = false;
+    }
+
+    if (*result) {
+        helper->water.queued -= helper->queued;
+        water->cursor = helper->water.cursor;
+        h2o_RunAppend(water, &helper->water);
+    } else {
+        h2o_RunReset(&helper->water, 0);
+    }
+
+    helper->state = helper_idle;
+
+    pthread_mutex_unlock(&helper->lock);
+
+    return true;
+}
+
+// wait for the helpers water abandoned
+extern void h2o_SpeculateWait(Water water) {
+    if (!water)            return;
+    if (!water->speculate) return;
+
+    H2oSpeculate speculate = water->speculate;
+    unsigned     index     = 0;
+
+    for ( ; index < speculate->count ; ++index) {
+        struct water_helper *helper = &speculate->helpers[index];
+
+        pthread_mutex_lock(&helper->lock);
+
+        while (water == helper->owner && helper_abandoned == helper->state) {
+            pthread_cond_wait(&helper->done, &helper->lock);
+        }
+
+        pthread_mutex_unlock(&helper->lock);
+    }
+}
+
+// abandon every helper water claimed (its walk is being dropped)
+extern void h2o_SpeculateStop(Water water) {
+    if (!water)            return;
+    if (!water->speculate) return;
+
+    H2oSpeculate speculate = water->speculate;
+    unsigned     index     = 0;
+
+    for ( ; index < speculate->count ; ++index) {
+        struct water_helper *helper = &speculate->helpers[index];
+
+        pthread_mutex_lock(&helper->lock);
+
+        if (water == helper->owner) {
+            if (helper_done == helper->state) {
+                h2o_RunReset(&helper->water, 0);
+                helper->state = helper_idle;
+            } else if (helper_busy == helper->state) {
+                helper->state = helper_abandoned;
+            }
+        }
+
+        pthread_mutex_unlock(&helper->lock);
+    }
+
+    h2o_SpeculateWait(water);
+}
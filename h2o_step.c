@@ -0,0 +1,187 @@
+/**********************************************************************
+This file is part of Water.
+
+Water is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Water is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Water.  If not, see <http://www.gnu.org/licenses/>.
+***********************************************************************/
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    h2o_ParseStart
+ **    h2o_ParseStep
+ **    h2o_ParseStop
+ **    h2o_StepCount
+ **    <routine-list-end>
+ **
+ ** resumable parses.
+ **
+ ** a stepped walk runs the same (recursive) vm on a stack of its own,
+ ** owned by the Water. every operation counts against the budget of
+ ** the step; when it is spent the walk switches back to the caller of
+ ** h2o_ParseStep, leaving the state of the vm (its frames) on that
+ ** stack until the next step switches back in.
+ **
+ ***/
+#define _GNU_SOURCE
+#include "water.h"
+
+/* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+// the stack of a walk (as deep as the stack of a thread, and only
+// touched as deep as the walk goes)
+#define STEP_STACK (8 << 20)
+
+struct water_steps {
+    ucontext_t    caller;  // where h2o_ParseStep was called
+    ucontext_t    walk;    // where the walk is
+    char         *stack;   // the walk's (after a guard page)
+    size_t        size;
+    H2oCode       code;
+    H2oUserNode   tree;
+    H2oThread     queued;  // the last event queued before the walk
+    unsigned long left;    // the operations left in this step
+    bool          finished;
+    bool          result;
+};
+
+static void step_Free(Water water) {
+    H2oSteps steps = water->steps;
+    size_t   page  = sysconf(_SC_PAGESIZE);
+
+    water->steps = 0;
+
+    munmap(steps->stack - page, steps->size + page);
+    free(steps);
+}
+
+// the Water of the walk step_Main starts (makecontext only passes
+// ints, so a pointer is handed over here; set just before the first
+// switch to the walk, on the thread that makes it)
+static __thread Water step_starting = 0;
+
+static void step_Main() {
+    Water    water = step_starting;
+    H2oSteps steps = water->steps;
+
+    step_starting = 0;
+
+    steps->result   = h2o_WalkCode(water, steps->code, steps->tree);
+    steps->finished = true;
+
+    // (returns to the caller of the last step, see uc_link)
+}
+
+extern bool h2o_ParseStart(Water water, const char* rule, H2oUserNode tree) {
+    if (!water)        return false;
+    if (water->live)   return false;
+    if (water->steps)  return false;
+
+    H2oCode code;
+
+    if (!h2o_LoadCaches(water))            return false;
+    if (!water->code(water, rule, &code))  return false;
+
+    H2oSteps steps = calloc(1, sizeof(struct water_steps));
+
+    if (!steps) return false;
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    char  *map  = mmap(0, STEP_STACK + page, PROT_READ|PROT_WRITE,
+                       MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+
+    if (MAP_FAILED == map) {
+        free(steps);
+        return false;
+    }
+
+    // (a walk too deep faults instead of writing past its stack)
+    mprotect(map, page, PROT_NONE);
+
+    steps->stack = map + page;
+    steps->size  = STEP_STACK;
+    steps->code  = code;
+    steps->tree   = tree;
+    steps->queued = water->end;
+
+    water->steps = steps;
+
+    if (0 != getcontext(&steps->walk)) {
+        step_Free(water);
+        return false;
+    }
+
+    steps->walk.uc_stack.ss_sp   = steps->stack;
+    steps->walk.uc_stack.ss_size = steps->size;
+    steps->walk.uc_link          = &steps->caller;
+
+    makecontext(&steps->walk, step_Main, 0);
+
+    return true;
+}
+
+extern H2oStatus h2o_ParseStep(Water water, unsigned long budget) {
+    if (!water)        return step_failed;
+    if (!water->steps) return step_failed;
+
+    H2oSteps steps = water->steps;
+
+    steps->left = budget;
+
+    // (only read by the first step, as the walk starts)
+    step_starting = water;
+
+    if (0 != swapcontext(&steps->caller, &steps->walk)) return step_failed;
+
+    if (!steps->finished) return step_suspended;
+
+    bool result = steps->result;
+
+    step_Free(water);
+
+    return (result ? step_matched : step_failed);
+}
+
+// drop a suspended walk (and the events it queued, those queued
+// before h2o_ParseStart are kept)
+extern bool h2o_ParseStop(Water water) {
+    if (!water)        return false;
+    if (!water->steps) return false;
+
+    // (the frames on the stack own nothing but the helpers they wait on)
+    if (water->speculate) h2o_SpeculateStop(water);
+
+    h2o_RunReset(water, water->steps->queued);
+
+    step_Free(water);
+
+    return true;
+}
+
+// count one operation of a stepped walk (the vm calls it on its own stack)
+extern void h2o_StepCount(Water water) {
+    H2oSteps steps = water->steps;
+
+    while (!steps->left) {
+        swapcontext(&steps->walk, &steps->caller);
+    }
+
+    steps->left -= 1;
+}
@@ -0,0 +1,226 @@
+/**********************************************************************
+This file is part of Water.
+
+Water is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Water is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Water.  If not, see <http://www.gnu.org/licenses/>.
+***********************************************************************/
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    h2o_ParseStream
+ **    <routine-list-end>
+ **
+ ** parse a stream of trees in two stages.
+ **
+ ** a matcher thread (with its own copy of the Water) walks tree N+1
+ ** while the calling thread runs the events of tree N. the event queue
+ ** of each tree is handed over through a small ring with one producer
+ ** and one consumer; the two semaphores count its filled and empty
+ ** slots, so neither side takes a lock.
+ **
+ ** the threads of the events run go back to the matcher the same way
+ ** (the consumer leaves its free list in spent when spent is empty,
+ ** the producer takes it when its own runs out).
+ **
+ ***/
+#include "water.h"
+
+/* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+// trees matched but not yet run (two would be double buffering,
+// a few more absorb the odd tree that costs more than its neighbours)
+#define STREAM_DEPTH 4
+
+struct water_batch {
+    H2oThread begin;
+    H2oThread end;
+    bool      result;  // the tree matched
+    bool      last;    // the stream has ended (no tree)
+};
+
+struct water_stream {
+    struct water  matcher;  // the copy of the Water the trees are walked with
+    H2oCode       code;
+    H2oNextTree   next;
+    void         *data;
+
+    struct water_batch ring[STREAM_DEPTH];
+    sem_t              filled;
+    sem_t              empty;
+    unsigned           head;    // (the consumer's)
+    unsigned           tail;    // (the producer's)
+
+    H2oThread spent;  // threads handed back to the matcher
+    bool      stop;   // the consumer has failed
+};
+
+static void stream_Put(struct water_stream *stream, struct water_batch batch) {
+    stream->ring[stream->tail % STREAM_DEPTH] = batch;
+    stream->tail += 1;
+    sem_post(&stream->filled);
+}
+
+static void *stream_Match(void *argument) {
+    struct water_stream *stream = argument;
+    Water                water  = &stream->matcher;
+    H2oUserNode          tree;
+
+    for ( ; ; ) {
+        sem_wait(&stream->empty);
+
+        if (__atomic_load_n(&stream->stop, __ATOMIC_ACQUIRE)) break;
+
+        if (!water->free_list) {
+            water->free_list = __atomic_exchange_n(&stream->spent, 0, __ATOMIC_ACQUIRE);
+        }
+
+        if (!stream->next(stream->data, &tree)) {
+            stream_Put(stream, (struct water_batch) { 0, 0, true, true });
+            break;
+        }
+
+        bool result = h2o_WalkCode(water, stream->code, tree);
+
+        if (!result) h2o_RunReset(water, 0);
+
+        stream_Put(stream, (struct water_batch) { water->begin, water->end, result, false });
+
+        water->begin = 0;
+        water->end   = 0;
+
+        if (!result) break;
+    }
+
+    return 0;
+}
+
+// hand the threads run back to the matcher (when it has taken the last)
+static void stream_Spent(struct water_stream *stream, Water water) {
+    if (!water->free_list) return;
+    if (__atomic_load_n(&stream->spent, __ATOMIC_ACQUIRE)) return;
+
+    __atomic_store_n(&stream->spent, water->free_list, __ATOMIC_RELEASE);
+
+    water->free_list = 0;
+}
+
+extern bool h2o_ParseStream(Water water, const char* rule, H2oNextTree next, void* data) {
+    if (!water)       return false;
+    if (water->live)  return false;
+    if (water->steps) return false;
+    if (water->begin) return false; // (its events are run or reset first)
+    if (!next)        return false;
+
+    struct water_stream *stream = calloc(1, sizeof(struct water_stream));
+
+    if (!stream) return false;
+
+    inline bool done(bool result) {
+        free(stream);
+        return result;
+    }
+
+    // the caches are loaded once, before the matcher shares them
+    if (!h2o_LoadCaches(water))                    return done(false);
+    if (!water->code(water, rule, &stream->code))  return done(false);
+
+    stream->matcher = *water;
+    stream->next    = next;
+    stream->data    = data;
+
+    stream->matcher.begin     = 0;
+    stream->matcher.end       = 0;
+    stream->matcher.free_list = 0;
+
+    if (0 != sem_init(&stream->filled, 0, 0))            return done(false);
+    if (0 != sem_init(&stream->empty, 0, STREAM_DEPTH)) {
+        sem_destroy(&stream->filled);
+        return done(false);
+    }
+
+    inline bool finish(bool result) {
+        sem_destroy(&stream->filled);
+        sem_destroy(&stream->empty);
+        return done(result);
+    }
+
+    pthread_t matcher;
+
+    if (0 != pthread_create(&matcher, 0, stream_Match, stream)) return finish(false);
+
+    // the events run here, on the calling thread, in the order of the trees
+    bool result = true;
+
+    for ( ; ; ) {
+        sem_wait(&stream->filled);
+
+        struct water_batch batch = stream->ring[stream->head % STREAM_DEPTH];
+
+        stream->head += 1;
+
+        if (batch.last) break;
+
+        if (!batch.result) {
+            result = false;
+            break;
+        }
+
+        water->begin = batch.begin;
+        water->end   = batch.end;
+
+        if (!h2o_RunQueue(water)) {
+            h2o_RunReset(water, 0);
+            result = false;
+            break;
+        }
+
+        water->begin = 0;
+        water->end   = 0;
+
+        stream_Spent(stream, water);
+
+        sem_post(&stream->empty);
+    }
+
+    if (!result) {
+        __atomic_store_n(&stream->stop, true, __ATOMIC_RELEASE);
+        sem_post(&stream->empty);
+    }
+
+    pthread_join(matcher, 0);
+
+    // (the trees matched after a failure)
+    for ( ; stream->head != stream->tail ; stream->head += 1) {
+        struct water_batch batch = stream->ring[stream->head % STREAM_DEPTH];
+
+        water->begin = batch.begin;
+        water->end   = batch.end;
+
+        h2o_RunReset(water, 0);
+    }
+
+    h2o_RunFree(&stream->matcher);
+
+    stream->matcher.free_list = __atomic_exchange_n(&stream->spent, 0, __ATOMIC_ACQUIRE);
+
+    h2o_RunFree(&stream->matcher);
+
+    return finish(result);
+}
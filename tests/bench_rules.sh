@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# compiler scalability: time water on synthetic grammars of N rules
+#
+#   usage: bench_rules.sh [water] [rules ...]
+#
+# each rule is
+#   R<n> = L<n>: ->@e [ R<n+1> ] | M<n>: ->@e %leaf
+# the last rule points back at R0, so the rule graph is one large cycle
+# (the worst case for the FIRST set analysis)
+#
+# the time per rule should stay flat as the number of rules grows
+#
+
+WATER=${1:-../water}
+[ $# -gt 0 ] && shift
+
+SIZES=${*:-10 100 1000 10000 100000 1000000}
+WORK=${TMPDIR:-/tmp}/bench_rules.$$
+
+mkdir -p $WORK || exit 1
+trap 'rm -rf $WORK' 0
+
+printf "%10s %6s %12s %12s %10s\n" rules emit seconds rules/sec usec/rule
+
+for count in $SIZES ; do
+    awk -v count=$count 'BEGIN {
+        for (n = 0 ; n < count ; ++n) {
+            printf("R%d = L%d: ->@e [ R%d ] | M%d: ->@e %%leaf\n", n, n, (n + 1) % count, n);
+        }
+    }' > $WORK/rules.h2o
+
+    for emit in c image ; do
+        start=$(date +%s%N)
+        if ! $WATER --name bench --emit=$emit --output $WORK/rules.out --file $WORK/rules.h2o ; then
+            echo "water failed on $count rules" >&2
+            exit 1
+        fi
+        stop=$(date +%s%N)
+
+        awk -v count=$count -v emit=$emit -v nsec=$((stop - start)) 'BEGIN {
+            seconds = nsec / 1e9;
+            if (seconds <= 0) seconds = 1e-9;
+            printf("%10d %6s %12.3f %12.0f %10.2f\n",
+                   count, emit, seconds, count / seconds, (seconds * 1e6) / count);
+        }'
+    done
+done
@@ -0,0 +1,119 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** binding by index: the roots and events of the let grammar bound from
+ ** tables laid out by let_names.h, instead of looked up by name.
+ **/
+#include "walker.h"
+#include "let_names.h"
+
+static unsigned bound_calls = 0; // events run through the bound table
+
+static bool bound_begin(Water water, H2oUserNode value) {
+    bound_calls += 1;
+    return begin_event(water, value);
+}
+static bool bound_end(Water water, H2oUserNode value) {
+    bound_calls += 1;
+    return end_event(water, value);
+}
+static bool bound_assign(Water water, H2oUserNode value) {
+    bound_calls += 1;
+    return assign_event(water, value);
+}
+static bool bound_value(Water water, H2oUserNode value) {
+    bound_calls += 1;
+    return value_event(water, value);
+}
+static bool bound_symbol(Water water, H2oUserNode value) {
+    bound_calls += 1;
+    return symbol_event(water, value);
+}
+static bool bound_statement(Water water, H2oUserNode value) {
+    bound_calls += 1;
+    return statement_event(water, value);
+}
+
+static const H2oEvent the_events[let_wtree_event_count] = {
+    [let_wtree_event_begin]     = bound_begin,
+    [let_wtree_event_end]       = bound_end,
+    [let_wtree_event_assign]    = bound_assign,
+    [let_wtree_event_value]     = bound_value,
+    [let_wtree_event_symbol]    = bound_symbol,
+    [let_wtree_event_statement] = bound_statement,
+};
+
+static struct water the_walker;
+static struct water the_other;
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    if (!walker_Init(&the_walker)) return 1;
+
+    H2oUserType types[let_wtree_root_count] = {
+        [let_wtree_root_Let]           = type_Of("Let"),
+        [let_wtree_root_LetAssign]     = type_Of("LetAssign"),
+        [let_wtree_root_ParameterName] = type_Of("ParameterName"),
+        [let_wtree_root_Value]         = type_Of("Value"),
+        [let_wtree_root_Symbol]        = type_Of("Symbol"),
+    };
+
+    // a table of the wrong size is refused
+    if (h2o_BindEvents(&let_wtree_events, the_events, let_wtree_event_count - 1)) {
+        fprintf(stderr, "bound a short table\n");
+        return 1;
+    }
+
+    if (!h2o_BindTypes(&let_wtree_roots, types, let_wtree_root_count))           return 1;
+    if (!h2o_BindEvents(&let_wtree_events, the_events, let_wtree_event_count))   return 1;
+
+    Node_test tree = let_Tree();
+
+    if (!walker_Parse(&the_walker, "Start", tree)) {
+        fprintf(stderr, "unable to parse Start\n");
+        return 1;
+    }
+
+    if (!log_Check("bound", LET_EVENTS)) return 1;
+
+    unsigned calls = bound_calls;
+
+    if (20 != calls) {
+        fprintf(stderr, "%u events ran through the bound table\n", calls);
+        return 1;
+    }
+
+    // a cache is bound once (and never after it is loaded)
+    if (h2o_BindEvents(&let_wtree_events, the_events, let_wtree_event_count)) {
+        fprintf(stderr, "bound a cache twice\n");
+        return 1;
+    }
+
+    // the binding is the grammar's, so holds for another Water
+    if (!walker_Init(&the_other)) return 1;
+
+    if (!walker_Parse(&the_other, "Start", tree)) {
+        fprintf(stderr, "unable to parse Start again\n");
+        return 1;
+    }
+
+    if (!log_Check("other", LET_EVENTS)) return 1;
+
+    if (2 * calls != bound_calls) {
+        fprintf(stderr, "the other Water ran %u events unbound\n", 2 * calls - bound_calls);
+        return 1;
+    }
+
+    printf("bind ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,295 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** the compile cache (water --cache): a miss compiles what water does
+ ** without the cache and keeps it, a hit writes it again without
+ ** compiling, an entry that lost its _names.h is compiled again, an
+ ** output that would not change is not written, and the same text at
+ ** another path is another entry (built with WATER_PATH naming water).
+ **/
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <dirent.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#if !defined(WATER_PATH)
+#define WATER_PATH "water"
+#endif
+
+#define LET_PATH "let.h2o"
+
+// (a time no file written by the test has)
+#define OLD_TIME ((time_t) 1000000)
+
+static char the_directory[] = "cache.XXXXXX";
+
+// run water with these arguments (true if it succeeded)
+static bool water_Run(const char* format, ...) {
+    char    command[1024];
+    char    arguments[896];
+    va_list ap;
+
+    va_start(ap, format);
+    vsnprintf(arguments, sizeof(arguments), format, ap);
+    va_end(ap);
+
+    snprintf(command, sizeof(command), "%s %s", WATER_PATH, arguments);
+
+    if (0 == system(command)) return true;
+
+    fprintf(stderr, "failed: %s\n", command);
+
+    return false;
+}
+
+// the bytes of path
+static bool file_Read(const char* path, char **text, size_t *length) {
+    FILE       *file = fopen(path, "r");
+    struct stat info;
+
+    if (!file)                          return false;
+    if (0 != fstat(fileno(file), &info)) return false;
+
+    char *start = malloc(info.st_size + 1);
+
+    if (!start) return false;
+
+    if ((size_t) info.st_size != fread(start, 1, info.st_size, file)) return false;
+
+    fclose(file);
+
+    *text   = start;
+    *length = info.st_size;
+
+    return true;
+}
+
+static bool file_Copy(const char* from, const char* to) {
+    char  *text   = 0;
+    size_t length = 0;
+
+    if (!file_Read(from, &text, &length)) return false;
+
+    FILE *file = fopen(to, "w");
+
+    if (!file) return false;
+
+    bool result = (length == fwrite(text, 1, length, file));
+
+    if (0 != fclose(file)) result = false;
+
+    free(text);
+
+    return result;
+}
+
+// do the two files hold the same bytes
+static bool file_Same(const char* path, const char* other) {
+    char  *one    = 0;
+    char  *two    = 0;
+    size_t length = 0;
+    size_t count  = 0;
+
+    if (!file_Read(path, &one, &length)) return false;
+    if (!file_Read(other, &two, &count)) return false;
+
+    bool result = (length == count) && !memcmp(one, two, length);
+
+    free(one);
+    free(two);
+
+    if (!result) fprintf(stderr, "%s is not %s\n", path, other);
+
+    return result;
+}
+
+// date path back to OLD_TIME
+static bool file_Age(const char* path) {
+    struct utimbuf times = { OLD_TIME, OLD_TIME };
+
+    return 0 == utime(path, &times);
+}
+
+// is path still dated OLD_TIME
+static bool file_Old(const char* path) {
+    struct stat info;
+
+    if (0 != stat(path, &info)) return false;
+
+    return OLD_TIME == info.st_mtime;
+}
+
+// the number of entries in the cache, and the path of the last
+static unsigned cache_Entries(char *path, size_t size) {
+    char cache[64];
+
+    snprintf(cache, sizeof(cache), "%s/cache", the_directory);
+
+    DIR *directory = opendir(cache);
+
+    if (!directory) return 0;
+
+    unsigned       count = 0;
+    struct dirent *entry = 0;
+
+    while ((entry = readdir(directory))) {
+        size_t length = strlen(entry->d_name);
+
+        if (2 >= length) continue;
+        if (strcmp(entry->d_name + length - 2, ".c")) continue;
+
+        snprintf(path, size, "%s/%s", cache, entry->d_name);
+        count += 1;
+    }
+
+    closedir(directory);
+
+    return count;
+}
+
+// the _names.h beside path (path ends in .c)
+static void names_Path(const char* path, char *target, size_t size) {
+    snprintf(target, size, "%.*s_names.h", (int) (strlen(path) - 2), path);
+}
+
+// compile a.h2o through the cache
+static bool cache_Compile(const char* what) {
+    if (water_Run("--cache %s/cache --name let_wtree --output %s/a.c --file %s/a.h2o",
+                  the_directory, the_directory, the_directory)) return true;
+
+    fprintf(stderr, "%s: unable to compile\n", what);
+
+    return false;
+}
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    char path[256];
+    char other[256];
+    char entry[256];
+    char names[256];
+
+    if (!mkdtemp(the_directory)) {
+        perror(the_directory);
+        return 1;
+    }
+
+    snprintf(path, sizeof(path), "%s/a.h2o", the_directory);
+
+    if (!file_Copy(LET_PATH, path)) return 1;
+
+    snprintf(path, sizeof(path), "%s/b.h2o", the_directory);
+
+    if (!file_Copy(LET_PATH, path)) return 1;
+
+    // (what water writes without the cache)
+    if (!water_Run("--name let_wtree --output %s/plain.c --file %s/a.h2o",
+                   the_directory, the_directory)) return 1;
+
+    // a miss
+    if (!cache_Compile("miss")) return 1;
+
+    if (1 != cache_Entries(entry, sizeof(entry))) {
+        fprintf(stderr, "miss: not one entry\n");
+        return 1;
+    }
+
+    snprintf(path,  sizeof(path),  "%s/a.c",     the_directory);
+    snprintf(other, sizeof(other), "%s/plain.c", the_directory);
+
+    if (!file_Same(path, other))  return 1;
+    if (!file_Same(entry, other)) return 1;
+
+    snprintf(path,  sizeof(path),  "%s/a_names.h",     the_directory);
+    snprintf(other, sizeof(other), "%s/plain_names.h", the_directory);
+
+    if (!file_Same(path, other)) return 1;
+
+    // a hit compiles nothing, and leaves the unchanged output alone
+    snprintf(path, sizeof(path), "%s/a.c", the_directory);
+    names_Path(entry, names, sizeof(names));
+
+    if (!file_Age(entry)) return 1;
+    if (!file_Age(names)) return 1;
+    if (!file_Age(path))  return 1;
+
+    if (!cache_Compile("hit")) return 1;
+
+    if (!file_Old(entry) || !file_Old(names)) {
+        fprintf(stderr, "hit: the entry was compiled again\n");
+        return 1;
+    }
+
+    if (!file_Old(path)) {
+        fprintf(stderr, "hit: the unchanged output was written\n");
+        return 1;
+    }
+
+    // a changed output is written again
+    FILE *file = fopen(path, "a");
+
+    if (!file) return 1;
+
+    fprintf(file, "/* changed */\n");
+    fclose(file);
+
+    if (!file_Age(path))           return 1;
+    if (!cache_Compile("changed")) return 1;
+
+    if (file_Old(path)) {
+        fprintf(stderr, "changed: the output was not written\n");
+        return 1;
+    }
+
+    snprintf(other, sizeof(other), "%s/plain.c", the_directory);
+
+    if (!file_Same(path, other)) return 1;
+
+    // an entry without its _names.h is compiled again
+    if (0 != unlink(names)) return 1;
+
+    if (!cache_Compile("names")) return 1;
+
+    if (file_Old(entry)) {
+        fprintf(stderr, "names: the entry was not compiled again\n");
+        return 1;
+    }
+
+    if (!file_Same(entry, other)) return 1;
+
+    snprintf(other, sizeof(other), "%s/plain_names.h", the_directory);
+
+    if (!file_Same(names, other)) return 1;
+
+    // the same text at another path is another entry
+    if (!water_Run("--cache %s/cache --name let_wtree --output %s/b.c --file %s/b.h2o",
+                   the_directory, the_directory, the_directory)) return 1;
+
+    if (2 != cache_Entries(entry, sizeof(entry))) {
+        fprintf(stderr, "path: not two entries\n");
+        return 1;
+    }
+
+    snprintf(path, sizeof(path), "rm -rf %s", the_directory);
+
+    if (0 != system(path)) return 1;
+
+    printf("cache ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,134 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** compiling in memory: the text of let.h2o compiled with
+ ** h2o_CompileGrammar walks the let tree as the let grammar compiled to
+ ** C does, while malformed text and a grammar with a %{ } guard are
+ ** refused without writing to stdout.
+ **/
+#include "walker.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LET_PATH "let.h2o"
+
+static const char the_malformed[] = "Start = = Let |\n";
+
+static const char the_guarded[] =
+    "Start = Value\n"
+    "Value = %{ 0 == NODE->size } Value: ->@value\n";
+
+// the text of path, read into memory
+static bool text_Read(const char* path, char **text, size_t *length) {
+    FILE       *file = fopen(path, "r");
+    struct stat info;
+
+    if (!file)                          return false;
+    if (0 != fstat(fileno(file), &info)) return false;
+
+    char *start = malloc(info.st_size + 1);
+
+    if (!start) return false;
+
+    if ((size_t) info.st_size != fread(start, 1, info.st_size, file)) return false;
+
+    fclose(file);
+
+    start[info.st_size] = 0;
+
+    *text   = start;
+    *length = info.st_size;
+
+    return true;
+}
+
+// text is refused (and nothing is written to stdout)
+static bool compile_Refused(const char* what, const char* text) {
+    FILE *out   = tmpfile();
+    int   saved = dup(1);
+
+    if (!out || 0 > saved) return false;
+
+    fflush(stdout);
+
+    if (0 > dup2(fileno(out), 1)) return false;
+
+    H2oGrammar grammar = 0;
+    bool       result  = h2o_CompileGrammar("refused_wtree", text, strlen(text), &grammar);
+
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+
+    struct stat info;
+
+    if (0 != fstat(fileno(out), &info)) return false;
+
+    fclose(out);
+
+    if (result) {
+        fprintf(stderr, "%s: compiled\n", what);
+        return false;
+    }
+
+    if (info.st_size) {
+        fprintf(stderr, "%s: %ld bytes written to stdout\n", what, (long) info.st_size);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    Node_test  tree    = let_Tree();
+    H2oGrammar grammar = 0;
+    char      *text    = 0;
+    size_t     length  = 0;
+
+    if (!text_Read(LET_PATH, &text, &length)) {
+        fprintf(stderr, "unable to read %s\n", LET_PATH);
+        return 1;
+    }
+
+    if (!h2o_CompileGrammar("compiled_wtree", text, length, &grammar)) {
+        fprintf(stderr, "unable to compile %s\n", LET_PATH);
+        return 1;
+    }
+
+    // (the text is not kept by the grammar)
+    memset(text, 0, length);
+    free(text);
+
+    struct water water;
+
+    if (!walker_Registry(&water))            return 1;
+    if (!h2o_AttachGrammar(&water, grammar)) return 1;
+
+    if (!walker_Parse(&water, "Start", tree)) {
+        fprintf(stderr, "unable to parse Start\n");
+        return 1;
+    }
+
+    if (!log_Check("compiled", LET_EVENTS)) return 1;
+
+    if (!h2o_WaterFree(&water))    return 1;
+    if (!h2o_FreeGrammar(grammar)) return 1;
+
+    if (!compile_Refused("malformed", the_malformed)) return 1;
+    if (!compile_Refused("guarded",   the_guarded))   return 1;
+
+    printf("compile ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,100 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** the FIRST sets: the root labels each let rule can start with (none
+ ** kept for a rule that starts with %any), and the rules they reject
+ ** before applying them still parse as they did.
+ **/
+#include "walker.h"
+#include "let_names.h"
+
+static struct water the_walker;
+
+// the FIRST set of rule is exactly the roots (-1 ended), or none is kept
+static bool first_Is(unsigned rule, const int roots[]) {
+    H2oFirst first = let_wtree_rules.first;
+    unsigned begin = first->offsets[rule];
+    unsigned end   = first->offsets[rule + 1];
+
+    if (!roots) {
+        if (!first->codes[rule]) return true;
+        fprintf(stderr, "rule %s has a FIRST set\n", let_wtree_rules.names[rule]);
+        return false;
+    }
+
+    if (!first->codes[rule]) {
+        fprintf(stderr, "rule %s has no FIRST set\n", let_wtree_rules.names[rule]);
+        return false;
+    }
+
+    if (first->roots != &let_wtree_roots) return false;
+
+    unsigned count = 0;
+
+    for ( ; 0 <= roots[count] ; ++count) {
+        unsigned at = begin;
+
+        for ( ; at < end ; ++at) {
+            if (first->labels[at] == (unsigned) roots[count]) break;
+        }
+
+        if (at < end) continue;
+
+        fprintf(stderr, "rule %s can not start with %s\n",
+                let_wtree_rules.names[rule], let_wtree_roots.names[roots[count]]);
+        return false;
+    }
+
+    if (end - begin == count) return true;
+
+    fprintf(stderr, "rule %s starts with %u roots, not %u\n",
+            let_wtree_rules.names[rule], end - begin, count);
+
+    return false;
+}
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    if (!walker_Init(&the_walker)) return 1;
+
+    if (!let_wtree_rules.first) {
+        fprintf(stderr, "no FIRST sets\n");
+        return 1;
+    }
+
+    const int let[]    = { let_wtree_root_Let, -1 };
+    const int assign[] = { let_wtree_root_LetAssign, -1 };
+    const int value[]  = { let_wtree_root_Value, -1 };
+    const int symbol[] = { let_wtree_root_Symbol, -1 };
+
+    if (!first_Is(let_wtree_rule_Start,     0))      return 1;
+    if (!first_Is(let_wtree_rule_AnyTree,   0))      return 1;
+    if (!first_Is(let_wtree_rule_AnyLeaf,   0))      return 1;
+    if (!first_Is(let_wtree_rule_Let,       let))    return 1;
+    if (!first_Is(let_wtree_rule_LetAssign, assign)) return 1;
+    if (!first_Is(let_wtree_rule_Value,     value))  return 1;
+    if (!first_Is(let_wtree_rule_Symbol,    symbol)) return 1;
+
+    Node_test trees[LET_TREES];
+
+    let_Trees(trees);
+
+    if (!let_Parses("first", &the_walker, trees)) return 1;
+
+    if (!walker_Parse(&the_walker, "Start", trees[0])) return 1;
+
+    if (!log_Check("first", LET_EVENTS)) return 1;
+
+    printf("first ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,155 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** a forest of trees parsed over a pool of threads: the events run on
+ ** the caller's Water, in ordered mode the same events in the same
+ ** order as a parse then a run of each tree, in streaming mode the
+ ** same events in the order the trees were parsed.
+ **/
+#include "walker.h"
+
+#define FOREST_TREES   64
+#define FOREST_THREADS 4
+
+static struct water the_walker;
+static unsigned     elsewhere = 0; // events run on a Water not the caller's
+
+static bool statement_caller(Water water, H2oUserNode value) {
+    if (water != &the_walker) elsewhere += 1;
+    return log_Add("statement", value);
+}
+
+// the lines of a log, sorted (the order of trees in streaming mode is not kept)
+static int line_Compare(const void *left, const void *right) {
+    return strcmp(*(char * const *) left, *(char * const *) right);
+}
+
+static unsigned log_Lines(char *log, char *lines[], unsigned size) {
+    unsigned count = 0;
+    char    *line  = strtok(log, "\n");
+
+    for ( ; line && count < size ; line = strtok(0, "\n")) lines[count++] = line;
+
+    qsort(lines, count, sizeof(char*), line_Compare);
+
+    return count;
+}
+
+static char the_serial[TEST_LOG];
+static char the_sorted[TEST_LOG];
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    if (!walker_Registry(&the_walker))                                return 1;
+    if (!h2o_SetEvent(&the_walker, "statement", statement_caller))    return 1;
+    if (!let_wtree(&the_walker))                                      return 1;
+
+    Node_test   let = let_Tree();
+    H2oUserNode trees[FOREST_TREES];
+    bool        results[FOREST_TREES];
+    unsigned    index = 0;
+
+    // a let tree, then a value, a symbol and a statement by turns
+    const char *leaves[] = { "Value", "Symbol", "Statement" };
+
+    for ( ; index < FOREST_TREES ; ++index) {
+        if (0 == index % 4) {
+            trees[index] = (H2oUserNode) let;
+            continue;
+        }
+
+        Node_test leaf = 0;
+
+        push_tree(leaves[index % 4 - 1], 0);
+        stack_PopNode(&the_trees, &leaf);
+
+        trees[index] = (H2oUserNode) leaf;
+    }
+
+    // the events of a parse then a run of each tree
+    the_serial[0] = 0;
+
+    for (index = 0 ; index < FOREST_TREES ; ++index) {
+        if (!walker_Parse(&the_walker, "Start", trees[index])) {
+            fprintf(stderr, "unable to parse tree %u\n", index);
+            return 1;
+        }
+        strcat(the_serial, the_log);
+    }
+
+    log_Clear();
+
+    if (!h2o_ParseForest(&the_walker, "Start", trees, FOREST_TREES,
+                         FOREST_THREADS, forest_ordered, results)) {
+        fprintf(stderr, "unable to parse the ordered forest\n");
+        return 1;
+    }
+
+    if (!log_Check("ordered", the_serial)) return 1;
+
+    for (index = 0 ; index < FOREST_TREES ; ++index) {
+        if (results[index]) continue;
+        fprintf(stderr, "ordered: tree %u failed\n", index);
+        return 1;
+    }
+
+    log_Clear();
+
+    if (!h2o_ParseForest(&the_walker, "Start", trees, FOREST_TREES,
+                         FOREST_THREADS, forest_streaming, results)) {
+        fprintf(stderr, "unable to parse the streaming forest\n");
+        return 1;
+    }
+
+    static char *serial[TEST_LOG / 8];
+    static char *streamed[TEST_LOG / 8];
+
+    strcpy(the_sorted, the_serial);
+
+    unsigned expected = log_Lines(the_sorted, serial, TEST_LOG / 8);
+    unsigned found    = log_Lines(the_log, streamed, TEST_LOG / 8);
+
+    if (expected != found) {
+        fprintf(stderr, "streaming: expected %u events, found %u\n", expected, found);
+        return 1;
+    }
+
+    for (index = 0 ; index < expected ; ++index) {
+        if (!strcmp(serial[index], streamed[index])) continue;
+        fprintf(stderr, "streaming: expected %s, found %s\n", serial[index], streamed[index]);
+        return 1;
+    }
+
+    if (elsewhere) {
+        fprintf(stderr, "%u events ran on a copy of the Water\n", elsewhere);
+        return 1;
+    }
+
+    // events already queued are neither run nor lost
+    log_Clear();
+
+    if (!h2o_Parse(&the_walker, "Start", let)) return 1;
+
+    if (h2o_ParseForest(&the_walker, "Start", trees, FOREST_TREES,
+                        FOREST_THREADS, forest_ordered, results)) {
+        fprintf(stderr, "parsed a forest with events queued\n");
+        return 1;
+    }
+
+    if (!h2o_RunQueue(&the_walker)) return 1;
+
+    if (!log_Check("queued", LET_EVENTS)) return 1;
+
+    printf("forest ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
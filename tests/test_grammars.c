@@ -0,0 +1,139 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** many grammars in one process: let.h2o and pair.h2o linked side by
+ ** side, attached to one Water (the value event and Value root they
+ ** both use found once) and to a Water of their own.
+ **/
+#include "walker.h"
+
+extern bool pair_wtree(Water water);
+
+static bool pair_event(Water water __attribute__ ((unused)), H2oUserNode value) {
+    return log_Add("pair", value);
+}
+static bool leaf_event(Water water __attribute__ ((unused)), H2oUserNode value) {
+    return log_Add("leaf", value);
+}
+
+// the events, found by a call-back that counts each name asked for
+static struct {
+    const char *name;
+    H2oEvent    event;
+    unsigned    found;
+} the_events[] = {
+    { "begin",     begin_event,     0 },
+    { "end",       end_event,       0 },
+    { "value",     value_event,     0 },
+    { "assign",    assign_event,    0 },
+    { "symbol",    symbol_event,    0 },
+    { "statement", statement_event, 0 },
+    { "pair",      pair_event,      0 },
+    { "leaf",      leaf_event,      0 },
+    { 0, 0, 0 },
+};
+
+static bool find_event(Water water __attribute__ ((unused)), H2oUserName name, H2oEvent *target) {
+    unsigned index = 0;
+
+    for ( ; the_events[index].name ; ++index) {
+        if (strcmp(the_events[index].name, name)) continue;
+        the_events[index].found += 1;
+        *target = the_events[index].event;
+        return true;
+    }
+
+    return false;
+}
+
+static struct water the_both;
+static struct water the_pair;
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    memset(&the_both, 0, sizeof(struct water));
+
+    the_both.first = GetFirst_test;
+    the_both.next  = GetNext_test;
+    the_both.match = MatchNode_test;
+    the_both.event = find_event;
+
+    if (!h2o_WaterInit(&the_both, 1024)) return 1;
+
+    const char *types[] = { "Let", "LetAssign", "ParameterName", "Value", "Symbol", "Pair", 0 };
+    unsigned    index   = 0;
+
+    for ( ; types[index] ; ++index) {
+        if (!h2o_SetType(&the_both, types[index], type_Of(types[index]))) return 1;
+    }
+
+    if (!pair_wtree(&the_both)) return 1;
+    if (!let_wtree(&the_both))  return 1;
+
+    Node_test tree = let_Tree();
+
+    if (!walker_Parse(&the_both, "let_wtree.Start", tree)) {
+        fprintf(stderr, "unable to parse let_wtree.Start\n");
+        return 1;
+    }
+
+    if (!log_Check("let", LET_EVENTS)) return 1;
+
+    Node_test value = 0;
+
+    push_tree("Value", 0);
+    stack_PopNode(&the_trees, &value);
+
+    if (!walker_Parse(&the_both, "pair_wtree.Start", value)) {
+        fprintf(stderr, "unable to parse pair_wtree.Start\n");
+        return 1;
+    }
+
+    if (!log_Check("pair", "value Value\n")) return 1;
+
+    // each name was found once, for both grammars
+    for (index = 0 ; the_events[index].name ; ++index) {
+        if (1 == the_events[index].found) continue;
+        fprintf(stderr, "event %s was found %u times\n",
+                the_events[index].name, the_events[index].found);
+        return 1;
+    }
+
+    // and a grammar serves a Water of its own as well
+    if (!walker_Registry(&the_pair))                   return 1;
+    if (!h2o_SetType(&the_pair, "Pair", type_Of("Pair"))) return 1;
+    if (!h2o_SetEvent(&the_pair, "pair", pair_event))  return 1;
+    if (!h2o_SetEvent(&the_pair, "leaf", leaf_event))  return 1;
+    if (!pair_wtree(&the_pair))                        return 1;
+
+    push_tree("Pair", 0);
+
+    Node_test pair = 0;
+
+    stack_PopNode(&the_trees, &pair);
+
+    if (!walker_Parse(&the_pair, "Start", pair)) {
+        fprintf(stderr, "unable to parse Start alone\n");
+        return 1;
+    }
+
+    if (!log_Check("alone", "pair Pair\n")) return 1;
+
+    if (walker_Parse(&the_pair, "let_wtree.Start", tree)) {
+        fprintf(stderr, "parsed a grammar not attached\n");
+        return 1;
+    }
+
+    printf("grammars ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,126 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** guards: the guard grammar (its %{ } guards read the size of the test
+ ** node, so guard.c is compiled with H2O_GUARD_HEADER and H2O_GUARD_NODE)
+ ** parses a leaf or a Block of two or more, whether the guards are called
+ ** through their nodes by the interpreter or directly by the jit.
+ **/
+#include "walker.h"
+
+#define GUARD_PARSES 8
+#define GUARD_TREES  4
+
+extern bool guard_wtree(Water water);
+
+// the events of each tree (zero if it does not parse)
+static const char *guard_events[GUARD_TREES] = {
+    "begin Block\n"
+    "statement Value\n"
+    "begin Block\n"  "statement Symbol\n"  "statement Symbol\n"  "end Block\n"
+    "statement Block\n"
+    "end Block\n",
+    0,
+    0,
+    "statement Let\n",
+};
+
+static void guard_Trees(Node_test trees[GUARD_TREES]) {
+    stack_Init(100, &the_trees);
+
+    // a Block of two and an empty Block, in a Block
+    push_tree("Value", 0);
+    push_tree("Symbol", 0);
+    push_tree("Symbol", 0);
+    push_tree("Block", 2);
+    push_tree("Block", 0);
+    push_tree("Block", 3);
+    stack_PopNode(&the_trees, &trees[0]);
+
+    // a Block of one (neither guard holds)
+    push_tree("Value", 0);
+    push_tree("Block", 1);
+    stack_PopNode(&the_trees, &trees[1]);
+
+    // a Let of two (the Block guard holds, its label does not match)
+    push_tree("Value", 0);
+    push_tree("Symbol", 0);
+    push_tree("Let", 2);
+    stack_PopNode(&the_trees, &trees[2]);
+
+    // a Let of none (a leaf, as the empty Block is)
+    push_tree("Let", 0);
+    stack_PopNode(&the_trees, &trees[3]);
+}
+
+// parse every tree a few times (false at the first unexpected result)
+static bool guard_Parses(const char* what, Water water, Node_test trees[GUARD_TREES]) {
+    unsigned count = 0;
+
+    for ( ; count < GUARD_PARSES ; ++count) {
+        unsigned tree = 0;
+
+        for ( ; tree < GUARD_TREES ; ++tree) {
+            bool result = walker_Parse(water, "Start", trees[tree]);
+
+            if (!result) h2o_RunReset(water, 0);
+
+            if (result != (0 != guard_events[tree])) {
+                fprintf(stderr, "%s: parse %u of tree %u %s\n", what, count, tree,
+                        (result ? "matched" : "failed"));
+                return false;
+            }
+
+            if (!result) continue;
+
+            if (!log_Check(what, guard_events[tree])) return false;
+        }
+    }
+
+    return true;
+}
+
+static bool guard_Init(Water water) {
+    if (!walker_Registry(water))                        return false;
+    if (!h2o_SetType(water, "Block", type_Of("Block"))) return false;
+
+    return guard_wtree(water);
+}
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    Node_test trees[GUARD_TREES];
+
+    guard_Trees(trees);
+
+    struct water interpreted;
+
+    if (!guard_Init(&interpreted))                         return 1;
+    if (!guard_Parses("interpreted", &interpreted, trees)) return 1;
+    if (!h2o_WaterFree(&interpreted))                      return 1;
+
+    struct water jit;
+
+    if (!guard_Init(&jit)) return 1;
+
+    if (!h2o_EnableJit(&jit, 1)) {
+        printf("guard ok (no jit on this machine)\n");
+        return 0;
+    }
+
+    if (!guard_Parses("jit", &jit, trees)) return 1;
+    if (!h2o_WaterFree(&jit))              return 1;
+
+    printf("guard ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
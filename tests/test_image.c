@@ -0,0 +1,135 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** grammar images: let.img (water --emit=image) loaded at the base it
+ ** was laid out for, loaded again while that base is taken (so
+ ** relocated), and loaded from bytes in memory all walk the let tree
+ ** as the let grammar compiled to C does, while an image cut short or
+ ** with a header out of bounds is refused.
+ **/
+#include "walker.h"
+
+#include <sys/stat.h>
+
+#define IMAGE_PATH "let.img"
+
+// attach grammar to a fresh Water and walk the let tree with it
+static bool image_Walk(const char* what, H2oGrammar grammar, Node_test tree) {
+    struct water water;
+
+    if (!walker_Registry(&water))           return false;
+    if (!h2o_AttachGrammar(&water, grammar)) return false;
+
+    if (!walker_Parse(&water, "Start", tree)) {
+        fprintf(stderr, "%s: unable to parse Start\n", what);
+        return false;
+    }
+
+    if (!log_Check(what, LET_EVENTS)) return false;
+
+    return h2o_WaterFree(&water);
+}
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    Node_test  tree  = let_Tree();
+    H2oGrammar first = 0;
+    H2oGrammar again = 0;
+    H2oGrammar bytes = 0;
+
+    if (!h2o_LoadGrammarImage(IMAGE_PATH, &first)) {
+        fprintf(stderr, "unable to load %s\n", IMAGE_PATH);
+        return 1;
+    }
+
+    if (!image_Walk("mapped", first, tree)) return 1;
+
+    // (first still holds the preferred base)
+    if (!h2o_LoadGrammarImage(IMAGE_PATH, &again)) {
+        fprintf(stderr, "unable to load %s again\n", IMAGE_PATH);
+        return 1;
+    }
+
+    if (again->image == first->image) {
+        fprintf(stderr, "%s was mapped twice at one base\n", IMAGE_PATH);
+        return 1;
+    }
+
+    if (!image_Walk("relocated", again, tree)) return 1;
+
+    // the same image, from bytes read into memory
+    FILE       *file = fopen(IMAGE_PATH, "r");
+    struct stat info;
+
+    if (!file)                          return 1;
+    if (0 != fstat(fileno(file), &info)) return 1;
+
+    char *start = malloc(info.st_size);
+
+    if (!start) return 1;
+
+    if ((size_t) info.st_size != fread(start, 1, info.st_size, file)) return 1;
+
+    fclose(file);
+
+    if (!h2o_LoadGrammarBytes(start, info.st_size, &bytes)) {
+        fprintf(stderr, "unable to load %s from memory\n", IMAGE_PATH);
+        return 1;
+    }
+
+    free(start);
+
+    if (!image_Walk("bytes", bytes, tree)) return 1;
+
+    // a truncated image is refused
+    H2oGrammar cut = 0;
+
+    if (h2o_LoadGrammarBytes(bytes->image, bytes->size / 2, &cut)) {
+        fprintf(stderr, "loaded half an image\n");
+        return 1;
+    }
+
+    // as is a header placing the grammar across the end of the writable
+    // section, or the relocations off the alignment of a size_t
+    char *copy = malloc(bytes->size);
+
+    if (!copy) return 1;
+
+    struct water_image *header = (struct water_image *) copy;
+
+    memcpy(copy, bytes->image, bytes->size);
+    header->grammar = header->code - sizeof(struct water_grammar) / 2;
+
+    if (h2o_LoadGrammarBytes(copy, bytes->size, &cut)) {
+        fprintf(stderr, "loaded a grammar past its section\n");
+        return 1;
+    }
+
+    memcpy(copy, bytes->image, bytes->size);
+    header->relocs += 1;
+    header->rcount  = 0;
+
+    if (h2o_LoadGrammarBytes(copy, bytes->size, &cut)) {
+        fprintf(stderr, "loaded a misaligned relocation table\n");
+        return 1;
+    }
+
+    free(copy);
+
+    if (!h2o_FreeGrammar(bytes)) return 1;
+    if (!h2o_FreeGrammar(again)) return 1;
+    if (!h2o_FreeGrammar(first)) return 1;
+
+    printf("image ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
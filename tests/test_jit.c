@@ -0,0 +1,122 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** the jit: rules compiled to native code give the results and events
+ ** the interpreter does, and in lazy mode a rule compiled before one
+ ** of its names is known still finds it once it is.
+ **/
+#include "walker.h"
+
+#define JIT_PARSES 8
+
+static struct water the_walker;
+
+static char the_interpreted[TEST_LOG];
+
+// parse tree (with rule) a few times, every time giving expected
+static bool parse_Same(const char* what, const char* rule, Node_test tree,
+                       bool result, const char* expected)
+{
+    unsigned count = 0;
+
+    for ( ; count < JIT_PARSES ; ++count) {
+        if (result != walker_Parse(&the_walker, rule, tree)) {
+            fprintf(stderr, "%s: parse %u of %s %s\n", what, count, rule,
+                    (result ? "failed" : "matched"));
+            return false;
+        }
+
+        if (!log_Check(what, expected)) return false;
+    }
+
+    return true;
+}
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    if (!walker_Init(&the_walker)) return 1;
+
+    Node_test tree  = let_Tree();
+    Node_test value = 0;
+
+    push_tree("Value", 0);
+    stack_PopNode(&the_trees, &value);
+
+    // lazy, with the root of ParameterName unknown when Let first applies
+    // LetAssign (inside that rule, so not resolved by its FIRST test)
+    // (first, as the caches are the grammar's: a parse of a Water not lazy
+    //  resolves every name)
+    struct water lazy;
+
+    if (!walker_Init(&lazy))                     return 1;
+    if (!h2o_EnableLazy(&lazy, true))            return 1;
+    if (!h2o_EnableJit(&lazy, 1)) {
+        printf("jit ok (no jit on this machine)\n");
+        return 0;
+    }
+    if (!h2o_SetType(&lazy, "ParameterName", 0)) return 1;
+
+    Node_test let = 0;
+
+    push_tree("Value", 0);
+    push_tree("Symbol", 0);
+    push_tree("ParameterName", 1);
+    push_tree("LetAssign", 2);
+    push_tree("Let", 1);
+    stack_PopNode(&the_trees, &let);
+
+    log_Clear();
+
+    if (h2o_Parse(&lazy, "Let", let)) {
+        fprintf(stderr, "lazy: parsed Let without the root of ParameterName\n");
+        return 1;
+    }
+
+    h2o_RunReset(&lazy, 0);
+
+    if (!h2o_SetType(&lazy, "ParameterName", type_Of("ParameterName"))) return 1;
+
+    unsigned count = 0;
+
+    for ( ; count < JIT_PARSES ; ++count) {
+        if (!walker_Parse(&lazy, "Let", let)) {
+            fprintf(stderr, "lazy: parse %u of Let failed once its roots were known\n", count);
+            return 1;
+        }
+
+        if (!log_Check("lazy", "begin Let\n" "value Value\n" "symbol Symbol\n"
+                       "assign LetAssign\n" "end Let\n")) return 1;
+    }
+
+    // interpreted
+    if (!walker_Parse(&the_walker, "Start", tree)) return 1;
+
+    strcpy(the_interpreted, the_log);
+
+    if (!log_Check("interpreted", LET_EVENTS)) return 1;
+
+    // compiled from the first application on (then run native)
+    if (!h2o_EnableJit(&the_walker, 1)) {
+        printf("jit ok (no jit on this machine)\n");
+        return 0;
+    }
+
+    if (!parse_Same("native", "Start", tree, true, the_interpreted)) return 1;
+
+    // a rule that fails natively fails as it does interpreted
+    if (!parse_Same("native", "Let", value, false, "")) return 1;
+    if (!parse_Same("native", "Value", value, true, "value Value\n")) return 1;
+
+    printf("jit ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,108 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** lazy mode: the cache entries are resolved as the walk first uses
+ ** them, so a name missing from the registry only fails the trees that
+ ** reach it (and no longer does once it is registered).
+ **/
+#include "walker.h"
+#include "let_names.h"
+
+static struct water the_eager;
+static struct water the_lazy;
+
+// a Water over the let grammar whose registry has no statement event
+static bool lazy_Init(Water water) {
+    memset(water, 0, sizeof(struct water));
+
+    water->first = GetFirst_test;
+    water->next  = GetNext_test;
+    water->match = MatchNode_test;
+
+    if (!h2o_WaterInit(water, 1024)) return false;
+
+    const char *types[] = { "Let", "LetAssign", "ParameterName", "Value", "Symbol", 0 };
+    unsigned    index   = 0;
+
+    for ( ; types[index] ; ++index) {
+        if (!h2o_SetType(water, types[index], type_Of(types[index]))) return false;
+    }
+
+    if (!h2o_SetEvent(water, "begin",  begin_event))  return false;
+    if (!h2o_SetEvent(water, "end",    end_event))    return false;
+    if (!h2o_SetEvent(water, "value",  value_event))  return false;
+    if (!h2o_SetEvent(water, "assign", assign_event)) return false;
+    if (!h2o_SetEvent(water, "symbol", symbol_event)) return false;
+
+    return let_wtree(water);
+}
+
+#define LET_ONE                                 \
+    "begin Let\n"                               \
+    "value Value\n"  "symbol Symbol\n"  "assign LetAssign\n" \
+    "end Let\n"
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    Node_test trees[LET_TREES];
+
+    let_Trees(trees);
+
+    // resolving every name up front fails on the one missing
+    if (!lazy_Init(&the_eager)) return 1;
+
+    if (walker_Parse(&the_eager, "Let", trees[4])) {
+        fprintf(stderr, "eager: parsed without the statement event\n");
+        return 1;
+    }
+
+    h2o_RunReset(&the_eager, 0);
+
+    // resolving them on use only fails the trees that reach it
+    if (!lazy_Init(&the_lazy))              return 1;
+    if (!h2o_EnableLazy(&the_lazy, true))   return 1;
+
+    if (!walker_Parse(&the_lazy, "Let", trees[4])) {
+        fprintf(stderr, "lazy: unable to parse Let\n");
+        return 1;
+    }
+
+    if (!log_Check("lazy", LET_ONE)) return 1;
+
+    if (let_wtree_events.values[let_wtree_event_statement]) {
+        fprintf(stderr, "lazy: the statement event was resolved unused\n");
+        return 1;
+    }
+
+    if (walker_Parse(&the_lazy, "AnyLeaf", trees[1])) {
+        fprintf(stderr, "lazy: parsed AnyLeaf without the statement event\n");
+        return 1;
+    }
+
+    h2o_RunReset(&the_lazy, 0);
+
+    // (registered late, resolved on its next use)
+    if (!h2o_SetEvent(&the_lazy, "statement", statement_event)) return 1;
+
+    if (!walker_Parse(&the_lazy, "AnyLeaf", trees[1])) {
+        fprintf(stderr, "lazy: unable to parse AnyLeaf\n");
+        return 1;
+    }
+
+    if (!log_Check("late", "statement Value\n")) return 1;
+
+    if (!let_Parses("lazy", &the_lazy, trees)) return 1;
+
+    printf("lazy ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,138 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** parse limits: the let tree is parsed right at each limit (operations,
+ ** depth, events) and fails one under it, with that limit recorded in
+ ** water->exceeded and the events queued before the parse kept.
+ **/
+#include "walker.h"
+
+static struct water the_walker;
+static Node_test    the_tree;
+
+// parse the let tree from Start under limits (true if it parsed)
+static bool limit_Parse(unsigned long operations, unsigned depth, unsigned long events) {
+    struct water_limits limits = { operations, depth, events };
+
+    if (!h2o_SetLimits(&the_walker, &limits)) return false;
+
+    return walker_Parse(&the_walker, "Start", the_tree);
+}
+
+// tree parses at limit and not one under it, where limit trips as kind
+static bool limit_Trips(const char* what, bool (*parse)(unsigned long), unsigned long limit, H2oLimit kind) {
+    if (!parse(limit)) {
+        fprintf(stderr, "%s: unable to parse at %lu\n", what, limit);
+        return false;
+    }
+
+    if (!log_Check(what, LET_EVENTS)) return false;
+
+    if (limit_none != the_walker.exceeded) {
+        fprintf(stderr, "%s: a limit was exceeded at %lu\n", what, limit);
+        return false;
+    }
+
+    if (parse(limit - 1)) {
+        fprintf(stderr, "%s: parsed at %lu\n", what, limit - 1);
+        return false;
+    }
+
+    if (kind != the_walker.exceeded) {
+        fprintf(stderr, "%s: exceeded %u at %lu\n", what, the_walker.exceeded, limit - 1);
+        return false;
+    }
+
+    return true;
+}
+
+static bool operations_Parse(unsigned long limit) { return limit_Parse(limit, 0, 0); }
+static bool depth_Parse(unsigned long limit)      { return limit_Parse(0, limit, 0); }
+static bool events_Parse(unsigned long limit)     { return limit_Parse(0, 0, limit); }
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    if (!walker_Init(&the_walker)) return 1;
+
+    the_tree = let_Tree();
+
+    // (counted only under a limit)
+    if (!operations_Parse(~0UL)) return 1;
+
+    unsigned long operations = the_walker.operations;
+
+    if (!limit_Trips("operations", operations_Parse, operations, limit_operations)) return 1;
+
+    // the least depth the let tree parses in
+    unsigned long depth = 1;
+
+    for ( ; depth < 64 ; ++depth) {
+        if (depth_Parse(depth)) break;
+        h2o_RunReset(&the_walker, 0);
+    }
+
+    if (1 >= depth || 64 <= depth) {
+        fprintf(stderr, "depth: parsed at %lu\n", depth);
+        return 1;
+    }
+
+    // (the let tree queues the 20 events of LET_EVENTS)
+    if (!limit_Trips("depth",  depth_Parse,  depth, limit_depth))  return 1;
+    if (!limit_Trips("events", events_Parse, 20,    limit_events)) return 1;
+
+    // the events queued before a parse that runs into a limit are kept
+    Node_test value = 0;
+
+    push_tree("Value", 0);
+    stack_PopNode(&the_trees, &value);
+
+    if (!h2o_SetLimits(&the_walker, 0))          return 1;
+    if (!h2o_Parse(&the_walker, "Value", value)) return 1;
+
+    struct water_limits limits = { 0, 0, 2 };
+
+    if (!h2o_SetLimits(&the_walker, &limits)) return 1;
+
+    if (h2o_Parse(&the_walker, "Start", the_tree)) {
+        fprintf(stderr, "kept: parsed over the limit\n");
+        return 1;
+    }
+
+    log_Clear();
+
+    if (!h2o_RunQueue(&the_walker))          return 1;
+    if (!log_Check("kept", "value Value\n")) return 1;
+
+    h2o_RunReset(&the_walker, 0);
+
+    // a parse that fails on its own exceeds nothing
+    if (walker_Parse(&the_walker, "Let", value)) return 1;
+
+    if (limit_none != the_walker.exceeded) {
+        fprintf(stderr, "failed: exceeded %u\n", the_walker.exceeded);
+        return 1;
+    }
+
+    // and without limits the let tree parses again
+    if (!h2o_SetLimits(&the_walker, 0)) return 1;
+
+    if (!walker_Parse(&the_walker, "Start", the_tree)) {
+        fprintf(stderr, "unable to parse Start without limits\n");
+        return 1;
+    }
+
+    if (!log_Check("none", LET_EVENTS)) return 1;
+
+    printf("limits ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,140 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** hot reload: a Water joined to a live set parses the grammar last
+ ** published. reload.img publishes let.img from its %reload predicate,
+ ** in the middle of a parse; that parse finishes on reload.img and
+ ** the next one is on let.img.
+ **/
+#include "walker.h"
+
+#define RELOAD_PATH "reload.img"
+#define LET_PATH    "let.img"
+
+static struct water the_binder; // binds each version published (never joined)
+static struct water the_reader; // parses from the live set
+
+static H2oLive the_live;
+
+// what the %reload predicate saw
+static unsigned      reload_calls  = 0;
+static bool          reload_failed = false;
+static unsigned long reload_epoch  = 0;
+static unsigned long reload_linked = 0;
+
+static bool reload_predicate(Water water, H2oUserNode value __attribute__ ((unused))) {
+    if (reload_calls++) return true;
+
+    reload_epoch  = water->epoch;
+    reload_linked = water->version;
+
+    if (!h2o_ReloadGrammar(the_live, &the_binder, LET_PATH, 0)) reload_failed = true;
+
+    return true;
+}
+
+#define RELOAD_EVENTS       \
+    "begin Block\n"         \
+    "statement Let\n"       \
+    "statement Let\n"       \
+    "end Block\n"
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    Node_test tree = let_Tree();
+
+    if (!walker_Registry(&the_binder))                               return 1;
+    if (!h2o_SetType(&the_binder, "Block", type_Of("Block")))        return 1;
+    if (!h2o_SetPredicate(&the_binder, "reload", reload_predicate)) return 1;
+    if (!walker_Registry(&the_reader))                               return 1;
+
+    if (!h2o_LiveCreate(&the_live))             return 1;
+    if (!h2o_LiveJoin(the_live, &the_reader))   return 1;
+
+    // nothing published yet
+    if (walker_Parse(&the_reader, "Start", tree)) {
+        fprintf(stderr, "parsed before a grammar was published\n");
+        return 1;
+    }
+
+    if (!h2o_ReloadGrammar(the_live, &the_binder, RELOAD_PATH, 0)) {
+        fprintf(stderr, "unable to publish %s\n", RELOAD_PATH);
+        return 1;
+    }
+
+    // the parse publishes let.img as it goes, and finishes on reload.img
+    if (!walker_Parse(&the_reader, "Start", tree)) {
+        fprintf(stderr, "unable to parse Start on %s\n", RELOAD_PATH);
+        return 1;
+    }
+
+    if (reload_failed) {
+        fprintf(stderr, "unable to publish %s\n", LET_PATH);
+        return 1;
+    }
+
+    if (!log_Check("reload", RELOAD_EVENTS)) return 1;
+
+    if (!reload_epoch || !reload_linked) {
+        fprintf(stderr, "the parse was not in an epoch\n");
+        return 1;
+    }
+
+    if (the_reader.epoch) {
+        fprintf(stderr, "the parse did not leave its epoch\n");
+        return 1;
+    }
+
+    // the next parse is on let.img
+    if (!walker_Parse(&the_reader, "Start", tree)) {
+        fprintf(stderr, "unable to parse Start on %s\n", LET_PATH);
+        return 1;
+    }
+
+    if (!log_Check("let", LET_EVENTS)) return 1;
+
+    if (the_reader.version <= reload_linked) {
+        fprintf(stderr, "still linked to version %lu\n", the_reader.version);
+        return 1;
+    }
+
+    if (!walker_Parse(&the_reader, "let_wtree.Start", tree)) {
+        fprintf(stderr, "unable to parse let_wtree.Start\n");
+        return 1;
+    }
+
+    // (the rules of the version replaced are gone with it)
+    if (walker_Parse(&the_reader, "Block", tree)) {
+        fprintf(stderr, "parsed Block after %s was replaced\n", RELOAD_PATH);
+        return 1;
+    }
+
+    h2o_RunReset(&the_reader, 0);
+
+    if (1 >= reload_calls) {
+        fprintf(stderr, "%%reload was called %u times\n", reload_calls);
+        return 1;
+    }
+
+    // a live set is only freed once every Water has left it
+    if (h2o_LiveFree(the_live)) {
+        fprintf(stderr, "freed a live set still joined\n");
+        return 1;
+    }
+
+    if (!h2o_LiveLeave(the_live, &the_reader)) return 1;
+    if (!h2o_LiveFree(the_live))               return 1;
+
+    printf("live ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,188 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** the manifest (water --manifest): grammars compiled by a pool of
+ ** --jobs workers are each what water writes compiling them one at a
+ ** time, and a --jobs that is not a count of one or more is refused
+ ** (built with WATER_PATH naming water).
+ **/
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if !defined(WATER_PATH)
+#define WATER_PATH "water"
+#endif
+
+#define MANIFEST_GRAMMARS 4
+
+static const char *the_grammars[MANIFEST_GRAMMARS] = { "let", "pair", "scan", "speculate" };
+
+static char the_directory[] = "manifest.XXXXXX";
+
+// run water with these arguments (true if it succeeded)
+static bool water_Run(const char* format, ...) {
+    char    command[1024];
+    char    arguments[896];
+    va_list ap;
+
+    va_start(ap, format);
+    vsnprintf(arguments, sizeof(arguments), format, ap);
+    va_end(ap);
+
+    snprintf(command, sizeof(command), "%s %s", WATER_PATH, arguments);
+
+    return 0 == system(command);
+}
+
+// the bytes of path
+static bool file_Read(const char* path, char **text, size_t *length) {
+    FILE       *file = fopen(path, "r");
+    struct stat info;
+
+    if (!file)                          return false;
+    if (0 != fstat(fileno(file), &info)) return false;
+
+    char *start = malloc(info.st_size + 1);
+
+    if (!start) return false;
+
+    if ((size_t) info.st_size != fread(start, 1, info.st_size, file)) return false;
+
+    fclose(file);
+
+    *text   = start;
+    *length = info.st_size;
+
+    return true;
+}
+
+// do <directory>/<kind>/<grammar><suffix> and the serial one hold the same bytes
+static bool output_Same(const char* kind, const char* grammar, const char* suffix) {
+    char   path[256];
+    char   other[256];
+    char  *one    = 0;
+    char  *two    = 0;
+    size_t length = 0;
+    size_t count  = 0;
+
+    snprintf(path,  sizeof(path),  "%s/%s/%s%s",     the_directory, kind, grammar, suffix);
+    snprintf(other, sizeof(other), "%s/serial/%s%s", the_directory, grammar, suffix);
+
+    if (!file_Read(path, &one, &length)) {
+        fprintf(stderr, "%s: %s was not written\n", kind, path);
+        return false;
+    }
+
+    if (!file_Read(other, &two, &count)) return false;
+
+    bool result = (length == count) && !memcmp(one, two, length);
+
+    free(one);
+    free(two);
+
+    if (!result) fprintf(stderr, "%s: %s is not %s\n", kind, path, other);
+
+    return result;
+}
+
+// compile the grammars listed in <directory>/<kind>.list with jobs workers
+static bool manifest_Compile(const char* kind, const char* jobs) {
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/%s", the_directory, kind);
+
+    if (0 != mkdir(path, 0777)) return false;
+
+    snprintf(path, sizeof(path), "%s/%s.list", the_directory, kind);
+
+    FILE *file = fopen(path, "w");
+
+    if (!file) return false;
+
+    unsigned index = 0;
+
+    for ( ; index < MANIFEST_GRAMMARS ; ++index) {
+        const char *grammar = the_grammars[index];
+        fprintf(file, "%s_wtree %s.h2o %s/%s/%s.c\n", grammar, grammar, the_directory, kind, grammar);
+    }
+
+    if (0 != fclose(file)) return false;
+
+    if (!water_Run("--jobs %s --manifest %s", jobs, path)) {
+        fprintf(stderr, "%s: unable to compile %s\n", kind, path);
+        return false;
+    }
+
+    for (index = 0 ; index < MANIFEST_GRAMMARS ; ++index) {
+        if (!output_Same(kind, the_grammars[index], ".c"))       return false;
+        if (!output_Same(kind, the_grammars[index], "_names.h")) return false;
+    }
+
+    return true;
+}
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    char path[256];
+
+    if (!mkdtemp(the_directory)) {
+        perror(the_directory);
+        return 1;
+    }
+
+    snprintf(path, sizeof(path), "%s/serial", the_directory);
+
+    if (0 != mkdir(path, 0777)) return 1;
+
+    // (one at a time)
+    unsigned index = 0;
+
+    for ( ; index < MANIFEST_GRAMMARS ; ++index) {
+        const char *grammar = the_grammars[index];
+
+        if (water_Run("--name %s_wtree --output %s/serial/%s.c --file %s.h2o",
+                      grammar, the_directory, grammar, grammar)) continue;
+
+        fprintf(stderr, "serial: unable to compile %s.h2o\n", grammar);
+        return 1;
+    }
+
+    if (!manifest_Compile("one",  "1")) return 1;
+    if (!manifest_Compile("two",  "2")) return 1;
+    if (!manifest_Compile("many", "8")) return 1;
+
+    // (a count of no workers, or no count at all)
+    const char *refused[] = { "0", "-2", "many" };
+
+    for (index = 0 ; index < sizeof(refused) / sizeof(refused[0]) ; ++index) {
+        snprintf(path, sizeof(path), "%s/one.list", the_directory);
+
+        if (!water_Run("--jobs %s --manifest %s 2> /dev/null", refused[index], path)) continue;
+
+        fprintf(stderr, "--jobs %s was not refused\n", refused[index]);
+        return 1;
+    }
+
+    snprintf(path, sizeof(path), "rm -rf %s", the_directory);
+
+    if (0 != system(path)) return 1;
+
+    printf("manifest ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
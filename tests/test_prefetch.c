@@ -0,0 +1,126 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** prefetch: with a peek that finds nothing, or one that finds the
+ ** siblings ahead, the let rules parse the let trees as they do without
+ ** (by the match call-back and in type-id mode), and no sibling further
+ ** ahead than the distance asked for is peeked at.
+ **/
+#include "walker.h"
+
+static Node_test let_trees[LET_TREES];
+
+static unsigned peek_calls   = 0;
+static unsigned peek_longest = 0;
+
+// peeks at nothing
+static bool peek_Nothing(Water water __attribute__ ((unused)),
+                         const struct water_location *location __attribute__ ((unused)),
+                         unsigned distance,
+                         H2oUserNode *target __attribute__ ((unused)))
+{
+    peek_calls += 1;
+
+    if (distance > peek_longest) peek_longest = distance;
+
+    return false;
+}
+
+// peeks at the sibling distance ahead (as example_PeekNode)
+static bool peek_Sibling(Water water __attribute__ ((unused)),
+                         const struct water_location *location,
+                         unsigned distance,
+                         H2oUserNode *target)
+{
+    struct test_node *node = location->root;
+
+    peek_calls += 1;
+
+    if (distance > peek_longest) peek_longest = distance;
+
+    if (!node) return false;
+
+    unsigned index = (unsigned) location->offset + distance;
+
+    if (index >= node->size) return false;
+
+    *target = (H2oUserNode) node->childern[index];
+
+    return true;
+}
+
+// the let rules over the let trees with peek distance ahead
+static bool prefetch_Parses(const char* what, bool typeid, H2oPeekNode peek, unsigned distance) {
+    struct water water;
+
+    if (!walker_Init(&water)) return false;
+
+    if (typeid) {
+        water.match = 0;
+        if (!H2O_TYPE_FIELD(&water, struct test_node, type)) return false;
+    }
+
+    if (!h2o_EnablePrefetch(&water, peek, distance)) return false;
+
+    peek_calls   = 0;
+    peek_longest = 0;
+
+    if (!walker_Parse(&water, "Start", let_trees[0])) {
+        fprintf(stderr, "%s: unable to parse Start\n", what);
+        return false;
+    }
+
+    if (!log_Check(what, LET_EVENTS))         return false;
+    if (!let_Parses(what, &water, let_trees)) return false;
+
+    if (peek && !peek_calls) {
+        fprintf(stderr, "%s: nothing was peeked at\n", what);
+        return false;
+    }
+
+    if (peek_longest > distance) {
+        fprintf(stderr, "%s: peeked %u ahead\n", what, peek_longest);
+        return false;
+    }
+
+    return h2o_WaterFree(&water);
+}
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    const unsigned distances[] = { 1, 2, 4 };
+    unsigned       typeid      = 0;
+
+    let_Trees(let_trees);
+
+    for ( ; typeid < 2 ; ++typeid) {
+        if (!prefetch_Parses("off", typeid, 0, 0)) return 1;
+
+        unsigned index = 0;
+
+        for ( ; index < sizeof(distances) / sizeof(distances[0]) ; ++index) {
+            char what[64];
+
+            snprintf(what, sizeof(what), "nothing %u%s", distances[index], (typeid ? " typeid" : ""));
+
+            if (!prefetch_Parses(what, typeid, peek_Nothing, distances[index])) return 1;
+
+            snprintf(what, sizeof(what), "sibling %u%s", distances[index], (typeid ? " typeid" : ""));
+
+            if (!prefetch_Parses(what, typeid, peek_Sibling, distances[index])) return 1;
+        }
+    }
+
+    printf("prefetch ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
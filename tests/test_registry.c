@@ -0,0 +1,151 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** the default registry: names set with h2o_SetType and h2o_SetEvent,
+ ** and two grammars that both define Start. names of a kind whose
+ ** call-back is the user's (or once the Water is freed) are refused.
+ **/
+#include "walker.h"
+
+extern bool pair_wtree(Water water);
+
+static bool pair_event(Water water __attribute__ ((unused)), H2oUserNode value) {
+    return log_Add("pair", value);
+}
+static bool leaf_event(Water water __attribute__ ((unused)), H2oUserNode value) {
+    return log_Add("leaf", value);
+}
+
+// the user's own call-backs (they find nothing)
+static bool own_Code(Water water __attribute__ ((unused)),
+                     H2oUserName name __attribute__ ((unused)),
+                     H2oCode *target __attribute__ ((unused))) {
+    return false;
+}
+static bool own_Attach(Water water __attribute__ ((unused)),
+                       H2oUserName name __attribute__ ((unused)),
+                       H2oCode code __attribute__ ((unused))) {
+    return false;
+}
+static bool own_Type(Water water __attribute__ ((unused)),
+                     H2oUserName name __attribute__ ((unused)),
+                     H2oUserType *target __attribute__ ((unused))) {
+    return false;
+}
+static bool own_Event(Water water __attribute__ ((unused)),
+                      H2oUserName name __attribute__ ((unused)),
+                      H2oEvent *target __attribute__ ((unused))) {
+    return false;
+}
+static bool own_Predicate(Water water __attribute__ ((unused)),
+                          H2oUserName name __attribute__ ((unused)),
+                          H2oPredicate *target __attribute__ ((unused))) {
+    return false;
+}
+
+static bool pair_Predicate(Water water __attribute__ ((unused)), H2oUserNode value __attribute__ ((unused))) {
+    return true;
+}
+
+// none of the h2o_Set calls is taken
+static bool set_Refused(const char* what, Water water) {
+    if (h2o_SetType(water, "Pair", type_Of("Pair"))
+        || h2o_SetEvent(water, "pair", pair_event)
+        || h2o_SetPredicate(water, "pair", pair_Predicate)) {
+        fprintf(stderr, "%s: a name was set\n", what);
+        return false;
+    }
+
+    return true;
+}
+
+static struct water the_walker;
+static struct water the_own;
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    if (!walker_Init(&the_walker)) return 1;
+
+    // (attached last, so its Start is the one registered as Start)
+    if (!h2o_SetType(&the_walker, "Pair", type_Of("Pair"))) return 1;
+    if (!h2o_SetEvent(&the_walker, "pair", pair_event))     return 1;
+    if (!h2o_SetEvent(&the_walker, "leaf", leaf_event))     return 1;
+    if (!pair_wtree(&the_walker))                           return 1;
+
+    Node_test tree = let_Tree();
+
+    // the Start the let rules call is still their own
+    if (!walker_Parse(&the_walker, "let_wtree.Start", tree)) {
+        fprintf(stderr, "unable to parse let_wtree.Start\n");
+        return 1;
+    }
+
+    if (!log_Check("let_wtree.Start", LET_EVENTS)) return 1;
+
+    push_tree("Pair", 0);
+
+    Node_test pair = 0;
+
+    stack_PopNode(&the_trees, &pair);
+
+    if (!walker_Parse(&the_walker, "pair_wtree.Start", pair)) {
+        fprintf(stderr, "unable to parse pair_wtree.Start\n");
+        return 1;
+    }
+
+    if (!log_Check("pair_wtree.Start", "pair Pair\n")) return 1;
+
+    if (!walker_Parse(&the_walker, "Start", pair)) {
+        fprintf(stderr, "unable to parse Start\n");
+        return 1;
+    }
+
+    if (!log_Check("Start", "pair Pair\n")) return 1;
+
+    // a let tree is not a pair (nor a leaf)
+    if (walker_Parse(&the_walker, "pair_wtree.Start", tree)) {
+        fprintf(stderr, "pair_wtree.Start parsed a let tree\n");
+        return 1;
+    }
+
+    // the kinds whose call-backs are the user's are not the registry's
+    memset(&the_own, 0, sizeof(struct water));
+
+    the_own.type = own_Type;
+
+    if (!h2o_WaterInit(&the_own, 64))                return 1;
+    if (!h2o_SetEvent(&the_own, "pair", pair_event)) return 1;
+
+    if (h2o_SetType(&the_own, "Pair", type_Of("Pair"))) {
+        fprintf(stderr, "own type: a type was set\n");
+        return 1;
+    }
+
+    if (!h2o_WaterFree(&the_own))        return 1;
+    if (!set_Refused("freed", &the_own)) return 1;
+
+    // (nor is there a registry when every call-back is)
+    memset(&the_own, 0, sizeof(struct water));
+
+    the_own.code      = own_Code;
+    the_own.attach    = own_Attach;
+    the_own.type      = own_Type;
+    the_own.event     = own_Event;
+    the_own.predicate = own_Predicate;
+
+    if (!h2o_WaterInit(&the_own, 64))  return 1;
+    if (!set_Refused("own", &the_own)) return 1;
+
+    printf("registry ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,282 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** scanned repetitions: h2o_ScanTypes (with avx2 where the cpu has it)
+ ** finds the run a plain loop does, for type ids of each size, and the
+ ** scan grammar parses runs of siblings scanned as it does matching
+ ** them one at a time (and by the match call-back).
+ **/
+#include "walker.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern bool scan_wtree(Water water);
+
+static unsigned long the_seed = 1;
+
+// a pseudo-random number under range (the same ones each run)
+static unsigned random_Next(unsigned range) {
+    the_seed = the_seed * 6364136223846793005UL + 1442695040888963407UL;
+    return (unsigned) (the_seed >> 33) % range;
+}
+
+/* h2o_ScanTypes */
+
+// a node with its type id in fields of each size
+struct scan_node {
+    unsigned char  byte;
+    unsigned short half;
+    unsigned int   word;
+    size_t         wide;
+};
+
+#define SCAN_NODES 80
+
+// the first node whose type id is not one of ids, one node at a time
+static unsigned scan_Expected(const struct scan_node *nodes[], unsigned count,
+                              size_t offset, unsigned size,
+                              const size_t ids[], unsigned number)
+{
+    unsigned index = 0;
+
+    for ( ; index < count ; ++index) {
+        if (!nodes[index]) break;
+
+        const char *field = ((const char *) nodes[index]) + offset;
+        size_t      id    = 0;
+
+        switch (size) {
+        case 1: id = *((const unsigned char *)  field); break;
+        case 2: id = *((const unsigned short *) field); break;
+        case 4: id = *((const unsigned int *)   field); break;
+        case 8: id = *((const size_t *)         field); break;
+        }
+
+        unsigned which = 0;
+
+        for ( ; which < number ; ++which) {
+            if (id == ids[which]) break;
+        }
+
+        if (which == number) break;
+    }
+
+    return index;
+}
+
+static bool scan_Types() {
+    static struct scan_node        pool[SCAN_NODES];
+    static const struct scan_node *nodes[SCAN_NODES];
+
+    const size_t   offsets[] = { offsetof(struct scan_node, byte), offsetof(struct scan_node, half),
+                                 offsetof(struct scan_node, word), offsetof(struct scan_node, wide) };
+    const unsigned sizes[]   = { 1, 2, 4, 8 };
+
+    unsigned round = 0;
+
+    for ( ; round < 2000 ; ++round) {
+        unsigned count  = random_Next(SCAN_NODES + 1);
+        unsigned number = 1 + random_Next(4);
+        size_t   ids[5];
+        unsigned index  = 0;
+
+        for ( ; index < number ; ++index) ids[index] = 1 + random_Next(4);
+
+        // (an id wider than a field matches no node)
+        if (!random_Next(8)) ids[number++] = ((size_t) 1 << 40) + ids[0];
+
+        // runs of the ids, broken by other ids, a null node now and then
+        for (index = 0 ; index < count ; ++index) {
+            size_t id = (random_Next(16) ? ids[random_Next(number)] : 1 + random_Next(8));
+
+            pool[index].byte = (unsigned char)  id;
+            pool[index].half = (unsigned short) id;
+            pool[index].word = (unsigned int)   id;
+            pool[index].wide = id;
+
+            nodes[index] = (random_Next(64) ? &pool[index] : 0);
+        }
+
+        unsigned field = 0;
+
+        for ( ; field < 4 ; ++field) {
+            unsigned expected = scan_Expected(nodes, count, offsets[field], sizes[field], ids, number);
+            unsigned found    = h2o_ScanTypes((const H2oUserNode *) nodes, count,
+                                              offsets[field], sizes[field], ids, number);
+
+            if (expected == found) continue;
+
+            fprintf(stderr, "round %u: %u byte ids scanned to %u, not %u (of %u)\n",
+                    round, sizes[field], found, expected, count);
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* the scan grammar */
+
+static unsigned sibling_calls = 0;
+
+// the siblings from location on (as example_GetSiblings)
+static bool siblings_Test(Water water __attribute__ ((unused)),
+                          const struct water_location *location,
+                          const H2oUserNode **nodes,
+                          unsigned *count)
+{
+    struct test_node *node = location->root;
+
+    if (!node) return false;
+
+    unsigned index = (unsigned) location->offset;
+
+    if (index >= node->size) return false;
+
+    sibling_calls += 1;
+
+    *nodes = (const H2oUserNode *) &node->childern[index];
+    *count = node->size - index;
+
+    return true;
+}
+
+static bool skip_Test(Water water __attribute__ ((unused)), H2oLocation location, unsigned distance) {
+    struct test_node *node = location->root;
+
+    if (!node) return false;
+
+    unsigned index = (unsigned) location->offset + distance;
+
+    if (index >= node->size) return false;
+
+    location->offset  = (H2oUserMark) index;
+    location->current = (H2oUserNode) node->childern[index];
+
+    return true;
+}
+
+#define SCAN_TREES 300
+
+// push a Block of runs of siblings (and Blocks, depth deep)
+static bool scan_Block(unsigned depth) {
+    const char *types[] = { "Value", "Symbol", "Let", "Statement", "Block" };
+    unsigned    kinds   = (depth ? 5 : 4);
+    unsigned    runs    = random_Next(8);
+    unsigned    count   = 0;
+
+    for ( ; runs-- ; ) {
+        unsigned kind   = random_Next(kinds);
+        unsigned length = 1 + random_Next(12);
+
+        for ( ; length-- ; ++count) {
+            if (4 == kind) {
+                if (!scan_Block(depth - 1)) return false;
+            } else {
+                if (!push_tree(types[kind], 0)) return false;
+            }
+        }
+    }
+
+    return push_tree("Block", count);
+}
+
+static bool scan_Init(Water water, bool typeid, bool scan) {
+    if (!walker_Registry(water)) return false;
+
+    if (!h2o_SetType(water, "Block",     type_Of("Block")))     return false;
+    if (!h2o_SetType(water, "Statement", type_Of("Statement"))) return false;
+
+    if (typeid) {
+        water->match = 0;
+        if (!H2O_TYPE_FIELD(water, struct test_node, type)) return false;
+    }
+
+    if (scan && !h2o_EnableScan(water, siblings_Test, skip_Test)) return false;
+
+    return scan_wtree(water);
+}
+
+static struct water the_matched;
+static struct water the_stepped;
+static struct water the_scanned;
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    if (!scan_Types()) return 1;
+
+    if (!scan_Init(&the_matched, false, false)) return 1;
+    if (!scan_Init(&the_stepped, true,  false)) return 1;
+    if (!scan_Init(&the_scanned, true,  true))  return 1;
+
+    stack_Init(100, &the_trees);
+
+    char     expected[TEST_LOG];
+    unsigned parsed = 0;
+    unsigned tree   = 0;
+
+    for ( ; tree < SCAN_TREES ; ++tree) {
+        Node_test block = 0;
+
+        if (!scan_Block(2))                     return 1;
+        if (!stack_PopNode(&the_trees, &block)) return 1;
+
+        bool matched = walker_Parse(&the_matched, "Start", block);
+
+        if (!matched) h2o_RunReset(&the_matched, 0);
+
+        strcpy(expected, the_log);
+
+        struct { const char *name; Water water; } modes[] = {
+            { "stepped", &the_stepped },
+            { "scanned", &the_scanned },
+        };
+        unsigned mode = 0;
+
+        for ( ; mode < 2 ; ++mode) {
+            bool result = walker_Parse(modes[mode].water, "Start", block);
+
+            if (!result) h2o_RunReset(modes[mode].water, 0);
+
+            if (result != matched) {
+                fprintf(stderr, "tree %u: %s %s\n", tree, modes[mode].name,
+                        (result ? "parsed" : "did not parse"));
+                return 1;
+            }
+
+            char what[64];
+
+            snprintf(what, sizeof(what), "tree %u %s", tree, modes[mode].name);
+
+            if (!log_Check(what, expected)) return 1;
+        }
+
+        if (matched) parsed += 1;
+    }
+
+    // (some of each, and the runs were scanned)
+    if (!parsed || SCAN_TREES == parsed) {
+        fprintf(stderr, "%u of %u trees parsed\n", parsed, SCAN_TREES);
+        return 1;
+    }
+
+    if (!sibling_calls) {
+        fprintf(stderr, "no run was scanned\n");
+        return 1;
+    }
+
+    printf("scan ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
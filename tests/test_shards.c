@@ -0,0 +1,56 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** shards: let.h2o compiled with --shards 3 (its rules in let_shards_1.c
+ ** to let_shards_3.c) walks the let tree and parses the let trees from
+ ** each rule as the let grammar compiled to one file does.
+ **/
+#include "walker.h"
+
+extern bool let_shards(Water water);
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    Node_test    trees[LET_TREES];
+    struct water single;
+    struct water sharded;
+
+    let_Trees(trees);
+
+    if (!walker_Init(&single))       return 1;
+    if (!walker_Registry(&sharded)) return 1;
+    if (!let_shards(&sharded))      return 1;
+
+    if (!walker_Parse(&single, "Start", trees[0])) {
+        fprintf(stderr, "single: unable to parse Start\n");
+        return 1;
+    }
+
+    if (!log_Check("single", LET_EVENTS)) return 1;
+
+    if (!walker_Parse(&sharded, "Start", trees[0])) {
+        fprintf(stderr, "sharded: unable to parse Start\n");
+        return 1;
+    }
+
+    if (!log_Check("sharded", LET_EVENTS)) return 1;
+
+    if (!let_Parses("single",  &single,  trees)) return 1;
+    if (!let_Parses("sharded", &sharded, trees)) return 1;
+
+    if (!h2o_WaterFree(&sharded)) return 1;
+    if (!h2o_WaterFree(&single))  return 1;
+
+    printf("shards ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,79 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** source maps: the code of each let rule is placed where let.h2o
+ ** declares it, as "file:line:column rule" (counted from one, the
+ ** column of the '=' each rule of let.h2o is aligned to).
+ **/
+#include "walker.h"
+
+static struct water the_walker;
+
+// the place of rule is exactly expected
+static bool source_Place(const char* rule, const char* expected) {
+    H2oCode code = 0;
+
+    if (!the_walker.code(&the_walker, rule, &code)) return false;
+
+    char place[256];
+
+    if (!h2o_SourceOf(&the_walker, code, place, sizeof(place))) {
+        fprintf(stderr, "no place for %s\n", rule);
+        return false;
+    }
+
+    if (strcmp(place, expected)) {
+        fprintf(stderr, "%s is placed at %s, not %s\n", rule, place, expected);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    if (!walker_Init(&the_walker)) return 1;
+
+    unsigned rule = 0;
+
+    // (the rules of let_rules are in the order let.h2o defines them, one a line)
+    for ( ; rule < LET_RULES ; ++rule) {
+        char expected[256];
+
+        snprintf(expected, sizeof(expected), "let.h2o:%u:11 %s", rule + 1, let_rules[rule]);
+
+        if (!source_Place(let_rules[rule], expected)) return 1;
+    }
+
+    // too small a buffer, or code the grammar does not hold, has no place
+    H2oCode code = 0;
+    char    small[4];
+
+    if (!the_walker.code(&the_walker, "Start", &code)) return 1;
+
+    if (h2o_SourceOf(&the_walker, code, small, sizeof(small))) {
+        fprintf(stderr, "a place fit in %u bytes\n", (unsigned) sizeof(small));
+        return 1;
+    }
+
+    static const struct water_code stray = { water_Any, "stray" };
+    char place[256];
+
+    if (h2o_SourceOf(&the_walker, (H2oCode) &stray, place, sizeof(place))) {
+        fprintf(stderr, "stray code placed at %s\n", place);
+        return 1;
+    }
+
+    printf("source ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,128 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** speculative choice: the speculate grammar (let with a costly
+ ** predicate ahead of each alternative of Start) runs the same events
+ ** with the helpers on as without, whichever of the predicates hold.
+ **/
+#include "walker.h"
+
+#include <pthread.h>
+
+extern bool speculate_wtree(Water water);
+
+static struct water the_serial;
+static struct water the_speculative;
+
+// which of the predicates hold (read from the helpers too)
+static bool holds_a = true;
+static bool holds_b = true;
+
+// whether a predicate was called from a helper
+static pthread_t the_caller;
+static bool      helped = false;
+
+static bool slow_Test(bool *holds) {
+    volatile unsigned spin = 0;
+
+    while (spin < 20000) ++spin;
+
+    if (!pthread_equal(the_caller, pthread_self())) {
+        __atomic_store_n(&helped, true, __ATOMIC_RELAXED);
+    }
+
+    return __atomic_load_n(holds, __ATOMIC_RELAXED);
+}
+
+static bool slow_a(Water water __attribute__ ((unused)), H2oUserNode value __attribute__ ((unused))) {
+    return slow_Test(&holds_a);
+}
+static bool slow_b(Water water __attribute__ ((unused)), H2oUserNode value __attribute__ ((unused))) {
+    return slow_Test(&holds_b);
+}
+
+static bool speculate_Init(Water water) {
+    if (!walker_Registry(water))                     return false;
+    if (!h2o_SetPredicate(water, "slow_a", slow_a)) return false;
+    if (!h2o_SetPredicate(water, "slow_b", slow_b)) return false;
+
+    return speculate_wtree(water);
+}
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    Node_test trees[LET_TREES];
+
+    let_Trees(trees);
+
+    the_caller = pthread_self();
+
+    if (!speculate_Init(&the_serial))                    return 1;
+    if (!speculate_Init(&the_speculative))               return 1;
+    if (!h2o_EnableSpeculation(&the_speculative, 2))     return 1;
+
+    char     expected[TEST_LOG];
+    unsigned holds = 0;
+
+    // a holds or not, b holds or not
+    for ( ; holds < 4 ; ++holds) {
+        holds_a = (0 == (holds & 1));
+        holds_b = (0 == (holds & 2));
+
+        unsigned tree = 0;
+
+        for ( ; tree < LET_TREES ; ++tree) {
+            bool serial = walker_Parse(&the_serial, "Start", trees[tree]);
+
+            if (!serial) h2o_RunReset(&the_serial, 0);
+
+            strcpy(expected, the_log);
+
+            bool speculative = walker_Parse(&the_speculative, "Start", trees[tree]);
+
+            if (!speculative) h2o_RunReset(&the_speculative, 0);
+
+            if (serial != speculative) {
+                fprintf(stderr, "holds %u tree %u: %s speculating\n", holds, tree,
+                        (speculative ? "only parsed" : "did not parse"));
+                return 1;
+            }
+
+            char what[64];
+
+            snprintf(what, sizeof(what), "holds %u tree %u", holds, tree);
+
+            if (!log_Check(what, expected)) return 1;
+        }
+    }
+
+    if (!helped) {
+        fprintf(stderr, "no choice was speculated on\n");
+        return 1;
+    }
+
+    // (stopped, the choices run one after the other)
+    if (!h2o_EnableSpeculation(&the_speculative, 0)) return 1;
+
+    holds_a = holds_b = true;
+
+    if (!walker_Parse(&the_speculative, "Start", trees[0])) {
+        fprintf(stderr, "unable to parse Start with the helpers stopped\n");
+        return 1;
+    }
+
+    if (!log_Check("stopped", LET_EVENTS)) return 1;
+
+    printf("speculate ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
@@ -0,0 +1,97 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** resumable parses: a walk stepped one operation at a time queues the
+ ** events a parse does, and a walk stopped drops only its own events.
+ **/
+#include "walker.h"
+
+static struct water the_walker;
+
+// step the walk started to its end, a step of budget operations at a time
+static bool step_All(Water water, unsigned long budget, unsigned *steps) {
+    unsigned count = 0;
+
+    for (;;) {
+        H2oStatus status = h2o_ParseStep(water, budget);
+
+        count += 1;
+
+        if (step_suspended == status) continue;
+
+        *steps = count;
+
+        return (step_matched == status);
+    }
+}
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    if (!walker_Init(&the_walker)) return 1;
+
+    Node_test tree  = let_Tree();
+    unsigned  steps = 0;
+
+    // resumed to its end, one operation a step
+    if (!h2o_ParseStart(&the_walker, "Start", tree)) return 1;
+
+    if (!step_All(&the_walker, 1, &steps)) {
+        fprintf(stderr, "stepped walk failed\n");
+        return 1;
+    }
+
+    if (2 > steps) {
+        fprintf(stderr, "stepped walk was never suspended\n");
+        return 1;
+    }
+
+    log_Clear();
+
+    if (!h2o_RunQueue(&the_walker)) return 1;
+
+    if (!log_Check("stepped", LET_EVENTS)) return 1;
+
+    // stopped, with the events of a parse queued before it started
+    log_Clear();
+
+    if (!h2o_Parse(&the_walker, "Start", tree))         return 1;
+    if (!h2o_ParseStart(&the_walker, "Start", tree))    return 1;
+
+    if (step_suspended != h2o_ParseStep(&the_walker, 3)) {
+        fprintf(stderr, "walk not suspended\n");
+        return 1;
+    }
+
+    if (h2o_Parse(&the_walker, "Start", tree)) {
+        fprintf(stderr, "parsed while a walk was suspended\n");
+        return 1;
+    }
+
+    if (h2o_RunQueue(&the_walker)) {
+        fprintf(stderr, "ran the queue while a walk was suspended\n");
+        return 1;
+    }
+
+    if (!h2o_ParseStop(&the_walker)) return 1;
+    if (!h2o_RunQueue(&the_walker))  return 1;
+
+    if (!log_Check("stopped", LET_EVENTS)) return 1;
+
+    // and the Water parses as before
+    if (!walker_Parse(&the_walker, "Start", tree)) return 1;
+
+    if (!log_Check("after", LET_EVENTS)) return 1;
+
+    printf("step ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
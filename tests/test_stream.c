@@ -0,0 +1,100 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** a stream of trees: the events run in the order of the trees, as
+ ** h2o_Parse then h2o_RunQueue would run them, up to the first tree
+ ** that fails.
+ **/
+#include "walker.h"
+
+#define STREAM_TREES 6
+
+struct trees {
+    Node_test tree[STREAM_TREES];
+    unsigned  count;
+    unsigned  at;
+};
+
+static bool next_tree(void* data, H2oUserNode *tree) {
+    struct trees *trees = data;
+
+    if (trees->at >= trees->count) return false;
+
+    *tree = (H2oUserNode) trees->tree[trees->at++];
+
+    return true;
+}
+
+static struct water the_walker;
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    if (!walker_Init(&the_walker)) return 1;
+
+    Node_test    tree  = let_Tree();
+    struct trees trees = { { 0 }, STREAM_TREES, 0 };
+    unsigned     index = 0;
+
+    for ( ; index < STREAM_TREES ; ++index) trees.tree[index] = tree;
+
+    char expected[TEST_LOG] = { 0 };
+
+    for (index = 0 ; index < STREAM_TREES ; ++index) strcat(expected, LET_EVENTS);
+
+    log_Clear();
+
+    if (!h2o_ParseStream(&the_walker, "Start", next_tree, &trees)) {
+        fprintf(stderr, "unable to parse the stream\n");
+        return 1;
+    }
+
+    if (!log_Check("stream", expected)) return 1;
+
+    // the third tree is not a value
+    for (index = 0 ; index < STREAM_TREES ; ++index) {
+        push_tree((2 == index ? "Symbol" : "Value"), 0);
+        stack_PopNode(&the_trees, &trees.tree[index]);
+    }
+
+    trees.at = 0;
+
+    log_Clear();
+
+    if (h2o_ParseStream(&the_walker, "Value", next_tree, &trees)) {
+        fprintf(stderr, "parsed a stream with a symbol in it\n");
+        return 1;
+    }
+
+    if (!log_Check("failed stream", "value Value\n" "value Value\n")) return 1;
+
+    // events already queued are neither run nor lost
+    for (index = 0 ; index < STREAM_TREES ; ++index) trees.tree[index] = tree;
+
+    trees.at = 0;
+
+    log_Clear();
+
+    if (!h2o_Parse(&the_walker, "Start", tree)) return 1;
+
+    if (h2o_ParseStream(&the_walker, "Start", next_tree, &trees)) {
+        fprintf(stderr, "parsed a stream with events queued\n");
+        return 1;
+    }
+
+    if (!h2o_RunQueue(&the_walker)) return 1;
+
+    if (!log_Check("queued", LET_EVENTS)) return 1;
+
+    printf("stream ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
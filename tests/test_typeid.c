@@ -0,0 +1,115 @@
+/***************************
+ **
+ ** Project: Water
+ **
+ ** Routine List:
+ **    <routine-list-end>
+ **
+ ** integer type-id mode: the roots are compared with the type field of
+ ** each node (never through water->match), a type id of zero matches
+ ** no root, and a type id past the FIRST masks falls back to the rules
+ ** that start with %any.
+ **/
+#include "walker.h"
+#include "let_names.h"
+
+extern bool pair_wtree(Water water);
+
+static unsigned match_calls = 0;
+
+static bool match_counted(Water water, H2oUserType type, H2oUserNode node) {
+    match_calls += 1;
+    return MatchNode_test(water, type, node);
+}
+
+static bool pair_event(Water water __attribute__ ((unused)), H2oUserNode value) {
+    return log_Add("pair", value);
+}
+static bool leaf_event(Water water __attribute__ ((unused)), H2oUserNode value) {
+    return log_Add("leaf", value);
+}
+
+static struct water the_walker;
+
+// a leaf whose type id is type
+static Node_test leaf_Typed(size_t type) {
+    Node_test leaf = 0;
+
+    push_tree("Value", 0);
+    stack_PopNode(&the_trees, &leaf);
+
+    leaf->type = type;
+
+    return leaf;
+}
+
+int main(int    argc __attribute__ ((unused)),
+         char **argv __attribute__ ((unused)))
+{
+    if (!walker_Registry(&the_walker)) return 1;
+
+    the_walker.match = match_counted;
+
+    if (!H2O_TYPE_FIELD(&the_walker, struct test_node, type)) return 1;
+
+    // the root of Pair is left zero (as a root never resolved is)
+    if (!h2o_SetType(&the_walker, "Pair", 0))           return 1;
+    if (!h2o_SetEvent(&the_walker, "pair", pair_event)) return 1;
+    if (!h2o_SetEvent(&the_walker, "leaf", leaf_event)) return 1;
+    if (!pair_wtree(&the_walker))                       return 1;
+
+    // (attached last, so its rules are the plain names)
+    if (!let_wtree(&the_walker)) return 1;
+
+    Node_test trees[LET_TREES];
+
+    let_Trees(trees);
+
+    if (!let_Parses("typeid", &the_walker, trees)) return 1;
+
+    if (!walker_Parse(&the_walker, "let_wtree.Start", trees[0])) return 1;
+
+    if (!log_Check("typeid", LET_EVENTS)) return 1;
+
+    if (!let_wtree_rules.masks) {
+        fprintf(stderr, "typeid: no FIRST masks were built\n");
+        return 1;
+    }
+
+    // a type id of zero is not the zero root of Pair
+    Node_test zero = leaf_Typed(0);
+
+    if (walker_Parse(&the_walker, "pair_wtree.Pair", zero)) {
+        fprintf(stderr, "typeid: a type id of zero matched a zero root\n");
+        return 1;
+    }
+
+    if (!walker_Parse(&the_walker, "pair_wtree.Start", zero)) return 1;
+
+    if (!log_Check("zero", "leaf ?\n")) return 1;
+
+    // a type id past the masks starts only the rules that start with %any
+    Node_test past = leaf_Typed(100);
+
+    if (walker_Parse(&the_walker, "let_wtree.Value", past)) {
+        fprintf(stderr, "typeid: type id 100 parsed as a Value\n");
+        return 1;
+    }
+
+    if (!walker_Parse(&the_walker, "let_wtree.Start", past)) return 1;
+
+    if (!log_Check("past", "statement ?\n")) return 1;
+
+    if (match_calls) {
+        fprintf(stderr, "typeid: water->match was called %u times\n", match_calls);
+        return 1;
+    }
+
+    printf("typeid ok\n");
+
+    return 0;
+}
+
+/*****************
+ ** end of file **
+ *****************/
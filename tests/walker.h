@@ -0,0 +1,271 @@
+#if !defined(_walker_h_)
+#define _walker_h_
+////////////////////////////
+//
+// Project: Water
+// Module:  tests
+//
+// CreatedBy:
+// CreatedOn: 2010
+//
+// Purpose
+//   -- the set-up shared by the runtime tests: the let tree of
+//   -- test_let.c, a Water with the let grammar attached over the
+//   -- default registry, and a log of the events run
+//
+// Uses
+//   -- nodes.h, let.h2o
+//
+// Interface
+//   -- walker_Init, walker_Parse, let_Tree, log_Check, let_Trees, let_Parses
+//
+#include "nodes.h"
+
+/* */
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+extern bool let_wtree(Water water);
+
+// the type names, a node type is its index (from one, zero matches no node)
+#define TEST_TYPES 64
+
+static const char *the_types[TEST_TYPES];
+static size_t      type_count = 0;
+
+extern size_t symbol_Make(const CuData name) {
+    size_t index = 1;
+
+    for ( ; index <= type_count ; ++index) {
+        if (strlen(the_types[index]) != (size_t) name.length) continue;
+        if (!memcmp(the_types[index], name.start, name.length)) return index;
+    }
+
+    if (type_count + 1 >= TEST_TYPES) return 0;
+
+    the_types[++type_count] = strndup(name.start, name.length);
+
+    return type_count;
+}
+
+extern const char* symbol_Name(size_t symbol) {
+    if (!symbol || symbol > type_count) return "?";
+    return the_types[symbol];
+}
+
+static inline H2oUserType type_Of(const char* name) {
+    CuData cname = { name, strlen(name) };
+    return (H2oUserType) symbol_Make(cname);
+}
+
+// the events run, one "event type" line each
+#define TEST_LOG 8192
+
+static char     the_log[TEST_LOG];
+static unsigned log_length = 0;
+
+static inline void log_Clear() {
+    log_length  = 0;
+    the_log[0]  = 0;
+}
+
+static inline bool log_Add(const char* event, H2oUserNode value) {
+    Node_test node = (Node_test) value;
+
+    int length = snprintf(the_log + log_length, TEST_LOG - log_length,
+                          "%s %s\n", event, symbol_Name(node->type));
+
+    if (0 > length || TEST_LOG <= log_length + length) return false;
+
+    log_length += length;
+
+    return true;
+}
+
+static bool begin_event(Water water __attribute__ ((unused)), H2oUserNode value) {
+    return log_Add("begin", value);
+}
+static bool end_event(Water water __attribute__ ((unused)), H2oUserNode value) {
+    return log_Add("end", value);
+}
+static bool value_event(Water water __attribute__ ((unused)), H2oUserNode value) {
+    return log_Add("value", value);
+}
+static bool assign_event(Water water __attribute__ ((unused)), H2oUserNode value) {
+    return log_Add("assign", value);
+}
+static bool symbol_event(Water water __attribute__ ((unused)), H2oUserNode value) {
+    return log_Add("symbol", value);
+}
+static bool statement_event(Water water __attribute__ ((unused)), H2oUserNode value) {
+    return log_Add("statement", value);
+}
+
+// the events of let_Tree (as test_let prints them)
+#define LET_EVENTS                              \
+    "begin Block\n"                             \
+    "begin Let\n"                               \
+    "value Value\n"  "symbol Symbol\n"  "assign LetAssign\n" \
+    "value Value\n"  "symbol Symbol\n"  "assign LetAssign\n" \
+    "statement Statement\n"                     \
+    "end Let\n"                                 \
+    "begin Let\n"                               \
+    "value Value\n"  "symbol Symbol\n"  "assign LetAssign\n" \
+    "value Value\n"  "symbol Symbol\n"  "assign LetAssign\n" \
+    "statement Statement\n"                     \
+    "end Let\n"                                 \
+    "end Block\n"
+
+static inline bool log_Check(const char* what, const char* expected) {
+    if (!strcmp(the_log, expected)) return true;
+
+    fprintf(stderr, "%s: expected\n%s", what, expected);
+    fprintf(stderr, "%s: found\n%s", what, the_log);
+
+    return false;
+}
+
+static struct test_stack the_trees;
+
+static inline bool push_tree(const char *name, unsigned childern) {
+    CuData    cname = { name, strlen(name) };
+    Node_test value;
+
+    if (!node_Create(&value, cname, childern, &the_trees)) return false;
+
+    return stack_PushNode(&the_trees, value);
+}
+
+// the tree test_let walks without an input file
+static inline Node_test let_Tree() {
+    stack_Init(100, &the_trees);
+
+    push_tree("Value", 0);
+    push_tree("Symbol", 0);
+    push_tree("ParameterName", 1);
+    push_tree("LetAssign", 2);
+    stack_Dup(&the_trees);
+    push_tree("Statement", 0);
+    push_tree("Let", 3);
+    stack_Dup(&the_trees);
+    push_tree("Block", 2);
+
+    Node_test value = 0;
+
+    stack_PopNode(&the_trees, &value);
+
+    return value;
+}
+
+// a Water over the test nodes, its names served by the default registry
+static inline bool walker_Registry(Water water) {
+    memset(water, 0, sizeof(struct water));
+
+    water->first = GetFirst_test;
+    water->next  = GetNext_test;
+    water->match = MatchNode_test;
+
+    if (!h2o_WaterInit(water, 1024)) return false;
+
+    const char *types[] = { "Let", "LetAssign", "ParameterName", "Value", "Symbol", 0 };
+    unsigned    index   = 0;
+
+    for ( ; types[index] ; ++index) {
+        if (!h2o_SetType(water, types[index], type_Of(types[index]))) return false;
+    }
+
+    return (h2o_SetEvent(water, "begin",     begin_event)
+            && h2o_SetEvent(water, "end",       end_event)
+            && h2o_SetEvent(water, "value",     value_event)
+            && h2o_SetEvent(water, "assign",    assign_event)
+            && h2o_SetEvent(water, "symbol",    symbol_event)
+            && h2o_SetEvent(water, "statement", statement_event));
+}
+
+// ... with the let grammar attached
+static inline bool walker_Init(Water water) {
+    if (!walker_Registry(water)) return false;
+
+    return let_wtree(water);
+}
+
+// parse tree from rule and run its events into the log
+static inline bool walker_Parse(Water water, const char* rule, Node_test tree) {
+    log_Clear();
+
+    if (!h2o_Parse(water, rule, tree)) return false;
+
+    if (!h2o_RunQueue(water)) {
+        h2o_RunReset(water, 0);
+        return false;
+    }
+
+    return true;
+}
+
+// a few trees, and which of the let rules each parses from
+#define LET_TREES 5
+#define LET_RULES 7
+
+static const char *let_rules[LET_RULES] = {
+    "Start", "Let", "LetAssign", "Value", "Symbol", "AnyTree", "AnyLeaf"
+};
+
+static const bool let_parses[LET_RULES][LET_TREES] = {
+    //  block  value  symbol assign let
+    {   true,  true,  true,  true,  true  }, // Start
+    {   false, false, false, false, true  }, // Let
+    {   false, false, false, true,  false }, // LetAssign
+    {   false, true,  false, false, false }, // Value
+    {   false, false, true,  false, false }, // Symbol
+    {   true,  false, false, true,  true  }, // AnyTree
+    {   false, true,  true,  false, false }, // AnyLeaf
+};
+
+static inline void let_Trees(Node_test trees[LET_TREES]) {
+    trees[0] = let_Tree();
+
+    push_tree("Value", 0);
+    stack_PopNode(&the_trees, &trees[1]);
+
+    push_tree("Symbol", 0);
+    stack_PopNode(&the_trees, &trees[2]);
+
+    push_tree("Value", 0);
+    push_tree("Symbol", 0);
+    push_tree("ParameterName", 1);
+    push_tree("LetAssign", 2);
+    stack_Dup(&the_trees);
+    stack_PopNode(&the_trees, &trees[3]);
+
+    push_tree("Let", 1);
+    stack_PopNode(&the_trees, &trees[4]);
+}
+
+// parse every tree from every rule (false at the first unexpected result)
+static inline bool let_Parses(const char* what, Water water, Node_test trees[LET_TREES]) {
+    unsigned rule = 0;
+
+    for ( ; rule < LET_RULES ; ++rule) {
+        unsigned tree = 0;
+
+        for ( ; tree < LET_TREES ; ++tree) {
+            bool result = walker_Parse(water, let_rules[rule], trees[tree]);
+
+            if (!result) h2o_RunReset(water, 0);
+
+            if (result == let_parses[rule][tree]) continue;
+
+            fprintf(stderr, "%s: %s %s tree %u\n", what, let_rules[rule],
+                    (result ? "parsed" : "did not parse"), tree);
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#endif
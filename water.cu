@@ -50,13 +50,14 @@ operator = STAR     @zero_plus
          | COPEN NUMBER DASH NUMBER CCLOSE @range
 
 label     = LABEL | predicate
-predicate = ANY   | !LEAF PREDICATE
+predicate = ANY   | GUARD | !LEAF PREDICATE
 
 IDENTIFIER = NAME !EQUAL @identifier
 NAME       =     < name-head name-tail > !( ':' ) -
 LABEL      =     < name-head name-tail >    ':'   - @label
 EVENT      = '@' < name-head name-tail >          - @event
 PREDICATE  = '%' < name-head name-tail >          - @predicate
+GUARD      = '%{' < guard-text > '}'              - @guard
 NUMBER     = < [0-9]+ > @number -
 
 ASSIGN   = '->' blank?
@@ -79,6 +80,9 @@ ANY      = '%any' - @any
 
 
 
+## a C expression (braces nest)
+guard-text = ( '{' guard-text '}' | !( '{' | '}' ) . )*
+
 name-head  = ( [a-zA-Z] )+
 name-tail  = ( [-_]? ( [a-zA-Z0-9] )+ )*
 
@@ -34,6 +34,7 @@ along with Water.  If not, see <http://www.gnu.org/licenses/>.
 //   --
 //
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef void                  *H2oUserNode;
 typedef void                  *H2oUserMark;
@@ -43,6 +44,13 @@ typedef struct water_location *H2oLocation;
 typedef struct water_code     *H2oCode;
 typedef struct water_thread   *H2oThread;
 typedef struct water_cache    *H2oCache;
+typedef struct water_grammar  *H2oGrammar;
+typedef struct water_source   *H2oSource;
+typedef struct water_link     *H2oLink;
+typedef struct water_registry *H2oRegistry;
+typedef struct water_live     *H2oLive;
+typedef struct water_speculate *H2oSpeculate;
+typedef struct water_steps     *H2oSteps;
 typedef struct water          *Water;
 
 /* fetch the first child of this node (if any)*/
@@ -51,6 +59,12 @@ typedef bool (*H2oGetFirst)(Water, H2oLocation);
 typedef bool (*H2oGetNext)(Water, H2oLocation);
 /* fetch the match root type*/
 typedef bool (*H2oMatchNode)(Water, H2oUserType, H2oUserNode);
+/* fetch the sibling distance after this location (without moving it) */
+typedef bool (*H2oPeekNode)(Water, const struct water_location*, unsigned distance, H2oUserNode*);
+/* fetch the siblings from this location on (when they are in one array) */
+typedef bool (*H2oGetSiblings)(Water, const struct water_location*, const H2oUserNode **nodes, unsigned *count);
+/* move this location distance siblings on */
+typedef bool (*H2oSkipNodes)(Water, H2oLocation, unsigned distance);
 
 /* user defined predicate */
 /* these are ONLY call while traversing the tree */
@@ -72,6 +86,20 @@ struct water_location {
     H2oUserNode    current; // the current node
 };
 
+// the limits of one parse (zero is no limit, see h2o_SetLimits)
+struct water_limits {
+    unsigned long operations; // vm operations
+    unsigned      depth;      // operations nested in one another
+    unsigned long events;     // events queued
+};
+
+typedef enum water_limit {
+    limit_none,
+    limit_operations,
+    limit_depth,
+    limit_events,
+} H2oLimit;
+
 struct water {
     /* call-backs */
     H2oGetFirst      first;
@@ -88,9 +116,46 @@ struct water {
     H2oThread begin;
     H2oThread end;
     H2oThread free_list;
-    H2oCache  cache;
+    H2oLink   caches;    // the caches of every grammar attached (see h2o_AddCache)
+    H2oLink   sources;   // where the code was written (see h2o_SourceOf)
+    H2oRegistry registry; // the default call-backs (see h2o_WaterInit)
+    unsigned  jit;       // applications of a rule before it is compiled (zero is off)
+    bool      lazy;      // resolve cache entries on first use (see h2o_EnableLazy)
+    H2oSpeculate speculate; // the helpers of costly choices (see h2o_EnableSpeculation)
+    H2oSteps  steps;     // the resumable walk in progress (see h2o_ParseStart)
+    H2oPeekNode peek;    // a sibling ahead (see h2o_EnablePrefetch)
+    unsigned  lookahead; // the siblings ahead to prefetch (zero is off)
+    H2oGetSiblings siblings; // the siblings as an array (see h2o_EnableScan)
+    H2oSkipNodes   skip;
+
+    /* hot reload (see h2o_LiveJoin) */
+    H2oLive       live;    // parse the grammar published there
+    unsigned long version; // the version the caches are linked to (its epoch)
+    H2oLink       linked;  // the links of that version (ahead of the others)
+    Water         reader;  // the next Water joined to live
+    unsigned long epoch;   // the epoch of the parse in progress (zero when idle)
+
+    /* limits (see h2o_SetLimits) */
+    struct water_limits limits;
+    bool          limited;    // a limit is set
+    unsigned long operations; // done by the parse in progress
+    unsigned long queued;     // events queued by the parse in progress
+    H2oLimit      exceeded;   // the limit the last parse ran into (if any)
+
+    /* integer type ids (see h2o_TypeField) */
+    size_t    type_offset; // where the type id is in each node
+    unsigned  type_size;   // the size of the type id (zero is off)
 };
 
+// in integer type-id mode
+// - the H2oUserType of a root is the type id (cast to a pointer)
+// - a node matches a root when its type id is equal
+// - water->match is not called
+// - type id zero matches no node (a zero H2oUserType is a root that was
+//   never resolved), so number the node types from one
+#define H2O_TYPE_FIELD(water, type, field) \
+    h2o_TypeField((water), offsetof(type, field), sizeof(((type *) 0)->field))
+
 /*-------------------------------------------------------------------*/
 #ifdef H2o_ARRAY_NODE_EXAMPLE
 
@@ -150,6 +215,57 @@ static bool example_MatchNode(Water water,  H2oUserType utype, H2oUserNode unode
     return type == node->type;
 }
 
+// the same test without the call-back
+// - H2O_TYPE_FIELD(water, struct example_node, type);
+
+// the siblings ahead are in the same array (see h2o_EnablePrefetch)
+static bool example_PeekNode(Water water, const struct water_location *location,
+                             unsigned distance, H2oUserNode *target) {
+    struct example_node *node = location->root;
+
+    if (!node) return false;
+
+    unsigned index = (unsigned) location->offset + distance;
+
+    if (index >= node->size) return false;
+
+    *target = (H2oUserNode) node->childern[index];
+
+    return true;
+}
+
+// the siblings are that array (see h2o_EnableScan)
+static bool example_GetSiblings(Water water, const struct water_location *location,
+                                const H2oUserNode **nodes, unsigned *count) {
+    struct example_node *node = location->root;
+
+    if (!node) return false;
+
+    unsigned index = (unsigned) location->offset;
+
+    if (index >= node->size) return false;
+
+    *nodes = (const H2oUserNode *) &node->childern[index];
+    *count = node->size - index;
+
+    return true;
+}
+
+static bool example_SkipNodes(Water water, H2oLocation location, unsigned distance) {
+    struct example_node *node = location->root;
+
+    if (!node) return false;
+
+    unsigned index = (unsigned) location->offset + distance;
+
+    if (index >= node->size) return false;
+
+    location->offset  = (H2oUserMark) index;
+    location->current = (H2oUserNode) node->childern[index];
+
+    return true;
+}
+
 #endif
 /*-------------------------------------------------------------------*/
 
@@ -179,6 +295,9 @@ typedef enum water_operation {
     water_Range,
     water_End,  // is this the and
 
+    // inline C (in generated C files only)
+    water_Guard,
+
     water_Void
 } H2oOperation;
 
@@ -194,6 +313,9 @@ typedef struct water_chain    *H2oChain;
 typedef struct water_function *H2oFunction;
 typedef struct water_action   *H2oAction;
 typedef struct water_group    *H2oGroup;
+typedef struct water_first    *H2oFirst;
+typedef struct water_guard    *H2oGuard;
+typedef struct water_index    *H2oIndex;
 
 // used by
 // - water_Any
@@ -254,12 +376,151 @@ struct water_group {
     unsigned     maximum; // zero means until GetNext returns false
 };
 
+// used by
+// - water_Guard
+// (a guard reading its node is compiled with H2O_GUARD_NODE, see the README)
+struct water_guard {
+    H2oOperation oper;
+    const char*  label;
+    H2oPredicate test;    // the %{ expression } compiled into the grammar
+};
+
 struct water_cache {
     H2oCacheType type;
-    H2oCache     next;
     unsigned     count;
     const char **names;
     void       **values;
+    void        *native;  // jit state (see h2o_jit.c)
+    H2oFirst     first;   // rule_cache only (if any)
+    unsigned long long *masks; // rule_cache in type-id mode: the ids each rule may start with (if any, built once)
+    H2oIndex     index;   // a perfect hash over names (if any)
+    bool         bound;   // the values were bound by index (see h2o_BindEvents)
+    bool         loaded;  // every value has been resolved (see h2o_Parse)
+};
+
+// a grammar may be attached to many Waters, and a Water may hold many
+// grammars, so the Water keeps its caches and sources in links
+// (one of cache or source is set)
+struct water_link {
+    H2oLink   next;
+    H2oCache  cache;
+    H2oSource source;
+};
+
+// a minimal perfect hash over the names of a cache (emitted by the compiler)
+// - a name is in bucket h2o_Hash(name) % buckets
+// - and at slot h2o_Mix(h2o_Hash(name), seeds[bucket]) % count
+// - slots[slot] is the index of the only name that may be there
+struct water_index {
+    unsigned        buckets;
+    const unsigned *seeds;
+    const unsigned *slots;
+};
+
+// FNV-1a (64 bits, so names only collide by accident past billions)
+static inline unsigned long long h2o_HashText(const char *text, unsigned length) {
+    unsigned long long hash = 14695981039346656037ull;
+
+    for ( ; length-- ; ++text) {
+        hash ^= (unsigned char) *text;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static inline unsigned long long h2o_Hash(const char *name) {
+    unsigned long long hash = 14695981039346656037ull;
+
+    for ( ; *name ; ++name) {
+        hash ^= (unsigned char) *name;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static inline unsigned long long h2o_Mix(unsigned long long hash, unsigned seed) {
+    unsigned long long value = hash ^ (seed * 0x9e3779b97f4a7c15ull);
+
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+
+    return value;
+}
+
+// the FIRST sets of the rules in a rule cache
+// - rule i can only succeed on a node matching one of the roots
+//   labels[offsets[i]] .. labels[offsets[i + 1] - 1],
+//   while it is bound to codes[i]
+// - codes[i] is zero for rules that can not be pruned
+struct water_first {
+    H2oCache        roots;    // the cache the labels index
+    const unsigned *offsets;  // count + 1 offsets into labels
+    const unsigned *labels;   // root indices
+    const H2oCode  *codes;    // the code each set describes
+};
+
+// where the nodes of a grammar were written
+// - places[i] is the node labelled L<first + i>
+//   (its code is zero when that label is not a node)
+struct water_place {
+    H2oCode     code;
+    const char *rule;    // the enclosing rule
+    unsigned    line;
+    unsigned    column;
+};
+
+struct water_source {
+    const char               *file;   // the grammar source
+    unsigned                  first;  // the label number of places[0]
+    unsigned                  count;
+    const struct water_place *places;
+};
+
+// a compiled grammar
+// - the rules it defines
+// - the caches its code references
+struct water_grammar {
+    const char  *name;
+    unsigned     count;      // number of rules
+    const char **names;      // rule names
+    const char **qualified;  // rule names prefixed by the grammar name ("name.rule")
+    H2oCode     *codes;      // rule codes
+    H2oCache     rules;
+    H2oCache     roots;
+    H2oCache     events;
+    H2oCache     predicates;
+    H2oSource    source;     // where the code was written (if any)
+    void        *image;      // the mapping backing this grammar (if any)
+    size_t       size;       // the size of the mapping
+    void        *library;    // the shared object backing this grammar (if any)
+};
+
+// the header of a grammar image (see h2o_image.c)
+//
+// [header][data (writable)][code (read-only)][relocations]
+//
+// every pointer in the image is written as if loaded at base,
+// relocations list the offset of each pointer for when it is not.
+#define H2O_IMAGE_MAGIC   "H2oImage"
+#define H2O_IMAGE_VERSION 6
+
+struct water_image {
+    char     magic[8];
+    unsigned version;
+    unsigned pointer;  // sizeof(void*) of the writer
+    size_t   base;     // preferred load address
+    size_t   size;     // size of the image in bytes
+    size_t   align;    // section alignment (a multiple of the page size)
+    size_t   data;     // offset of the writable section
+    size_t   code;     // offset of the read-only section
+    size_t   relocs;   // offset of the relocation table
+    size_t   rcount;   // number of relocations
+    size_t   grammar;  // offset of the struct water_grammar
 };
 
 static inline const char* oper2text(H2oOperation oper) {
@@ -284,15 +545,156 @@ static inline const char* oper2text(H2oOperation oper) {
     case water_Maybe     : return "Maybe";
     case water_Range     : return "Range";
     case water_End       : return "End";
+    case water_Guard     : return "Guard";
     default: break;
     }
     return "unknown";
 }
 
+// the call-backs left zero (code, attach, type, event and predicate)
+// are served by a registry filled with h2o_AddName and h2o_Set*
 extern bool h2o_WaterInit(Water, unsigned cacheSize);
+extern bool h2o_WaterFree(Water);
+extern bool h2o_SetType(Water, H2oUserName, H2oUserType);
+extern bool h2o_SetEvent(Water, H2oUserName, H2oEvent);
+extern bool h2o_SetPredicate(Water, H2oUserName, H2oPredicate);
+
+// bind every value of a cache at once, from a table laid out by the
+// enums of the header water writes beside the C file (<base>_names.h)
+// - count must be the size of the cache, and no event or predicate may be zero
+// - a bound cache is no longer looked up by name
+// - the values are kept in the cache, as those resolved by name are: a
+//   binding holds for every Water the grammar is attached to, so a
+//   cache is bound once, before its first parse
+extern bool h2o_BindTypes(H2oCache, const H2oUserType table[], unsigned count);
+extern bool h2o_BindEvents(H2oCache, const H2oEvent table[], unsigned count);
+extern bool h2o_BindPredicates(H2oCache, const H2oPredicate table[], unsigned count);
+
+// the first parse resolves the names of each attached cache once
+// - the rules a grammar defines are filled in when it is registered
+// - a name already resolved by another grammar of the Water is reused
+// - a grammar attached to several Waters shares its values with them
 extern bool h2o_Parse(Water, const char* rule, H2oUserNode tree);
 extern bool h2o_RunQueue(Water);
 
+typedef enum water_order {
+    forest_ordered,    // the events of each tree run in input order, one tree at a time
+    forest_streaming,  // the events of a tree run as soon as it is parsed (one tree at a time)
+} H2oOrder;
+
+// parse many trees over a pool of threads, each with its own copy of
+// water (its call-backs, modes and grammars), balanced by work stealing
+// - results[i] (if results is not zero) is whether tree i parsed and
+//   its events ran; true is returned when every tree did
+// - threads zero is one per processor
+// - the events run on water (from whichever thread parsed the tree),
+//   which may have no events queued (run or reset them first)
+// - water may not be joined to a live set (see h2o_LiveJoin)
+extern bool h2o_ParseForest(Water, const char* rule, H2oUserNode trees[], unsigned count,
+                            unsigned threads, H2oOrder order, bool results[]);
+
+// the next tree of a stream (false at its end)
+typedef bool (*H2oNextTree)(void* data, H2oUserNode *tree);
+
+// parse a stream of trees in two stages: while the events of a tree
+// run on the calling thread, the next trees are matched on another
+// (with its own copy of water, next is called there)
+// - the events run in the order of the trees, as h2o_Parse then h2o_RunQueue would
+// - it stops at the first tree that fails to parse or whose events fail
+// - water may have no events queued (run or reset them first)
+// - water may not be joined to a live set (see h2o_LiveJoin)
+extern bool h2o_ParseStream(Water, const char* rule, H2oNextTree next, void* data);
+
+typedef enum water_status {
+    step_failed,
+    step_matched,    // the events are queued (see h2o_RunQueue)
+    step_suspended,  // call h2o_ParseStep again to go on
+} H2oStatus;
+
+// a resumable parse: h2o_ParseStart sets up the walk of tree and each
+// h2o_ParseStep runs at most budget operations of it. the walk keeps
+// its state in water between steps, so many walks (one per Water) may
+// be interleaved on one thread.
+// - h2o_ParseStop drops a suspended walk
+// - while a walk is suspended h2o_Parse and h2o_RunQueue refuse water
+//   (the events queued before h2o_ParseStart stay queued until it ends)
+// - with the jit on, the native code of a rule runs between counts
+// - water may not be joined to a live set (see h2o_LiveJoin)
+extern bool      h2o_ParseStart(Water, const char* rule, H2oUserNode tree);
+extern H2oStatus h2o_ParseStep(Water, unsigned long budget);
+extern bool      h2o_ParseStop(Water);
+
+extern bool h2o_LoadGrammarImage(const char* path, H2oGrammar *target);
+extern bool h2o_LoadGrammarBytes(const void* bytes, size_t size, H2oGrammar *target);
+extern bool h2o_LoadGrammarLibrary(const char* path, const char* name, H2oGrammar *target);
+
+// compile grammar text straight into a runnable grammar (no C compiler)
+// - the same as water --emit=image, without the file
+// - free it with h2o_FreeGrammar
+extern bool h2o_CompileGrammar(const char* name, const char* text, size_t length, H2oGrammar *target);
+extern bool h2o_AttachGrammar(Water, H2oGrammar);
+extern bool h2o_FreeGrammar(H2oGrammar);
+
+// hot reload: the Waters joined to a live set parse whatever grammar
+// was last published to it. a parse in progress finishes on the version
+// it started with; a replaced version is freed once no parse that could
+// see it is still running (each joined Water records the epoch it
+// entered h2o_Parse in).
+// - h2o_Publish binds the grammar with water (its call-backs and modes)
+//   before any parse can see it, and owns it from then on
+// - h2o_ReloadGrammar loads and publishes a grammar image, or the
+//   <name>_grammar of a shared object when name is not zero
+//   (give each version of a shared object its own path)
+extern bool h2o_LiveCreate(H2oLive *target);
+extern bool h2o_LiveJoin(H2oLive, Water);
+extern bool h2o_LiveLeave(H2oLive, Water);
+extern bool h2o_Publish(H2oLive, Water, H2oGrammar);
+extern bool h2o_ReloadGrammar(H2oLive, Water, const char* path, const char* name);
+extern bool h2o_LiveReclaim(H2oLive);
+extern bool h2o_LiveFree(H2oLive);
+
+extern bool h2o_EnableJit(Water, unsigned threshold);
+
+// in lazy mode h2o_Parse resolves no names up front: each cache entry
+// is fetched the first time it is used and kept. a name that cannot be
+// found only fails the operations that use it.
+extern bool h2o_EnableLazy(Water, bool);
+
+// in speculative mode an Or or Select whose alternatives both apply a
+// predicate or guard (before any rule) runs the second alternative on
+// a helper thread, over a copy of the cursor and with its own events,
+// while the first runs here. the events of the second are only kept
+// when the first fails, as an ordered choice requires.
+// - threads is the number of helpers (zero stops them)
+// - the predicates and guards must be safe to call from any thread
+// - enable it before the rules are compiled (see h2o_EnableJit)
+extern bool h2o_EnableSpeculation(Water, unsigned threads);
+extern bool h2o_TypeField(Water, size_t offset, unsigned size);
+
+// prefetch the sibling distance ahead of each node a repetition (or
+// any other step to a next sibling) moves to, and its type id in
+// type-id mode, so it is in cache by the time it is matched
+// - peek must be cheap (see example_PeekNode), zero distance is off
+extern bool h2o_EnablePrefetch(Water, H2oPeekNode peek, unsigned distance);
+
+// in type-id mode a repetition (zero+, one+ or range) of a root, or of
+// a choice of roots, scans the siblings array for the end of its run
+// (several type ids at a time where the cpu can) instead of matching
+// one sibling at a time
+// - siblings gives the array from a location on, skip moves a location
+//   along it (see example_GetSiblings and example_SkipNodes)
+// - the run scanned counts as one operation (see h2o_SetLimits)
+extern bool h2o_EnableScan(Water, H2oGetSiblings siblings, H2oSkipNodes skip);
+
+// bound each parse (zero limits is none): a parse that runs into a
+// limit fails, drops the events it queued and leaves the limit in
+// water->exceeded (limit_none after any other parse)
+// - with the jit on, native code counts the rules it applies
+extern bool h2o_SetLimits(Water, const struct water_limits *limits);
+
+// write "file:line:column rule" for code into buffer
+extern bool h2o_SourceOf(Water, H2oCode, char *buffer, unsigned size);
+
 extern unsigned h2o_global_debug;
 extern void     h2o_debug(const char *filename, unsigned int linenum, const char *format, ...);
 extern void     h2o_error(const char *filename, unsigned int linenum, const char *format, ...);
@@ -334,6 +736,34 @@ static inline void h2o_noop() { return; }
 // used internally ONLY
 extern bool h2o_AddName(Water, const char*, const H2oCode);
 extern bool h2o_AddCache(Water, H2oCache);
+extern bool h2o_AddSource(Water, H2oSource);
+extern bool h2o_RegistryInit(Water, unsigned size);
+extern bool h2o_RegistryBind(Water, H2oCache, bool *bound);
+extern bool h2o_FindIndex(H2oCache, const char*, unsigned long long hash, unsigned *index);
+extern bool h2o_BindGrammar(Water, H2oGrammar);
+extern bool h2o_LoadCaches(Water);
+extern bool h2o_ParseCode(Water, H2oCode, H2oUserNode tree);
+extern bool h2o_WalkCode(Water, H2oCode, H2oUserNode tree);
+extern bool h2o_LiveParse(Water, const char* rule, H2oUserNode tree);
+extern void h2o_JitFree(H2oCache);
+
+typedef bool (*H2oNative)(Water, unsigned level);
+
+extern bool h2o_JitEntry(Water, H2oAction, H2oCode, H2oNative*);
+extern void *h2o_CacheValue(Water, H2oCache, unsigned index);
+extern bool h2o_Run(Water, unsigned level, H2oCode);
+extern bool h2o_RunApply(Water, unsigned level, H2oAction);
+extern bool h2o_RunEvent(Water, H2oAction);
+extern void h2o_RunReset(Water, H2oThread end);
+extern void h2o_RunFree(Water);
+extern void h2o_RunAppend(Water, Water from);
+extern bool h2o_Speculative(Water, H2oCode);
+extern bool h2o_SpeculateOr(Water, unsigned level, H2oChain, bool *result);
+extern void h2o_SpeculateWait(Water);
+extern void h2o_SpeculateStop(Water);
+extern void h2o_StepCount(Water);
+extern unsigned h2o_ScanTypes(const H2oUserNode nodes[], unsigned count, size_t offset, unsigned size,
+                              const size_t ids[], unsigned number);
 
 /////////////////////
 // end of file
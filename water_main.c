@@ -24,27 +24,462 @@ along with Water.  If not, see <http://www.gnu.org/licenses/>.
 #include <libgen.h>
 #include <getopt.h>
 #include <stdbool.h>
-
-/* */
-unsigned int h2o_global_debug = 0;
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 /* */
 static char*  program_name = 0;
 
+// where compiled grammars are kept by content hash (if any)
+static const char* cache_directory = 0;
+
+// split the C output of each grammar over this many files
+static unsigned shard_count = 1;
+
+// one grammar to compile
+struct water_job {
+    char *name;
+    char *infile;
+    char *outfile;
+    bool  result;
+};
+
+// the grammars of a manifest
+struct water_jobs {
+    struct water_job *list;
+    unsigned          count;
+    unsigned          allocated;
+    unsigned          next;     // the next job to start
+    H2oEmit           emit;
+};
+
 static void usage(char *name)
 {
-    fprintf(stderr, "usage: water  [--verbose]+ --name c_func_name [--output outfile] [--file infile]\n");
-    fprintf(stderr, "water [-v]+ -n c_func_name [-o outfile] [-f infile]\n");
+    fprintf(stderr, "usage: water  [--verbose]+ --name c_func_name [--emit=c|image] [--cache dir] [--shards count] [--output outfile] [--file infile]\n");
+    fprintf(stderr, "water [-v]+ -n c_func_name [-e c|image] [-c cachedir] [-s count] [-o outfile] [-f infile]\n");
+    fprintf(stderr, "water [-v]+ [-e c|image] [-c cachedir] [-s count] [-j jobs] -m manifest\n");
     fprintf(stderr, "water [--help]\n");
     fprintf(stderr, "water [-h]\n");
     fprintf(stderr, "where <option> can be\n");
     fprintf(stderr, "  -h|--help    print this help information\n");
     fprintf(stderr, "  -v|--verbose be verbose\n");
+    fprintf(stderr, "  -e|--emit    c     write a C file (the default)\n");
+    fprintf(stderr, "               image write a grammar image for h2o_LoadGrammarImage\n");
+    fprintf(stderr, "  -m|--manifest compile every grammar listed in the manifest,\n");
+    fprintf(stderr, "                one 'c_func_name infile outfile' per line\n");
+    fprintf(stderr, "  -j|--jobs    the number of grammars compiled at once (default: one per cpu)\n");
+    fprintf(stderr, "  -c|--cache   reuse (and keep) compiled grammars in this directory;\n");
+    fprintf(stderr, "               an unchanged <outfile> is not rewritten\n");
+    fprintf(stderr, "  -s|--shards  split the rules of the C output over <count> files:\n");
+    fprintf(stderr, "               <outfile> keeps the registration, <base>.h the shared\n");
+    fprintf(stderr, "               declarations and <base>_1.c .. <base>_<count>.c the rules\n");
+    fprintf(stderr, "               (where <base> is <outfile> without its .c)\n");
+    fprintf(stderr, "C output also writes <base>_names.h, the rule, root, event and\n");
+    fprintf(stderr, "predicate indexes for binding by index (see h2o_BindEvents)\n");
     fprintf(stderr, "if no <infile> is given, input is read from stdin\n");
     fprintf(stderr, "if no <oufile> is given, output is written to stdou\n");
     exit(1);
 }
 
+static bool compile_Parse(const char* infile,
+                          const char* outfile,
+                          const char* funcname,
+                          H2oEmit     emit)
+{
+    H2oParser water = 0;
+
+    if (!water_Create(infile, outfile, &water)) {
+        fprintf(stderr, "unable to create parser\n");
+        return false;
+    }
+
+    if (1 < shard_count && !water_Shards(water, shard_count)) {
+        fprintf(stderr, "unable to shard %s\n", funcname);
+        water_Free(water);
+        return false;
+    }
+
+    bool result = water_Parse(water, funcname, emit);
+
+    if (!water_Free(water)) {
+        fprintf(stderr, "unable to free parser\n");
+        return false;
+    }
+
+    return result;
+}
+
+// FNV-1a (64 bit)
+static inline uint64_t hash_Bytes(uint64_t hash, const void *start, size_t length) {
+    const unsigned char *at = start;
+
+    for ( ; length-- ; ++at) {
+        hash ^= *at;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static bool read_File(const char* path, char **start, size_t *length) {
+    FILE *file = fopen(path, "r");
+
+    if (!file) return false;
+
+    char  *buffer    = 0;
+    size_t used      = 0;
+    size_t allocated = 0;
+
+    for ( ; ; ) {
+        if (used >= allocated) {
+            allocated = (allocated ? allocated * 2 : 64 * 1024);
+            char *grow = realloc(buffer, allocated);
+            if (!grow) {
+                free(buffer);
+                fclose(file);
+                return false;
+            }
+            buffer = grow;
+        }
+
+        size_t count = fread(buffer + used, 1, allocated - used, file);
+
+        if (0 >= count) break;
+
+        used += count;
+    }
+
+    bool result = !ferror(file);
+
+    fclose(file);
+
+    if (!result) {
+        free(buffer);
+        return false;
+    }
+
+    *start  = buffer;
+    *length = used;
+
+    return true;
+}
+
+// does path hold exactly these bytes
+static bool file_Same(const char* path, const char *start, size_t length) {
+    struct stat info;
+
+    if (0 != stat(path, &info))  return false;
+    if (length != (size_t) info.st_size) return false;
+
+    char  *other = 0;
+    size_t count = 0;
+
+    if (!read_File(path, &other, &count)) return false;
+
+    bool result = (count == length) && !memcmp(start, other, length);
+
+    free(other);
+
+    return result;
+}
+
+// the name path is written under before it is renamed (one per thread)
+static bool temp_Path(const char* path, char *target, size_t size) {
+    int length = snprintf(target, size, "%s.%d.%lx.tmp",
+                          path, (int) getpid(), (unsigned long) pthread_self());
+
+    if (0 <= length && (size_t) length < size) return true;
+
+    fprintf(stderr, "%s: path too long\n", path);
+
+    return false;
+}
+
+// replace path with these bytes (never a partial file)
+static bool file_Write(const char* path, const char *start, size_t length) {
+    char temp[PATH_MAX];
+
+    if (!temp_Path(path, temp, sizeof(temp))) return false;
+
+    FILE *file = fopen(temp, "w");
+
+    if (!file) {
+        perror(temp);
+        return false;
+    }
+
+    bool result = (length == fwrite(start, 1, length, file));
+
+    if (0 != fclose(file)) result = false;
+
+    if (result && 0 != rename(temp, path)) {
+        perror(path);
+        result = false;
+    }
+
+    if (!result) unlink(temp);
+
+    return result;
+}
+
+// compile through the cache
+// - the entry is named by a hash of the source, its path (the output
+//   names it in the source map), the function name, the compiler
+//   version and the kind of output
+// - outfile is only written when its contents would change
+static bool compile_Cached(const char* infile,
+                           const char* outfile,
+                           const char* funcname,
+                           H2oEmit     emit)
+{
+    char  *source = 0;
+    size_t length = 0;
+
+    if (!read_File(infile, &source, &length)) {
+        perror(infile);
+        return false;
+    }
+
+    uint64_t key = 14695981039346656037ULL;
+
+    key = hash_Bytes(key, source, length);
+    key = hash_Bytes(key, infile, strlen(infile) + 1);
+    key = hash_Bytes(key, funcname, strlen(funcname) + 1);
+    key = hash_Bytes(key, WATER_VERSION, strlen(WATER_VERSION) + 1);
+    key = hash_Bytes(key, &emit, sizeof(emit));
+
+    free(source);
+
+    char entry[PATH_MAX];
+    int  written = snprintf(entry, sizeof(entry), "%s/%016llx.%s",
+                            cache_directory,
+                            (unsigned long long) key,
+                            (emit_image == emit ? "img" : "c"));
+
+    if (0 > written || sizeof(entry) <= (size_t) written) {
+        fprintf(stderr, "%s: path too long\n", cache_directory);
+        return false;
+    }
+
+    char names[PATH_MAX + 16];
+
+    water_NamesPath(entry, names, sizeof(names));
+
+    struct stat info;
+
+    // (an entry from before companion headers has none)
+    if (0 != stat(entry, &info) || (emit_ccode == emit && 0 != stat(names, &info))) {
+        char temp[PATH_MAX];
+
+        if (!temp_Path(entry, temp, sizeof(temp))) return false;
+
+        if (!compile_Parse(infile, temp, funcname, emit)) {
+            unlink(temp);
+            return false;
+        }
+
+        // the companion header is kept beside the entry
+        if (emit_ccode == emit) {
+            char from[PATH_MAX + 16];
+
+            water_NamesPath(temp, from, sizeof(from));
+
+            if (0 != rename(from, names)) {
+                perror(names);
+                unlink(from);
+                unlink(temp);
+                return false;
+            }
+        }
+
+        if (0 != rename(temp, entry)) {
+            perror(entry);
+            unlink(temp);
+            return false;
+        }
+    } else {
+        if (0 < h2o_global_debug) {
+            printf("%s found in cache %s\n", infile, entry);
+        }
+    }
+
+    char  *output = 0;
+    size_t size   = 0;
+
+    if (!read_File(entry, &output, &size)) {
+        perror(entry);
+        return false;
+    }
+
+    bool result = true;
+
+    if (!file_Same(outfile, output, size)) {
+        result = file_Write(outfile, output, size);
+    }
+
+    free(output);
+
+    if (!result || emit_ccode != emit) return result;
+
+    char target[PATH_MAX + 16];
+
+    water_NamesPath(outfile, target, sizeof(target));
+
+    if (!read_File(names, &output, &size)) {
+        perror(names);
+        return false;
+    }
+
+    if (!file_Same(target, output, size)) {
+        result = file_Write(target, output, size);
+    }
+
+    free(output);
+
+    return result;
+}
+
+static bool compile_Grammar(const char* infile,
+                            const char* outfile,
+                            const char* funcname,
+                            H2oEmit     emit)
+{
+    // the cache keeps single files
+    if (cache_directory && infile && outfile && 1 >= shard_count) {
+        return compile_Cached(infile, outfile, funcname, emit);
+    }
+
+    return compile_Parse(infile, outfile, funcname, emit);
+}
+
+static void* compile_Worker(void *value) {
+    struct water_jobs *jobs = value;
+
+    for ( ; ; ) {
+        unsigned index = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED);
+
+        if (index >= jobs->count) return 0;
+
+        struct water_job *job = &jobs->list[index];
+
+        job->result = compile_Grammar(job->infile, job->outfile, job->name, jobs->emit);
+    }
+}
+
+static bool read_Manifest(const char* filename, struct water_jobs *jobs) {
+    FILE *file = fopen(filename, "r");
+
+    if (!file) {
+        perror(filename);
+        return false;
+    }
+
+    char    *line      = 0;
+    size_t   allocated = 0;
+    unsigned number    = 0;
+    bool     result    = true;
+
+    while (0 <= getline(&line, &allocated, file)) {
+        char *save = 0;
+
+        ++number;
+
+        char *name = strtok_r(line, " \t\r\n", &save);
+
+        if (!name)        continue;
+        if ('#' == *name) continue;
+
+        char *infile  = strtok_r(0, " \t\r\n", &save);
+        char *outfile = strtok_r(0, " \t\r\n", &save);
+
+        if (!infile || !outfile || strtok_r(0, " \t\r\n", &save)) {
+            fprintf(stderr, "%s[%u] expected: c_func_name infile outfile\n", filename, number);
+            result = false;
+            break;
+        }
+
+        if (jobs->count >= jobs->allocated) {
+            unsigned          size = (jobs->allocated ? jobs->allocated * 2 : 64);
+            struct water_job *list = realloc(jobs->list, sizeof(struct water_job) * size);
+            if (!list) {
+                result = false;
+                break;
+            }
+            jobs->list      = list;
+            jobs->allocated = size;
+        }
+
+        struct water_job *job = &jobs->list[jobs->count++];
+
+        job->name    = strdup(name);
+        job->infile  = strdup(infile);
+        job->outfile = strdup(outfile);
+        job->result  = false;
+    }
+
+    free(line);
+    fclose(file);
+
+    return result;
+}
+
+// compile every grammar of the manifest on a pool of threads
+static bool compile_Manifest(const char* manifest, unsigned count, H2oEmit emit) {
+    struct water_jobs jobs;
+
+    memset(&jobs, 0, sizeof(jobs));
+
+    jobs.emit = emit;
+
+    if (!read_Manifest(manifest, &jobs)) return false;
+
+    if (0 >= count) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        count = (0 < cpus ? cpus : 1);
+    }
+
+    if (count > jobs.count) count = jobs.count;
+
+    pthread_t workers[count + 1];
+    unsigned  started = 0;
+
+    for ( ; started < count ; ++started) {
+        if (0 != pthread_create(&workers[started], 0, compile_Worker, &jobs)) break;
+    }
+
+    // with no threads the work is done here
+    if (0 >= started) compile_Worker(&jobs);
+
+    unsigned index = 0;
+
+    for ( ; index < started ; ++index) {
+        pthread_join(workers[index], 0);
+    }
+
+    bool result = true;
+
+    for (index = 0 ; index < jobs.count ; ++index) {
+        struct water_job *job = &jobs.list[index];
+        if (!job->result) {
+            fprintf(stderr, "unable to compile %s\n", job->infile);
+            result = false;
+        }
+        free(job->name);
+        free(job->infile);
+        free(job->outfile);
+    }
+
+    free(jobs.list);
+
+    return result;
+}
+
 int main(int argc, char **argv)
 {
     program_name = basename(argv[0]);
@@ -52,6 +487,9 @@ int main(int argc, char **argv)
     const char* infile   = 0;
     const char* outfile  = 0;
     const char* funcname = 0;
+    const char* manifest = 0;
+    H2oEmit     emit     = emit_ccode;
+    unsigned    jobs     = 0;
 
     unsigned do_trace  = 0;
     unsigned do_debug  = 0;
@@ -63,6 +501,11 @@ int main(int argc, char **argv)
         {"file",    1, 0, 'f'},
         {"output",  1, 0, 'o'},
         {"name",    1, 0, 'n'},
+        {"emit",    1, 0, 'e'},
+        {"manifest", 1, 0, 'm'},
+        {"jobs",    1, 0, 'j'},
+        {"cache",   1, 0, 'c'},
+        {"shards",  1, 0, 's'},
         {"version", 0, 0,  1},
         {0, 0, 0, 0}
     };
@@ -71,7 +514,7 @@ int main(int argc, char **argv)
     int option_index = 0;
 
     while (-1 != ( chr = getopt_long(argc, argv,
-                                     "vthf:n:o:",
+                                     "vthf:n:o:e:m:j:c:s:",
                                      long_options,
                                      &option_index)))
         {
@@ -101,6 +544,41 @@ int main(int argc, char **argv)
                     funcname = optarg;
                     break;
 
+                case 'e':
+                    if (!strcmp(optarg, "c")) {
+                        emit = emit_ccode;
+                    } else if (!strcmp(optarg, "image")) {
+                        emit = emit_image;
+                    } else {
+                        fprintf(stderr, "invalid emit %s\n", optarg);
+                        exit(1);
+                    }
+                    break;
+
+                case 'm':
+                    manifest = optarg;
+                    break;
+
+                case 'j':
+                    if (1 > atoi(optarg)) {
+                        fprintf(stderr, "invalid jobs %s\n", optarg);
+                        exit(1);
+                    }
+                    jobs = atoi(optarg);
+                    break;
+
+                case 'c':
+                    cache_directory = optarg;
+                    break;
+
+                case 's':
+                    if (1 > atoi(optarg)) {
+                        fprintf(stderr, "invalid shards %s\n", optarg);
+                        exit(1);
+                    }
+                    shard_count = atoi(optarg);
+                    break;
+
                 case 1:
                     {
                         printf("water version %s\n", WATER_VERSION);
@@ -120,23 +598,31 @@ int main(int argc, char **argv)
     cu_global_debug  = do_trace;
     h2o_global_debug = do_debug;
 
-    if (!funcname) {
-        fprintf(stderr, "a function name MUST be defined\n");
-        exit(1);
+    if (cache_directory) {
+        if (0 != mkdir(cache_directory, 0777) && EEXIST != errno) {
+            perror(cache_directory);
+            exit(1);
+        }
     }
 
+    if (1 < shard_count && emit_ccode != emit) {
+        fprintf(stderr, "only C output can be sharded\n");
+        exit(1);
+    }
 
-    H2oParser water = 0;
+    if (manifest) {
+        if (!compile_Manifest(manifest, jobs, emit)) {
+            exit(1);
+        }
+        return 0;
+    }
 
-    if (!water_Create(infile, outfile, &water)) {
-        fprintf(stderr, "unable to create parser\n");
+    if (!funcname) {
+        fprintf(stderr, "a function name MUST be defined\n");
         exit(1);
     }
 
-    water_Parse(water, funcname);
-
-    if (!water_Free(water)) {
-        fprintf(stderr, "unable to free parser\n");
+    if (!compile_Grammar(infile, outfile, funcname, emit)) {
         exit(1);
     }
 